@@ -0,0 +1,22 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <defines.h>
+#include <beatmap.h>
+
+
+typedef int (*bench_f)(int argc, const char* argv[]);
+
+int bench_playfield(int argc, const char* argv[]);
+int bench_raster(int argc, const char* argv[]);
+int bench_decode(int argc, const char* argv[]);
+int bench_preview(int argc, const char* argv[]);
+int bench_waveform(int argc, const char* argv[]);
+int bench_onset(int argc, const char* argv[]);
+
+// One minute of alternating jumptrill chords with long notes, at the given density
+void bench_make_chart(beatmap_t* beatmap, int columns, int notes_per_minute);
+void bench_destroy_chart(beatmap_t* beatmap);
+
+
+#endif
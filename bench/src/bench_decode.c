@@ -0,0 +1,74 @@
+#include <bench.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <decoder.h>
+#include <timer.h>
+#define SCOPE_NAME "bench"
+#include <logging.h>
+
+#define BENCH_RUNS 3
+
+
+static double _decode(decoder_t* decoder, const char* filepath, float* frames, int threads, uint64_t* count);
+
+
+int bench_decode(int argc, const char* argv[]) {
+    const char* filepath = (argc > 1) ? argv[1] : NULL;
+    int max_threads = (argc > 2) ? atoi(argv[2]) : 8;
+    if (!filepath || max_threads < 1) {
+        printf("Usage: decode <audio file> [max threads]\n");
+        return -1;
+    }
+
+    decoder_t decoder;
+    if (!decoder_open(&decoder, filepath, NULL))
+        return -1;
+
+    size_t size = decoder.frame_count * DECODER_CHANNELS * sizeof(float);
+    float* reference = malloc(size);
+    float* frames = malloc(size);
+    if (!reference || !frames) {
+        LOG("Failed to allocate the PCM buffers");
+        free(reference);
+        free(frames);
+        decoder_close(&decoder);
+        return -1;
+    }
+
+    uint64_t reference_count;
+    double base = _decode(&decoder, filepath, reference, 1, &reference_count);
+
+    printf("%.1f s at %d Hz, best of %d runs\n", decoder_length(&decoder), decoder.sample_rate, BENCH_RUNS);
+    printf("%8s | %10s %8s %8s | %s\n", "threads", "seconds", "speedup", "x real", "output");
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        uint64_t count;
+        double time = (threads == 1) ? base : _decode(&decoder, filepath, frames, threads, &count);
+        bool is_exact = threads == 1 || (count == reference_count && memcmp(frames, reference, count * DECODER_CHANNELS * sizeof(float)) == 0);
+        printf(
+            "%8d | %10.3f %8.2f %8.0f | %s\n",
+            threads,
+            time,
+            base / time,
+            decoder_length(&decoder) / time,
+            (is_exact) ? "identical" : "DIFFERS"
+        );
+    }
+
+    free(reference);
+    free(frames);
+    decoder_close(&decoder);
+    return 0;
+}
+
+double _decode(decoder_t* decoder, const char* filepath, float* frames, int threads, uint64_t* count) {
+    double best = 1e9;
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        double start = timer_now();
+        *count = decoder_decode_all(decoder, filepath, frames, threads);
+        best = min(best, timer_now() - start);
+    }
+    return best;
+}
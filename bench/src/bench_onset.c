@@ -0,0 +1,77 @@
+#include <bench.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <raylib.h>
+
+#include <onset.h>
+#include <timer.h>
+#define SCOPE_NAME "bench"
+#include <logging.h>
+
+
+static bool _check(const char* filepath, const char* cache_directory, double* time, double* length);
+
+
+int bench_onset(int argc, const char* argv[]) {
+    if (argc < 3) {
+        printf("Usage: onset <cache directory|-> <.osu file>...\n");
+        return -1;
+    }
+    const char* cache_directory = (argv[1][0] == '-') ? NULL : argv[1];
+
+    // charts of the same song share the envelope, only the first one of them computes it
+    double total_time = 0, total_length = 0;
+    int checked = 0;
+    for (int i = 2; i < argc; i++) {
+        double time, length;
+        if (!_check(argv[i], cache_directory, &time, &length))
+            continue;
+        total_time += time;
+        total_length += length;
+        checked++;
+    }
+
+    printf(
+        "%d of %d charts checked, %.1f s of music in %.3f s, %.0fx real time\n",
+        checked,
+        argc - 2,
+        total_length,
+        total_time,
+        (total_time > 0) ? total_length / total_time : 0
+    );
+    return 0;
+}
+
+bool _check(const char* filepath, const char* cache_directory, double* time, double* length) {
+    beatmap_t beatmap;
+    if (!beatmap_load(filepath, &beatmap, false))
+        return false;
+
+    // the audio file is named relative to the chart
+    char audio_filepath[512];
+    snprintf(audio_filepath, STACKARRAY_SIZE(audio_filepath), "%s/%s", GetDirectoryPath(filepath), beatmap.audio_filename);
+
+    double start = timer_now();
+    onset_envelope_t envelope;
+    if (!onset_envelope_get(audio_filepath, cache_directory, &envelope)) {
+        beatmap_destroy(&beatmap);
+        return false;
+    }
+    *time = timer_now() - start;
+    *length = (double)envelope.count / envelope.rate;
+
+    onset_report_t report;
+    bool ok = onset_check(&beatmap, &envelope, &report);
+    printf("%s [%s]: %.3f s\n", beatmap.title, beatmap.difname, *time);
+    if (ok)
+        onset_report_print(&report);
+    else
+        printf("  no clear beat\n");
+
+    onset_report_destroy(&report);
+    onset_envelope_destroy(&envelope);
+    beatmap_destroy(&beatmap);
+    return ok;
+}
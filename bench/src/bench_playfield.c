@@ -0,0 +1,96 @@
+#include <bench.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <gameplay.h>
+#include <playfield.h>
+#include <playfield_gl.h>
+#include <timer.h>
+#define SCOPE_NAME "bench"
+#include <logging.h>
+
+#define BENCH_DURATION 60
+#define BENCH_FPS 240
+
+
+typedef struct result_s {
+    double  build_time;     // seconds per frame
+    double  mean_quads;
+    int     max_quads;
+    int     max_draw_calls; // estimated from max_quads, there is no GL context to count them
+} result_t;
+
+static result_t _run(const beatmap_t* beatmap, bool merge_notes);
+
+
+int bench_playfield(int argc, const char* argv[]) {
+    static const int densities[] = { 1000, 10000, 25000, 50000, 100000, 200000 };
+    int columns = (argc > 1) ? atoi(argv[1]) : 4;
+    if (columns < 1 || columns > INPUT_MAX_COLUMNS) {
+        printf("Column count must be within 1..%d\n", INPUT_MAX_COLUMNS);
+        return -1;
+    }
+
+    printf("%dK, %d s at %d fps, quads per frame, draw calls estimated from the quads\n", columns, BENCH_DURATION, BENCH_FPS);
+    printf("%10s | %-5s | %10s %10s %10s %6s | %10s\n", "notes/min", "lod", "quads", "max quads", "max verts", "~draws", "us/frame");
+
+    for (int i = 0; i < STACKARRAY_SIZE(densities); i++) {
+        beatmap_t beatmap;
+        bench_make_chart(&beatmap, columns, densities[i]);
+
+        for (int lod = 0; lod <= 1; lod++) {
+            result_t r = _run(&beatmap, lod);
+            printf(
+                "%10d | %-5s | %10.1f %10d %10d %6d | %10.2f\n",
+                densities[i],
+                (lod) ? "on" : "off",
+                r.mean_quads,
+                r.max_quads,
+                r.max_quads * 4,
+                r.max_draw_calls,
+                r.build_time * 1e6
+            );
+        }
+
+        bench_destroy_chart(&beatmap);
+    }
+    return 0;
+}
+
+result_t _run(const beatmap_t* beatmap, bool merge_notes) {
+    result_t result = {0};
+    gameplay_t gameplay;
+    playfield_t playfield;
+
+    gameplay_load(&gameplay, beatmap, true, NULL);
+    playfield_init(&playfield, &gameplay, 280, 480);
+    playfield.merge_notes = merge_notes;
+
+    int frames = BENCH_DURATION * BENCH_FPS;
+    double total_quads = 0;
+    double build_time = 0;
+
+    for (int frame = 0; frame < frames; frame++) {
+        double pos = (double)frame / BENCH_FPS;
+        gameplay_update(&gameplay, pos);
+
+        double start = timer_now();
+        playfield_build(&playfield, &gameplay.state, pos);
+        build_time += timer_now() - start;
+
+        int quads = kv_size(playfield.quads);
+        total_quads += quads;
+        result.max_quads = max(result.max_quads, quads);
+    }
+
+    result.build_time = build_time / frames;
+    result.mean_quads = total_quads / frames;
+    // what playfield_gl_draw() splits the quads into, one call per PLAYFIELD_GL_MAX_QUADS
+    result.max_draw_calls = (result.max_quads + PLAYFIELD_GL_MAX_QUADS - 1) / PLAYFIELD_GL_MAX_QUADS;
+
+    playfield_destroy(&playfield);
+    gameplay_destroy(&gameplay);
+    return result;
+}
@@ -0,0 +1,111 @@
+#include <bench.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <raylib.h>
+
+#include <preview.h>
+#include <timer.h>
+#define SCOPE_NAME "bench"
+#include <logging.h>
+
+// Time on an item while scrolling, shorter than any decode
+#define BENCH_SCROLL_STEP 0.005
+#define BENCH_DWELL 1.0
+
+
+static void _select(const preview_item_t* items, int count, int index, double* worst, double* sum);
+static void _dwell(const char* label, int started);
+
+
+int bench_preview(int argc, const char* argv[]) {
+    int count = argc - 1;
+    if (count < 1) {
+        printf("Usage: preview <audio files...>\n");
+        return -1;
+    }
+
+    // one item per preview point, so a few files make a long list
+    int item_count = count * 8;
+    preview_item_t* items = malloc(item_count * sizeof(preview_item_t));
+    if (!items)
+        return -1;
+    for (int i = 0; i < item_count; i++)
+        items[i] = (preview_item_t){ argv[1 + i % count], (i < count) ? -1 : 5.0 * (i / count) };
+
+    SetTraceLogLevel(LOG_WARNING);
+    InitAudioDevice();
+    if (!preview_init(".")) {
+        CloseAudioDevice();
+        free(items);
+        return -1;
+    }
+
+    double worst = 0, sum = 0;
+    printf("%d items, %.0f ms per item while scrolling\n", item_count, BENCH_SCROLL_STEP * 1000);
+
+    int started = preview_stats().started;
+    _select(items, item_count, 0, &worst, &sum);
+    _dwell("first item", started);
+
+    for (int i = 1; i < item_count; i++) {
+        started = preview_stats().started;
+        _select(items, item_count, i, &worst, &sum);
+        timer_sleep(BENCH_SCROLL_STEP);
+    }
+    _dwell("after scrolling down", started);
+
+    // the neighbours were prefetched while the last item played
+    started = preview_stats().started;
+    _select(items, item_count, item_count - 2, &worst, &sum);
+    _dwell("previous item", started);
+    started = preview_stats().started;
+    _select(items, item_count, item_count - 1, &worst, &sum);
+    _dwell("back again", started);
+
+    preview_stats_t stats = preview_stats();
+    printf(
+        "preview_select(): %.3f ms max, %.3f ms mean\n",
+        worst * 1000,
+        sum / stats.selects * 1000
+    );
+    printf(
+        "%d selections, %d started, %d/%d from cached heads, %d loads cancelled, %.1f ms max latency\n",
+        stats.selects,
+        stats.started,
+        stats.head_hits,
+        stats.head_hits + stats.head_misses,
+        stats.cancelled,
+        stats.max_latency * 1000
+    );
+
+    preview_shutdown();
+    CloseAudioDevice();
+    free(items);
+    return 0;
+}
+
+void _select(const preview_item_t* items, int count, int index, double* worst, double* sum) {
+    preview_item_t neighbours[2];
+    int neighbour_count = 0;
+    if (index + 1 < count)
+        neighbours[neighbour_count++] = items[index + 1];
+    if (index > 0)
+        neighbours[neighbour_count++] = items[index - 1];
+
+    double start = timer_now();
+    preview_select(&items[index], neighbours, neighbour_count);
+    double time = timer_now() - start;
+    *worst = max(*worst, time);
+    *sum += time;
+}
+
+void _dwell(const char* label, int started) {
+    timer_sleep(BENCH_DWELL);
+    preview_stats_t stats = preview_stats();
+    if (stats.started > started)
+        printf("%-24s started after %.1f ms\n", label, stats.last_latency * 1000);
+    else
+        printf("%-24s did not start\n", label);
+}
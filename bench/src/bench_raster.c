@@ -0,0 +1,74 @@
+#include <bench.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <raylib.h>
+
+#include <gameplay.h>
+#include <playfield.h>
+#include <raster.h>
+#include <render_soft.h>
+#include <timer.h>
+#define SCOPE_NAME "bench"
+#include <logging.h>
+
+#define BENCH_DURATION 60
+#define BENCH_FPS 60
+#define BENCH_EXPORT_EVERY BENCH_FPS
+
+
+int bench_raster(int argc, const char* argv[]) {
+    int density = (argc > 1) ? atoi(argv[1]) : 10000;
+    const char* out_dir = (argc > 2) ? argv[2] : NULL;
+    if (density <= 0) {
+        printf("Usage: raster [notes per minute] [png directory]\n");
+        return -1;
+    }
+
+    beatmap_t beatmap;
+    gameplay_t gameplay;
+    playfield_t playfield;
+    raster_t raster;
+
+    bench_make_chart(&beatmap, 4, density);
+    gameplay_load(&gameplay, &beatmap, true, NULL);
+    playfield_init(&playfield, &gameplay, 280, 480);
+    if (!raster_init(&raster, playfield.width, playfield.height)) {
+        LOG("Failed to allocate the framebuffer");
+        return -1;
+    }
+
+    int frames = BENCH_DURATION * BENCH_FPS;
+    double render_time = 0;
+    uint64_t hash = 0;
+
+    for (int frame = 0; frame < frames; frame++) {
+        double pos = (double)frame / BENCH_FPS;
+        gameplay_update(&gameplay, pos);
+
+        double start = timer_now();
+        render_soft_frame(&raster, &playfield, &gameplay.state, pos);
+        render_time += timer_now() - start;
+
+        hash = hash * 31 + raster_hash(&raster);
+        if (out_dir && frame % BENCH_EXPORT_EVERY == 0)
+            ExportImage(raster_image(&raster), TextFormat("%s/frame_%05d.png", out_dir, frame));
+    }
+
+    printf(
+        "%d notes/min, %d frames of %dx%d: %.2f us/frame, hash %016llx\n",
+        density,
+        frames,
+        raster.width,
+        raster.height,
+        render_time / frames * 1e6,
+        (unsigned long long)hash
+    );
+
+    raster_destroy(&raster);
+    playfield_destroy(&playfield);
+    gameplay_destroy(&gameplay);
+    bench_destroy_chart(&beatmap);
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <bench.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <waveform.h>
+#include <timer.h>
+#define SCOPE_NAME "bench"
+#include <logging.h>
+
+#define BENCH_WIDTH 1920
+#define BENCH_FRAMES 1000
+
+
+static double _load(const char* filepath, const char* cache_directory, waveform_t* waveform);
+
+
+int bench_waveform(int argc, const char* argv[]) {
+    const char* filepath = (argc > 1) ? argv[1] : NULL;
+    const char* cache_directory = (argc > 2) ? argv[2] : "cache";
+    if (!filepath) {
+        printf("Usage: waveform <audio file> [cache directory]\n");
+        return -1;
+    }
+
+    // the first load builds and stores the pyramid, unless an earlier run did already
+    waveform_t waveform;
+    double first = _load(filepath, cache_directory, &waveform);
+    waveform_destroy(&waveform);
+    double cached = _load(filepath, cache_directory, &waveform);
+    if (first < 0 || cached < 0)
+        return -1;
+
+    double length = (double)waveform.frame_count / waveform.sample_rate;
+    int buckets = 0;
+    for (int i = 0; i < waveform.level_count; i++)
+        buckets += waveform.counts[i];
+    printf(
+        "%.1f s, %d levels, %.1f KiB, first load %.3f s, cached %.3f s\n",
+        length,
+        waveform.level_count,
+        buckets * sizeof(waveform_bucket_t) / 1024.0,
+        first,
+        cached
+    );
+
+    // a frame scrolls through the song at every zoom, from the whole song on screen to single frames
+    static waveform_column_t columns[BENCH_WIDTH];
+    printf("%12s | %12s\n", "pixels/s", "us/frame");
+    for (double zoom = BENCH_WIDTH / length; zoom <= waveform.sample_rate * 4; zoom *= 8) {
+        double start = timer_now();
+        for (int i = 0; i < BENCH_FRAMES; i++)
+            waveform_columns(&waveform, length * i / BENCH_FRAMES, zoom, columns, BENCH_WIDTH);
+        printf("%12.1f | %12.2f\n", zoom, (timer_now() - start) / BENCH_FRAMES * 1e6);
+    }
+
+    waveform_destroy(&waveform);
+    return 0;
+}
+
+double _load(const char* filepath, const char* cache_directory, waveform_t* waveform) {
+    double start = timer_now();
+    if (!waveform_load(waveform, filepath, cache_directory))
+        return -1;
+    while (!waveform_is_ready(waveform)) {
+        if (timer_now() - start > 60) {
+            LOG("Waveform did not load");
+            return -1;
+        }
+        timer_sleep(0.001);
+    }
+    return timer_now() - start;
+}
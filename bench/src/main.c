@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <logging.h>
+#include <defines.h>
+
+#include <bench.h>
+
+
+static const struct {
+    const char* name;
+    bench_f     run;
+    const char* description;
+} s_benches[] = {
+    { "playfield", bench_playfield, "note layout on synthetic dense charts, with and without LOD" },
+    { "raster",    bench_raster,    "headless software rendering, frame hashes and optional PNGs" },
+    { "decode",    bench_decode,    "full decode of an audio file on 1 to N threads, checked against one thread" },
+    { "preview",   bench_preview,   "song preview start latency while scrolling through a list of audio files" },
+    { "waveform",  bench_waveform,  "waveform pyramid build and cached load, column lookup at every zoom" },
+    { "onset",     bench_onset,     "timing check of charts against the onsets of their music, with the envelope cache" },
+};
+
+
+int main(int argc, const char* argv[]) {
+    logging_init();
+
+    int rc = -1;
+    for (int i = 0; argc > 1 && i < STACKARRAY_SIZE(s_benches); i++)
+        if (strcmp(argv[1], s_benches[i].name) == 0)
+            rc = s_benches[i].run(argc - 1, argv + 1);
+
+    if (rc < 0) {
+        printf("Usage: %s <bench> [args]\n", argv[0]);
+        for (int i = 0; i < STACKARRAY_SIZE(s_benches); i++)
+            printf("  %-12s %s\n", s_benches[i].name, s_benches[i].description);
+    }
+
+    logging_shutdown();
+    return rc < 0;
+}
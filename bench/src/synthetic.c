@@ -0,0 +1,50 @@
+#include <bench.h>
+
+
+void bench_make_chart(beatmap_t* beatmap, int columns, int notes_per_minute) {
+    memset(beatmap, 0, sizeof(*beatmap));
+    beatmap->CS = columns;
+    beatmap->OD = 8;
+    beatmap->SV = 1;
+    kv_init(beatmap->notes);
+    kv_init(beatmap->timing_points);
+    kv_init(beatmap->sample_filenames);
+
+    beatmap_timing_point_t timing = {
+        .time_start = 0,
+        .length = 60000.0f / 180,
+        .meter = 4,
+        .volume = 100,
+        .is_uninherited = true,
+    };
+    kv_push(beatmap_timing_point_t, beatmap->timing_points, timing);
+
+    // jumptrill: two chords alternating between the halves of the keys, every fourth note of
+    // a column is a hold that covers most of the gap to the next one
+    int chord = max(columns / 2, 1);
+    int rows = notes_per_minute / chord;
+    double row_ms = 60000.0 / rows;
+    double column_ms = row_ms * 2;
+
+    for (int row = 0; row < rows; row++) {
+        int first = (row % 2) ? chord : 0;
+        for (int c = first; c < first + chord && c < columns; c++) {
+            int time = row * row_ms;
+            bool is_hold = (row / 2) % 4 == 0 && column_ms * 0.75 >= 1;
+            beatmap_note_t note = {
+                .time_start = time,
+                .time_end = time + (is_hold ? (int)(column_ms * 0.75) : 0),
+                .column = c,
+                .is_hold_note = is_hold,
+                .sample.filename = -1,
+            };
+            kv_push(beatmap_note_t, beatmap->notes, note);
+        }
+    }
+}
+
+void bench_destroy_chart(beatmap_t* beatmap) {
+    kv_destroy(beatmap->notes);
+    kv_destroy(beatmap->timing_points);
+    kv_destroy(beatmap->sample_filenames);
+}
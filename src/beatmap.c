@@ -2,6 +2,7 @@
 #include <beatmap.h>
 
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -14,6 +15,8 @@
 #include <logging.h>
 #include <utils.h>
 
+KHASH_MAP_INIT_STR(sample_names, int)
+
 #define STRCP(dest, src)\
     memcpy((void*)(dest), src, min(strlen(src), STACKARRAY_SIZE(dest) - 1));\
     (dest)[STACKARRAY_SIZE(dest) - 1] = '\0';
@@ -48,6 +51,9 @@ const char* skip_space(const char* s) {
     return s;
 }
 
+static void _parse_hit_sample(beatmap_t* beatmap, khash_t(sample_names)* names, const char* s, beatmap_hit_sample_t* sample);
+static int _timing_point_at(const beatmap_t* beatmap, double time);
+
 
 bool beatmap_load(const char* filepath, beatmap_t* beatmap, bool load_only_meta) {
     LOGF("Loading beatmap \"%s\" ...", filepath);
@@ -58,6 +64,7 @@ bool beatmap_load(const char* filepath, beatmap_t* beatmap, bool load_only_meta)
     kv_init(beatmap->breaks);
     kv_init(beatmap->notes);
     kv_init(beatmap->timing_points);
+    kv_init(beatmap->sample_filenames);
 
     if (!FileExists(filepath)) {
         LOGF("File \"%s\" does not exists", filepath);
@@ -78,7 +85,8 @@ bool beatmap_load(const char* filepath, beatmap_t* beatmap, bool load_only_meta)
         .len = l,
         .current = file_text
     };
-    char line[100] = {'\0'};
+    // keysound filenames make hit object lines long
+    char line[512] = {'\0'};
 
     if (!cursor_get_next_line(&cursor, line, STACKARRAY_SIZE(line)) || TextFindIndex(line, "osu file format ") == -1) {
         LOGF("File \"%s\" is not an Osu beatmap", filepath);
@@ -108,6 +116,7 @@ bool beatmap_load(const char* filepath, beatmap_t* beatmap, bool load_only_meta)
     khint_t key_ar                  = kh_str_hash_func("ApproachRate");
     khint_t key_sv                  = kh_str_hash_func("SliderMultiplier");
     khint_t key_str                 = kh_str_hash_func("SliderTickRate");
+    khash_t(sample_names)* sample_names = kh_init(sample_names);
     while (cursor_get_next_line(&cursor, line, STACKARRAY_SIZE(line))) {
         int line_len = strlen(line);
 
@@ -149,6 +158,7 @@ bool beatmap_load(const char* filepath, beatmap_t* beatmap, bool load_only_meta)
                         beatmap->mode = strtof(val_s, NULL);
                         if (beatmap->mode != 3) {
                             LOG("Beatmap mode is not osu!mania");
+                            kh_destroy(sample_names, sample_names);
                             return false;
                         }
                     }
@@ -222,6 +232,9 @@ bool beatmap_load(const char* filepath, beatmap_t* beatmap, bool load_only_meta)
                     tm.time_start = atoi(params[0]);
                     tm.length = atof(params[1]);
                     tm.meter = atoi(params[2]);
+                    tm.sample_set = CONSTRAIN(atoi(params[3]), BEATMAP_SAMPLE_SET_DEFAULT, BEATMAP_SAMPLE_SET_DRUM);
+                    tm.sample_index = max(atoi(params[4]), 0);
+                    tm.volume = atoi(params[5]);
                     tm.is_uninherited = atoi(params[6]) == 1;
 
                     kv_push(beatmap_timing_point_t, beatmap->timing_points, tm);
@@ -229,10 +242,15 @@ bool beatmap_load(const char* filepath, beatmap_t* beatmap, bool load_only_meta)
                 else if (section == section_hit_objects && !load_only_meta) {
                     if (beatmap->CS == 0) {
                         LOG("Could not calculate hit object pararms beacause CS was not specified");
+                        kh_destroy(sample_names, sample_names);
                         return false;
                     }
 
-                    beatmap_note_t note = {0};
+                    beatmap_note_t note = { .sample.filename = -1 };
+                    if (params_count < 5) {
+                        LOGF("invalid hit object \"%s\"", line);
+                        continue;
+                    }
 
                     int type = atoi(params[3]);
                     if (type != 1 && type != 128)
@@ -240,12 +258,16 @@ bool beatmap_load(const char* filepath, beatmap_t* beatmap, bool load_only_meta)
 
                     note.is_hold_note = type == 128;
                     note.time_start = atoi(params[2]);
+                    note.hit_sound = atoi(params[4]);
+
+                    // hold notes carry their end time in front of the hitSample
+                    const char* hit_sample = (params_count > 5) ? params[5] : "";
                     if (note.is_hold_note) {
-                        int count = 0;
-                        char* c = strchr(params[5], ':');
-                        c[0] = '\0';
-                        note.time_end = atoi(params[5]);
+                        char* end = NULL;
+                        note.time_end = strtol(hit_sample, &end, 10);
+                        hit_sample = (*end == ':') ? end + 1 : "";
                     }
+                    _parse_hit_sample(beatmap, sample_names, hit_sample, &note.sample);
 
                     note.column = Clamp(
                         floorf(atoi(params[0]) * beatmap->CS / 512.0f),
@@ -260,6 +282,7 @@ bool beatmap_load(const char* filepath, beatmap_t* beatmap, bool load_only_meta)
     }
 
     UnloadFileText(file_text);
+    kh_destroy(sample_names, sample_names);
 
     bool ok = true;
 
@@ -302,9 +325,102 @@ void beatmap_destroy(beatmap_t* beatmap) {
     kv_destroy(beatmap->breaks);
     kv_destroy(beatmap->timing_points);
     kv_destroy(beatmap->notes);
+    for (int i = 0; i < kv_size(beatmap->sample_filenames); i++)
+        free(kv_A(beatmap->sample_filenames, i));
+    kv_destroy(beatmap->sample_filenames);
     kv_init(beatmap->breaks);
     kv_init(beatmap->timing_points);
     kv_init(beatmap->notes);
+    kv_init(beatmap->sample_filenames);
+}
+
+float beatmap_volume_at(const beatmap_t* beatmap, double time) {
+    int tp = _timing_point_at(beatmap, time);
+    if (tp < 0)
+        return 1;
+    return CONSTRAIN(kv_A(beatmap->timing_points, tp).volume, 0, 100) / 100.0f;
+}
+
+bool beatmap_note_sample(const beatmap_t* beatmap, const beatmap_note_t* note, char* dest, int size) {
+    if (note->sample.filename >= 0) {
+        snprintf(dest, size, "%s", kv_A(beatmap->sample_filenames, note->sample.filename));
+        return true;
+    }
+
+    int tp = _timing_point_at(beatmap, note->time_start / 1000.0);
+    beatmap_sample_set_t set = note->sample.normal_set;
+    int index = note->sample.index;
+    if (set == BEATMAP_SAMPLE_SET_DEFAULT && tp >= 0)
+        set = kv_A(beatmap->timing_points, tp).sample_set;
+    if (index == 0 && tp >= 0)
+        index = kv_A(beatmap->timing_points, tp).sample_index;
+    if (index == 0)
+        return false;
+
+    // index 1 has no number, like in osu!
+    static const char* set_names[] = { "normal", "normal", "soft", "drum" };
+    if (index == 1)
+        snprintf(dest, size, "%s-hitnormal.wav", set_names[set]);
+    else
+        snprintf(dest, size, "%s-hitnormal%d.wav", set_names[set], index);
+    return true;
+}
+
+float beatmap_note_volume(const beatmap_t* beatmap, const beatmap_note_t* note) {
+    if (note->sample.volume > 0)
+        return min(note->sample.volume, 100) / 100.0f;
+    return beatmap_volume_at(beatmap, note->time_start / 1000.0);
+}
+
+void _parse_hit_sample(beatmap_t* beatmap, khash_t(sample_names)* names, const char* s, beatmap_hit_sample_t* sample) {
+    // normalSet:additionSet:index:volume:filename, older versions stop early
+    int fields[4] = {0};
+    for (int i = 0; i < 4; i++) {
+        char* end = NULL;
+        fields[i] = strtol(s, &end, 10);
+        if (*end != ':') {
+            s = "";
+            break;
+        }
+        s = end + 1;
+    }
+
+    sample->normal_set = CONSTRAIN(fields[0], BEATMAP_SAMPLE_SET_DEFAULT, BEATMAP_SAMPLE_SET_DRUM);
+    sample->addition_set = CONSTRAIN(fields[1], BEATMAP_SAMPLE_SET_DEFAULT, BEATMAP_SAMPLE_SET_DRUM);
+    sample->index = max(fields[2], 0);
+    sample->volume = CONSTRAIN(fields[3], 0, 100);
+    sample->filename = -1;
+
+    s = skip_space(s);
+    if (*s == '\0')
+        return;
+
+    // notes sharing a keysound share its filename
+    int is_new = 0;
+    khint_t k = kh_put(sample_names, names, s, &is_new);
+    if (is_new) {
+        char* filename = strdup(s);
+        kh_key(names, k) = filename;
+        kh_value(names, k) = kv_size(beatmap->sample_filenames);
+        kv_push(char*, beatmap->sample_filenames, filename);
+    }
+    sample->filename = kh_value(names, k);
+}
+
+int _timing_point_at(const beatmap_t* beatmap, double time) {
+    int lo = 0, hi = kv_size(beatmap->timing_points);
+    if (hi == 0)
+        return -1;
+
+    // last timing point that starts at or before time, the first one also covers the lead-in
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (kv_A(beatmap->timing_points, mid).time_start <= time * 1000)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
 }
 
 void beatmap_debug_print(beatmap_t* beatmap) {
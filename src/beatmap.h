@@ -13,18 +13,39 @@ typedef struct beatmap_break_s {
     int time_end;
 } beatmap_break_t;
 
+typedef enum {
+    BEATMAP_SAMPLE_SET_DEFAULT,     // the timing point's set, normal if that is default too
+    BEATMAP_SAMPLE_SET_NORMAL,
+    BEATMAP_SAMPLE_SET_SOFT,
+    BEATMAP_SAMPLE_SET_DRUM,
+} beatmap_sample_set_t;
+
 typedef struct beatmap_timing_point_s {
-    int     time_start;
-    float   length;
-    int     meter;
-    bool    is_uninherited;
+    int                     time_start;
+    float                   length;
+    int                     meter;
+    beatmap_sample_set_t    sample_set;
+    int                     sample_index;   // 0 plays the skin's samples
+    int                     volume;         // hitsound volume, 0-100
+    bool                    is_uninherited;
 } beatmap_timing_point_t;
 
+// hitSample field of a hit object
+typedef struct beatmap_hit_sample_s {
+    beatmap_sample_set_t    normal_set;
+    beatmap_sample_set_t    addition_set;
+    int                     index;      // 0 uses the timing point's
+    int                     volume;     // 0-100, 0 uses the timing point's
+    int                     filename;   // keysound in sample_filenames, -1 for none
+} beatmap_hit_sample_t;
+
 typedef struct beatmap_note_s {
-    int     time_start;
-    int     time_end;
-    int     column;
-    bool    is_hold_note;
+    int                     time_start;
+    int                     time_end;
+    int                     column;
+    bool                    is_hold_note;
+    int                     hit_sound;  // additions, 2 whistle, 4 finish, 8 clap
+    beatmap_hit_sample_t    sample;
 } beatmap_note_t;
 
 typedef struct beatmap_s {
@@ -62,6 +83,7 @@ typedef struct beatmap_s {
 
     // [HitObjects]
     kvec_t(beatmap_note_t) notes;
+    kvec_t(char*) sample_filenames;     // every keysound once, notes refer to them by index
 } beatmap_t;
 
 
@@ -69,4 +91,14 @@ bool beatmap_load(const char* filepath, beatmap_t* new_beatmap, bool load_only_m
 void beatmap_destroy(beatmap_t* beatmap);
 void beatmap_debug_print(beatmap_t* beatmap);
 
+// Hitsound volume in [0, 1] of the timing point active at time (seconds).
+float beatmap_volume_at(const beatmap_t* beatmap, double time);
+
+// Filename of the sample the head of a note plays: its keysound, or <set>-hitnormal<index>.wav
+// with the set and index of the note or else its timing point. Returns false when the note
+// plays the skin's hitsound. Additions are not resolved.
+bool beatmap_note_sample(const beatmap_t* beatmap, const beatmap_note_t* note, char* dest, int size);
+// Volume in [0, 1] of the note's sample, its own or its timing point's.
+float beatmap_note_volume(const beatmap_t* beatmap, const beatmap_note_t* note);
+
 #endif
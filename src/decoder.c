@@ -0,0 +1,551 @@
+#include <decoder.h>
+
+#include <pthread.h>
+#include <ctype.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#ifdef _WIN32
+#define CPU_COUNT() pthread_num_processors_np()
+#else
+#include <unistd.h>
+#define CPU_COUNT() ((int)sysconf(_SC_NPROCESSORS_ONLN))
+#endif
+
+#include <raylib.h>
+// implementations are compiled into raylib
+#include <external/dr_mp3.h>
+#include <external/dr_wav.h>
+#define STB_VORBIS_HEADER_ONLY
+#include <external/stb_vorbis.c>
+
+#include <kvec.h>
+
+#include <timer.h>
+#define SCOPE_NAME "decoder"
+#include <logging.h>
+
+#define INDEX_MAGIC 0x3258444Du // "MDX2"
+
+// Layer III frames reference up to this many bytes of main data from the frames before them
+#define MP3_RESERVOIR_BYTES 511
+// Header, CRC and the largest side info, what is left of a frame is main data
+#define MP3_FRAME_OVERHEAD 38
+
+
+typedef struct mp3_frame_s {
+    uint32_t    offset;         // in the file
+    uint32_t    frame;          // first PCM frame it decodes to
+} mp3_frame_t;
+
+typedef struct mp3_s {
+    drmp3dec            dec;
+    unsigned char*      data;
+    unsigned int        size;
+    unsigned int        offset;     // of the next MP3 frame
+    drmp3_int16         pcm[DRMP3_MAX_SAMPLES_PER_FRAME];   // raylib builds dr_mp3 with 16-bit output
+    int                 pcm_count;
+    int                 pcm_offset;
+} mp3_t;
+
+// Shared by the threads of decoder_decode_all()
+typedef struct decode_job_s {
+    const decoder_t*    decoder;
+    const char*         filepath;
+    float*              frames;
+    uint64_t*           bounds;         // chunk i covers [bounds[i], bounds[i + 1])
+    int                 chunk_count;
+    atomic_int          next_chunk;
+    atomic_bool         has_failed;
+    uint64_t            last_count;     // the stream length is only an estimate for some formats
+} decode_job_t;
+
+typedef struct index_header_s {
+    uint32_t    magic;
+    uint32_t    count;
+    uint64_t    size;           // rejects an index of a different file
+    uint64_t    frame_count;
+} index_header_t;
+
+static bool _has_extension(const char* filepath, const char* extension);
+static bool _open_mp3(decoder_t* decoder, const char* filepath, const char* index_filepath);
+static bool _scan_mp3(decoder_t* decoder);
+static int _decode_mp3_frame(mp3_t* mp3, drmp3_int16* pcm);
+static int _read_mp3(decoder_t* decoder, float* frames, int count);
+static bool _seek_mp3(decoder_t* decoder, uint64_t frame);
+static int _find_mp3_frame(const decoder_t* decoder, uint64_t frame);
+static void* _decode_thread(void* arg);
+static bool _open_worker(const decoder_t* decoder, const char* filepath, decoder_t* worker);
+static void _close_worker(decoder_t* worker);
+static int _read_native(decoder_t* decoder, float* frames, int count);
+static bool _load_index(decoder_t* decoder, const char* index_filepath);
+static void _save_index(const decoder_t* decoder, const char* index_filepath);
+
+
+bool decoder_open(decoder_t* decoder, const char* filepath, const char* index_filepath) {
+    *decoder = (decoder_t){0};
+
+    if (_has_extension(filepath, ".mp3")) {
+        if (!_open_mp3(decoder, filepath, index_filepath))
+            return false;
+    }
+    else if (_has_extension(filepath, ".ogg")) {
+        int error = 0;
+        stb_vorbis* ogg = stb_vorbis_open_filename(filepath, &error, NULL);
+        if (!ogg) {
+            LOGF("Failed to open \"%s\" (error %d)", filepath, error);
+            return false;
+        }
+        stb_vorbis_info info = stb_vorbis_get_info(ogg);
+        decoder->format = DECODER_OGG;
+        decoder->handle = ogg;
+        decoder->sample_rate = info.sample_rate;
+        decoder->channels = info.channels;
+        decoder->frame_count = stb_vorbis_stream_length_in_samples(ogg);
+    }
+    else if (_has_extension(filepath, ".wav")) {
+        drwav* wav = malloc(sizeof(drwav));
+        if (!wav || !drwav_init_file(wav, filepath, NULL)) {
+            free(wav);
+            LOGF("Failed to open \"%s\"", filepath);
+            return false;
+        }
+        decoder->format = DECODER_WAV;
+        decoder->handle = wav;
+        decoder->sample_rate = wav->sampleRate;
+        decoder->channels = wav->channels;
+        decoder->frame_count = wav->totalPCMFrameCount;
+    }
+    else {
+        LOGF("Unsupported audio format \"%s\"", GetFileExtension(filepath));
+        return false;
+    }
+
+    decoder->scratch = malloc(DECODER_SCRATCH_FRAMES * decoder->channels * sizeof(float));
+    if (!decoder->scratch || decoder->channels < 1 || decoder->sample_rate <= 0) {
+        LOGF("Unsupported stream in \"%s\"", filepath);
+        decoder_close(decoder);
+        return false;
+    }
+    return true;
+}
+
+void decoder_close(decoder_t* decoder) {
+    if (decoder->handle) {
+        if (decoder->format == DECODER_MP3) {
+            UnloadFileData(((mp3_t*)decoder->handle)->data);
+            free(decoder->handle);
+        }
+        else if (decoder->format == DECODER_OGG) {
+            stb_vorbis_close(decoder->handle);
+        }
+        else if (decoder->format == DECODER_WAV) {
+            drwav_uninit(decoder->handle);
+            free(decoder->handle);
+        }
+    }
+    free(decoder->scratch);
+    free(decoder->index);
+    *decoder = (decoder_t){0};
+}
+
+int decoder_read(decoder_t* decoder, float* frames, int count) {
+    if (decoder->channels == DECODER_CHANNELS)
+        return _read_native(decoder, frames, count);
+
+    // mono is duplicated, channels past the second one are dropped
+    int done = 0;
+    while (done < count) {
+        int read = _read_native(decoder, decoder->scratch, min(count - done, DECODER_SCRATCH_FRAMES));
+        for (int i = 0; i < read; i++) {
+            const float* src = decoder->scratch + i * decoder->channels;
+            float* dest = frames + (done + i) * DECODER_CHANNELS;
+            dest[0] = src[0];
+            dest[1] = (decoder->channels > 1) ? src[1] : src[0];
+        }
+        done += read;
+        if (read == 0)
+            break;
+    }
+    return done;
+}
+
+bool decoder_seek(decoder_t* decoder, uint64_t frame) {
+    frame = min(frame, decoder->frame_count);
+
+    if (decoder->format == DECODER_MP3)
+        return _seek_mp3(decoder, frame);
+    if (decoder->format == DECODER_OGG)
+        return stb_vorbis_seek(decoder->handle, frame);
+    if (decoder->format == DECODER_WAV)
+        return drwav_seek_to_pcm_frame(decoder->handle, frame);
+    return false;
+}
+
+uint64_t decoder_decode_all(decoder_t* decoder, const char* filepath, float* frames, int threads) {
+    if (threads <= 0)
+        threads = CPU_COUNT();
+    int chunk_count = max(1, min(2 * threads, (int)(decoder->frame_count / DECODER_MIN_CHUNK_FRAMES)));
+    threads = max(1, min(threads, min(chunk_count, DECODER_MAX_THREADS)));
+
+    if (threads == 1) {
+        if (!decoder_seek(decoder, 0))
+            return 0;
+        return decoder_read(decoder, frames, decoder->frame_count);
+    }
+
+    // twice as many chunks as threads evens out threads that get descheduled
+    decode_job_t job = { decoder, filepath, frames, malloc((chunk_count + 1) * sizeof(uint64_t)) };
+    if (!job.bounds)
+        return 0;
+    job.bounds[0] = 0;
+    job.chunk_count = 0;
+    for (int i = 1; i < chunk_count; i++) {
+        uint64_t bound = decoder->frame_count * i / chunk_count;
+        if (decoder->format == DECODER_MP3)
+            bound = ((const mp3_frame_t*)decoder->index)[_find_mp3_frame(decoder, bound)].frame;
+        if (bound > job.bounds[job.chunk_count])
+            job.bounds[++job.chunk_count] = bound;
+    }
+    job.bounds[++job.chunk_count] = decoder->frame_count;
+    atomic_store(&job.next_chunk, 0);
+    atomic_store(&job.has_failed, false);
+
+    pthread_t pool[DECODER_MAX_THREADS];
+    int started = 0;
+    while (started < threads - 1 && pthread_create(&pool[started], NULL, _decode_thread, &job) == 0)
+        started++;
+    if (started < threads - 1)
+        LOGF("Started %d of %d decode threads", started + 1, threads);
+
+    // the calling thread helps out as well, at least one thread always runs
+    _decode_thread(&job);
+    for (int i = 0; i < started; i++)
+        pthread_join(pool[i], NULL);
+
+    free(job.bounds);
+    if (atomic_load(&job.has_failed))
+        return 0;
+    return job.last_count;
+}
+
+double decoder_length(const decoder_t* decoder) {
+    return (double)decoder->frame_count / decoder->sample_rate;
+}
+
+bool decoder_load_wave(const char* filepath, Wave* wave) {
+    *wave = (Wave){0};
+    const char* dot = strrchr(filepath, '.');
+    char extension[8];
+    if (!dot || strlen(dot) >= STACKARRAY_SIZE(extension))
+        return false;
+    for (int i = 0; i <= (int)strlen(dot); i++)
+        extension[i] = (char)tolower((unsigned char)dot[i]);
+
+    unsigned int size = 0;
+    unsigned char* data = LoadFileData(filepath, &size);
+    if (!data)
+        return false;
+    *wave = LoadWaveFromMemory(extension, data, (int)size);
+    UnloadFileData(data);
+    return IsWaveReady(*wave);
+}
+
+bool _has_extension(const char* filepath, const char* extension) {
+    // raylib's IsFileExtension() goes through static buffers, decoders open on several threads
+    const char* dot = strrchr(filepath, '.');
+    return dot && strcasecmp(dot, extension) == 0;
+}
+
+bool _open_mp3(decoder_t* decoder, const char* filepath, const char* index_filepath) {
+    mp3_t* mp3 = calloc(1, sizeof(mp3_t));
+    if (mp3)
+        mp3->data = LoadFileData(filepath, &mp3->size);
+    if (!mp3 || !mp3->data) {
+        free(mp3);
+        LOGF("Failed to open \"%s\"", filepath);
+        return false;
+    }
+    decoder->format = DECODER_MP3;
+    decoder->handle = mp3;
+
+    double start = timer_now();
+    bool is_cached = index_filepath && _load_index(decoder, index_filepath);
+    if (!is_cached && !_scan_mp3(decoder)) {
+        LOGF("No MP3 frames in \"%s\"", filepath);
+        decoder_close(decoder);
+        return false;
+    }
+    if (!is_cached && index_filepath)
+        _save_index(decoder, index_filepath);
+
+    // the stream parameters come from the first frame
+    const mp3_frame_t* index = decoder->index;
+    drmp3dec_frame_info info;
+    drmp3dec_init(&mp3->dec);
+    drmp3dec_decode_frame(&mp3->dec, mp3->data + index[0].offset, mp3->size - index[0].offset, NULL, &info);
+    decoder->sample_rate = info.hz;
+    decoder->channels = info.channels;
+    drmp3dec_init(&mp3->dec);
+
+    LOGF(
+        "%s %d MP3 frames in %.3f s",
+        (is_cached) ? "loaded" : "indexed",
+        decoder->index_count,
+        timer_now() - start
+    );
+    return true;
+}
+
+bool _scan_mp3(decoder_t* decoder) {
+    mp3_t* mp3 = decoder->handle;
+    kvec_t(mp3_frame_t) index;
+    kv_init(index);
+
+    // without an output buffer the frames are only parsed, but a frame whose reservoir can not
+    // be restored still decodes to nothing just like in a full decode
+    drmp3dec_init(&mp3->dec);
+    mp3->offset = 0;
+    uint64_t frame = 0;
+    while (mp3->offset < mp3->size) {
+        mp3_frame_t entry = { mp3->offset, (uint32_t)frame };
+        int samples = _decode_mp3_frame(mp3, NULL);
+        if (samples < 0)
+            break;
+        kv_push(mp3_frame_t, index, entry);
+        frame += samples;
+    }
+    mp3->offset = 0;
+
+    if (kv_size(index) == 0 || frame == 0) {
+        kv_destroy(index);
+        return false;
+    }
+    decoder->index = index.a;
+    decoder->index_count = kv_size(index);
+    decoder->frame_count = frame;
+    return true;
+}
+
+int _decode_mp3_frame(mp3_t* mp3, drmp3_int16* pcm) {
+    // returns the PCM frames of the next MP3 frame, -1 at the end of the file
+    drmp3dec_frame_info info;
+    int samples = drmp3dec_decode_frame(&mp3->dec, mp3->data + mp3->offset, mp3->size - mp3->offset, pcm, &info);
+    if (info.frame_bytes <= 0)
+        return -1;
+    mp3->offset += info.frame_bytes;
+    return samples;
+}
+
+int _read_mp3(decoder_t* decoder, float* frames, int count) {
+    mp3_t* mp3 = decoder->handle;
+    int done = 0;
+
+    while (done < count) {
+        if (mp3->pcm_offset == mp3->pcm_count) {
+            int samples = _decode_mp3_frame(mp3, mp3->pcm);
+            if (samples < 0)
+                break;
+            mp3->pcm_count = samples;
+            mp3->pcm_offset = 0;
+            continue;
+        }
+
+        // same conversion as drmp3_read_pcm_frames_f32()
+        int read = min(count - done, mp3->pcm_count - mp3->pcm_offset);
+        const drmp3_int16* src = mp3->pcm + mp3->pcm_offset * decoder->channels;
+        float* dest = frames + done * decoder->channels;
+        for (int i = 0; i < read * decoder->channels; i++)
+            dest[i] = src[i] * 0.000030517578125f;
+        mp3->pcm_offset += read;
+        done += read;
+    }
+    return done;
+}
+
+bool _seek_mp3(decoder_t* decoder, uint64_t frame) {
+    mp3_t* mp3 = decoder->handle;
+    const mp3_frame_t* index = decoder->index;
+
+    int target = _find_mp3_frame(decoder, frame);
+
+    // the frame before the target has to decode completely, which takes the frames that fill
+    // its reservoir
+    int first = max(0, target - DECODER_WARMUP_FRAMES);
+    int reservoir = 0;
+    while (first > 0 && reservoir < MP3_RESERVOIR_BYTES) {
+        reservoir += (int)(index[first].offset - index[first - 1].offset) - MP3_FRAME_OVERHEAD;
+        first--;
+    }
+
+    drmp3dec_init(&mp3->dec);
+    mp3->offset = index[first].offset;
+    for (int i = first; i < target; i++) {
+        if (_decode_mp3_frame(mp3, mp3->pcm) < 0)
+            return false;
+    }
+
+    uint64_t position = index[target].frame;
+    mp3->pcm_count = 0;
+    mp3->pcm_offset = 0;
+    while (true) {
+        int samples = _decode_mp3_frame(mp3, mp3->pcm);
+        if (samples < 0)
+            return frame == decoder->frame_count;
+        if (frame < position + samples) {
+            mp3->pcm_count = samples;
+            mp3->pcm_offset = frame - position;
+            return true;
+        }
+        position += samples;
+    }
+}
+
+void* _decode_thread(void* arg) {
+    decode_job_t* job = arg;
+    decoder_t worker;
+    if (!_open_worker(job->decoder, job->filepath, &worker)) {
+        atomic_store(&job->has_failed, true);
+        return NULL;
+    }
+
+    int chunk;
+    while (!atomic_load(&job->has_failed) && (chunk = atomic_fetch_add(&job->next_chunk, 1)) < job->chunk_count) {
+        uint64_t start = job->bounds[chunk];
+        int count = job->bounds[chunk + 1] - start;
+        int read = (decoder_seek(&worker, start)) ? decoder_read(&worker, job->frames + start * DECODER_CHANNELS, count) : 0;
+
+        bool is_last = chunk == job->chunk_count - 1;
+        if (is_last)
+            job->last_count = start + read;
+        if (read < count && !(is_last && read > 0)) {
+            LOGF("Failed to decode frames %llu to %llu", (unsigned long long)start, (unsigned long long)(start + count));
+            atomic_store(&job->has_failed, true);
+        }
+    }
+
+    _close_worker(&worker);
+    return NULL;
+}
+
+bool _open_worker(const decoder_t* decoder, const char* filepath, decoder_t* worker) {
+    if (decoder->format != DECODER_MP3)
+        return decoder_open(worker, filepath, NULL);
+
+    // MP3 workers share the file contents and the index, only the decoder state is their own
+    *worker = *decoder;
+    worker->handle = malloc(sizeof(mp3_t));
+    worker->scratch = malloc(DECODER_SCRATCH_FRAMES * decoder->channels * sizeof(float));
+    if (!worker->handle || !worker->scratch) {
+        free(worker->handle);
+        free(worker->scratch);
+        return false;
+    }
+    *(mp3_t*)worker->handle = *(const mp3_t*)decoder->handle;
+    return true;
+}
+
+void _close_worker(decoder_t* worker) {
+    if (worker->format != DECODER_MP3) {
+        decoder_close(worker);
+        return;
+    }
+    free(worker->handle);
+    free(worker->scratch);
+}
+
+int _find_mp3_frame(const decoder_t* decoder, uint64_t frame) {
+    // last MP3 frame starting at or before the target, frames that decode to nothing share
+    // the position of the next one
+    const mp3_frame_t* index = decoder->index;
+    int lo = 0, hi = decoder->index_count;
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (index[mid].frame <= frame)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int _read_native(decoder_t* decoder, float* frames, int count) {
+    if (decoder->format == DECODER_MP3)
+        return _read_mp3(decoder, frames, count);
+    if (decoder->format == DECODER_WAV)
+        return drwav_read_pcm_frames_f32(decoder->handle, count, frames);
+
+    // stb_vorbis returns at most one vorbis frame per call
+    int done = 0;
+    while (done < count) {
+        int read = stb_vorbis_get_samples_float_interleaved(
+            decoder->handle,
+            decoder->channels,
+            frames + done * decoder->channels,
+            (count - done) * decoder->channels
+        );
+        if (read <= 0)
+            break;
+        done += read;
+    }
+    return done;
+}
+
+bool _load_index(decoder_t* decoder, const char* index_filepath) {
+    if (!FileExists(index_filepath))
+        return false;
+
+    unsigned int size = 0;
+    unsigned char* data = LoadFileData(index_filepath, &size);
+    if (!data)
+        return false;
+
+    index_header_t header = {0};
+    if (size >= sizeof(header))
+        memcpy(&header, data, sizeof(header));
+
+    bool is_valid =
+        header.magic == INDEX_MAGIC &&
+        header.size == ((mp3_t*)decoder->handle)->size &&
+        header.count > 0 &&
+        header.frame_count > 0 &&
+        size == sizeof(header) + header.count * sizeof(mp3_frame_t);
+
+    if (is_valid) {
+        decoder->index = malloc(header.count * sizeof(mp3_frame_t));
+        is_valid = decoder->index != NULL;
+    }
+    if (is_valid) {
+        memcpy(decoder->index, data + sizeof(header), header.count * sizeof(mp3_frame_t));
+        decoder->index_count = header.count;
+        decoder->frame_count = header.frame_count;
+    }
+    else {
+        LOGF("Ignoring stale seek index \"%s\"", index_filepath);
+    }
+
+    UnloadFileData(data);
+    return is_valid;
+}
+
+void _save_index(const decoder_t* decoder, const char* index_filepath) {
+    index_header_t header = {
+        INDEX_MAGIC,
+        decoder->index_count,
+        ((mp3_t*)decoder->handle)->size,
+        decoder->frame_count,
+    };
+    unsigned int size = sizeof(header) + decoder->index_count * sizeof(mp3_frame_t);
+
+    unsigned char* data = malloc(size);
+    if (!data)
+        return;
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), decoder->index, decoder->index_count * sizeof(mp3_frame_t));
+
+    if (!SaveFileData(index_filepath, data, size))
+        LOGF("Failed to write \"%s\"", index_filepath);
+    free(data);
+}
@@ -0,0 +1,77 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <stdint.h>
+
+#include <raylib.h>
+
+#include <defines.h>
+
+// Decoded audio is always interleaved float stereo
+#define DECODER_CHANNELS 2
+
+#ifndef DECODER_SCRATCH_FRAMES
+#define DECODER_SCRATCH_FRAMES 1024
+#endif
+
+// MP3 frames decoded ahead of a seek target so the bit reservoir and the synthesis filter
+// of the target frame are in the same state as in a decode from the start
+#ifndef DECODER_WARMUP_FRAMES
+#define DECODER_WARMUP_FRAMES 2
+#endif
+
+// Shortest piece of the stream decoder_decode_all() hands to a thread, shorter chunks spend
+// more of their time seeking
+#ifndef DECODER_MIN_CHUNK_FRAMES
+#define DECODER_MIN_CHUNK_FRAMES (1 << 18)
+#endif
+
+#ifndef DECODER_MAX_THREADS
+#define DECODER_MAX_THREADS 32
+#endif
+
+
+typedef enum {
+    DECODER_MP3,
+    DECODER_OGG,
+    DECODER_WAV,
+} decoder_format_t;
+
+// Thin wrapper over the decoders raylib is built with (minimp3 from dr_mp3, stb_vorbis, dr_wav).
+typedef struct decoder_s {
+    decoder_format_t    format;
+    void*               handle;
+    int                 sample_rate;
+    int                 channels;       // of the file
+    uint64_t            frame_count;
+    float*              scratch;        // DECODER_SCRATCH_FRAMES frames of the file's channels
+    void*               index;          // MP3 frame offsets, see decoder_open()
+    int                 index_count;
+} decoder_t;
+
+
+// MP3 files are indexed with a scan of their frame headers so seeks jump straight to the frame
+// holding the target. The index is loaded from index_filepath (optional) or stored there for
+// the next time.
+bool decoder_open(decoder_t* decoder, const char* filepath, const char* index_filepath);
+void decoder_close(decoder_t* decoder);
+
+// Returns the number of frames read, less than count only at the end of the stream.
+int decoder_read(decoder_t* decoder, float* frames, int count);
+bool decoder_seek(decoder_t* decoder, uint64_t frame);
+
+// Decodes the whole stream into frames (frame_count frames) on up to threads threads, 0 for
+// one per core. Each thread decodes chunks starting at an exact seek, MP3 chunks start on frame
+// boundaries, so the chunks join sample-exactly. Other formats are opened again from filepath
+// once per thread. Returns the number of frames decoded, 0 on failure.
+uint64_t decoder_decode_all(decoder_t* decoder, const char* filepath, float* frames, int threads);
+
+double decoder_length(const decoder_t* decoder);
+
+// LoadWave() for short files loaded on any thread. raylib picks the format by an extension
+// some of its versions derive through static buffers, here it is derived locally and matched
+// in any case.
+bool decoder_load_wave(const char* filepath, Wave* wave);
+
+
+#endif
@@ -0,0 +1,264 @@
+#include <export.h>
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <gameplay.h>
+#include <input.h>
+#include <mixdown.h>
+#include <playback_clock.h>
+#include <playfield.h>
+#include <raster.h>
+#include <render_soft.h>
+#include <ring.h>
+#include <timer.h>
+#define SCOPE_NAME "export"
+#include <logging.h>
+
+
+typedef struct frame_s {
+    int                 index;
+    double              pos;
+    gameplay_state_t    state;
+    raster_t            raster;
+} frame_t;
+
+// Frames circulate free -> render -> encode -> free, every ring has a single producer and consumer
+static frame_t          s_frames[EXPORT_FRAMES_IN_FLIGHT];
+static ring_t           s_free;
+static ring_t           s_to_render;
+static ring_t           s_to_encode;
+static atomic_bool      s_failed = false;
+static pthread_mutex_t  s_lock = PTHREAD_MUTEX_INITIALIZER;     // guards the waits on the rings
+static pthread_cond_t   s_changed = PTHREAD_COND_INITIALIZER;   // a frame was handed over or the export failed
+static const gameplay_t* s_gameplay = NULL;
+static export_config_t  s_config;
+static FILE*            s_video = NULL;
+static uint8_t*         s_yuv = NULL;
+static mixdown_t        s_mixdown;
+
+static void _on_hitsound(int column, int note, double time);
+static frame_t* _take(ring_t* ring);
+static void _give(ring_t* ring, const frame_t* frame);
+static void _fail();
+static void* _render_thread(void* arg);
+static void* _encode_thread(void* arg);
+static bool _open_video();
+static void _close_video();
+static void _rgba_to_yuv420(const raster_t* raster, uint8_t* yuv);
+
+
+bool export_run(const beatmap_t* beatmap, bool autoplay, export_config_t config) {
+    s_config = config;
+    atomic_store(&s_failed, false);
+
+    if (!mixdown_init(&s_mixdown, config.music_filepath, config.hitsound_filepath))
+        return false;
+
+    gameplay_t gameplay;
+    if (!gameplay_load(&gameplay, beatmap, autoplay, _on_hitsound)) {
+        mixdown_destroy(&s_mixdown);
+        return false;
+    }
+    s_gameplay = &gameplay;
+
+    bool ok = _open_video();
+    ring_init(&s_free, sizeof(int), EXPORT_FRAMES_IN_FLIGHT);
+    ring_init(&s_to_render, sizeof(int), EXPORT_FRAMES_IN_FLIGHT);
+    ring_init(&s_to_encode, sizeof(int), EXPORT_FRAMES_IN_FLIGHT);
+    for (int i = 0; i < EXPORT_FRAMES_IN_FLIGHT && ok; i++) {
+        ok = raster_init(&s_frames[i].raster, config.width, config.height);
+        ring_write(&s_free, &i, 1);
+    }
+
+    pthread_t render_thread, encode_thread;
+    bool has_threads = false;
+    if (ok && pthread_create(&render_thread, NULL, _render_thread, NULL) == 0) {
+        has_threads = pthread_create(&encode_thread, NULL, _encode_thread, NULL) == 0;
+        if (!has_threads) {
+            // stops on the failure flag
+            _fail();
+            pthread_join(render_thread, NULL);
+        }
+    }
+    if (ok && !has_threads) {
+        LOG("Failed to start the export threads");
+        ok = false;
+    }
+
+    double length = mixdown_length(&s_mixdown);
+    int frame_count = ceil(length * config.fps);
+    double start = timer_now();
+
+    // simulation stage, the virtual clock advances by exactly one frame per iteration
+    for (int i = 0; ok && i < frame_count + 1; i++) {
+        frame_t* frame = _take(&s_free);
+        if (!frame)
+            break;
+
+        if (i < frame_count) {
+            double pos = (double)i / config.fps;
+            playback_clock_sync(pos, false);
+            input_poll();
+            gameplay_update(&gameplay, pos);
+
+            frame->index = i;
+            frame->pos = pos;
+            frame->state = gameplay.state;
+        }
+        else {
+            frame->index = -1;  // end of stream
+        }
+        _give(&s_to_render, frame);
+    }
+
+    if (has_threads) {
+        pthread_join(render_thread, NULL);
+        pthread_join(encode_thread, NULL);
+    }
+    ok = ok && !atomic_load(&s_failed);
+
+    double elapsed = timer_now() - start;
+    if (ok)
+        LOGF("%d frames in %.1f s, %.1fx real time", frame_count, elapsed, length / elapsed);
+
+    if (ok && config.audio_filepath)
+        ok = mixdown_export(&s_mixdown, config.audio_filepath);
+
+    for (int i = 0; i < EXPORT_FRAMES_IN_FLIGHT; i++)
+        raster_destroy(&s_frames[i].raster);
+    ring_destroy(&s_free);
+    ring_destroy(&s_to_render);
+    ring_destroy(&s_to_encode);
+    _close_video();
+    gameplay_destroy(&gameplay);
+    mixdown_destroy(&s_mixdown);
+    return ok;
+}
+
+void _on_hitsound(int column, int note, double time) {
+    mixdown_add_hit(&s_mixdown, time, beatmap_volume_at(s_gameplay->beatmap, time));
+}
+
+frame_t* _take(ring_t* ring) {
+    int index;
+    pthread_mutex_lock(&s_lock);
+    while (ring_read(ring, &index, 1) == 0) {
+        if (atomic_load_explicit(&s_failed, memory_order_relaxed)) {
+            pthread_mutex_unlock(&s_lock);
+            return NULL;
+        }
+        pthread_cond_wait(&s_changed, &s_lock);
+    }
+    pthread_mutex_unlock(&s_lock);
+    return &s_frames[index];
+}
+
+void _give(ring_t* ring, const frame_t* frame) {
+    pthread_mutex_lock(&s_lock);
+    ring_write(ring, &(int){ frame - s_frames }, 1);
+    pthread_cond_broadcast(&s_changed);
+    pthread_mutex_unlock(&s_lock);
+}
+
+void _fail() {
+    pthread_mutex_lock(&s_lock);
+    atomic_store(&s_failed, true);
+    pthread_cond_broadcast(&s_changed);
+    pthread_mutex_unlock(&s_lock);
+}
+
+void* _render_thread(void* arg) {
+    playfield_t playfield;
+    playfield_init(&playfield, s_gameplay, s_config.width, s_config.height);
+
+    frame_t* frame;
+    while ((frame = _take(&s_to_render)) != NULL) {
+        if (frame->index >= 0)
+            render_soft_frame(&frame->raster, &playfield, &frame->state, frame->pos);
+        _give(&s_to_encode, frame);
+        if (frame->index < 0)
+            break;
+    }
+
+    playfield_destroy(&playfield);
+    return NULL;
+}
+
+void* _encode_thread(void* arg) {
+    size_t frame_size = s_config.width * s_config.height * 3 / 2;
+
+    frame_t* frame;
+    while ((frame = _take(&s_to_encode)) != NULL) {
+        if (frame->index < 0)
+            break;
+
+        _rgba_to_yuv420(&frame->raster, s_yuv);
+        if (fputs("FRAME\n", s_video) < 0 || fwrite(s_yuv, 1, frame_size, s_video) != frame_size) {
+            LOG("Failed to write a frame");
+            _fail();
+            break;
+        }
+        _give(&s_free, frame);
+    }
+    return NULL;
+}
+
+bool _open_video() {
+    const char* path = s_config.video_filepath;
+    if (s_config.width % 2 || s_config.height % 2 || s_config.fps <= 0) {
+        LOGF("Unsupported video format %dx%d at %d fps", s_config.width, s_config.height, s_config.fps);
+        return false;
+    }
+
+    s_video = (path[0] == '|') ? popen(path + 1, "w") : fopen(path, "wb");
+    s_yuv = malloc(s_config.width * s_config.height * 3 / 2);
+    if (!s_video || !s_yuv) {
+        LOGF("Failed to open \"%s\"", path);
+        _close_video();
+        return false;
+    }
+
+    fprintf(s_video, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", s_config.width, s_config.height, s_config.fps);
+    LOGF("%dx%d at %d fps to \"%s\"", s_config.width, s_config.height, s_config.fps, path);
+    return true;
+}
+
+void _close_video() {
+    if (s_video) {
+        if (s_config.video_filepath[0] == '|')
+            pclose(s_video);
+        else
+            fclose(s_video);
+    }
+    SAFE_DELETE(s_yuv);
+    s_video = NULL;
+}
+
+void _rgba_to_yuv420(const raster_t* raster, uint8_t* yuv) {
+    // BT.601 limited range, chroma is the average of each 2x2 block
+    int w = raster->width;
+    int h = raster->height;
+    uint8_t* y_plane = yuv;
+    uint8_t* u_plane = yuv + w * h;
+    uint8_t* v_plane = u_plane + (w / 2) * (h / 2);
+
+    for (int i = 0; i < w * h; i++) {
+        Color c = raster->pixels[i];
+        y_plane[i] = ((66 * c.r + 129 * c.g + 25 * c.b + 128) >> 8) + 16;
+    }
+
+    for (int y = 0; y < h / 2; y++) {
+        for (int x = 0; x < w / 2; x++) {
+            const Color* p = &raster->pixels[(y * 2) * w + x * 2];
+            int r = (p[0].r + p[1].r + p[w].r + p[w + 1].r + 2) >> 2;
+            int g = (p[0].g + p[1].g + p[w].g + p[w + 1].g + 2) >> 2;
+            int b = (p[0].b + p[1].b + p[w].b + p[w + 1].b + 2) >> 2;
+            u_plane[y * (w / 2) + x] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+            v_plane[y * (w / 2) + x] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+        }
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <defines.h>
+#include <beatmap.h>
+
+// Frames in flight between the simulation, render and encode stages
+#ifndef EXPORT_FRAMES_IN_FLIGHT
+#define EXPORT_FRAMES_IN_FLIGHT 8
+#endif
+
+
+typedef struct export_config_s {
+    const char* video_filepath;     // .y4m file, or "|command" to pipe the stream into
+    const char* audio_filepath;     // .wav, NULL to skip the mixdown
+    const char* music_filepath;
+    const char* hitsound_filepath;
+    int         fps;
+    int         width;
+    int         height;
+} export_config_t;
+
+
+// Plays the beatmap on a virtual clock as fast as possible. Input comes from the input
+// module (replay backend) unless autoplay is set. Output only depends on the inputs.
+bool export_run(const beatmap_t* beatmap, bool autoplay, export_config_t config);
+
+
+#endif
@@ -0,0 +1,149 @@
+#include <frame_pacer.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <raylib.h>
+
+#include <timer.h>
+#define SCOPE_NAME "frame pacer"
+#include <logging.h>
+
+
+static const char* s_mode_names[] = {
+    "unlimited",
+    "fps",
+    "vsync",
+    "low-latency",
+};
+
+static frame_pacer_mode_t   s_mode = FRAME_PACER_UNLIMITED;
+static double               s_period = 0;
+static double               s_deadline = 0;
+static double               s_frame_start = 0;
+static double               s_last_present = 0;
+static double               s_render_estimate = 0;
+static double               s_history[FRAME_PACER_HISTORY];
+static int                  s_history_count = 0;
+static int                  s_history_i = 0;
+
+
+void frame_pacer_init(frame_pacer_mode_t mode, int target_fps) {
+    int refresh_rate = GetMonitorRefreshRate(GetCurrentMonitor());
+    if (refresh_rate <= 0)
+        refresh_rate = 60;
+
+    s_mode = mode;
+    s_period = (mode == FRAME_PACER_TARGET_FPS && target_fps > 0) ? 1.0 / target_fps : 1.0 / refresh_rate;
+    s_deadline = s_last_present = s_render_estimate = 0;
+    s_history_count = s_history_i = 0;
+
+    // raylib's own limiter is off, pacing is done here
+    SetTargetFPS(0);
+    if (mode == FRAME_PACER_VSYNC || mode == FRAME_PACER_LOW_LATENCY)
+        SetWindowState(FLAG_VSYNC_HINT);
+    else
+        ClearWindowState(FLAG_VSYNC_HINT);
+
+    LOGF("%s, period %.3f ms (monitor %d Hz)", s_mode_names[mode], s_period * 1000, refresh_rate);
+}
+
+bool frame_pacer_mode_from_name(const char* name, frame_pacer_mode_t* mode, int* target_fps) {
+    char* end = NULL;
+    long fps = strtol(name, &end, 10);
+    if (end != name && *end == '\0' && fps > 0) {
+        *mode = FRAME_PACER_TARGET_FPS;
+        *target_fps = fps;
+        return true;
+    }
+
+    for (int i = 0; i < STACKARRAY_SIZE(s_mode_names); i++) {
+        if (i != FRAME_PACER_TARGET_FPS && strcmp(name, s_mode_names[i]) == 0) {
+            *mode = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void frame_pacer_wait() {
+    double now = timer_now();
+
+    if (s_mode == FRAME_PACER_TARGET_FPS) {
+        // fixed cadence, resynchronized after a frame that overran by more than a period
+        s_deadline += s_period;
+        if (s_deadline < now - s_period)
+            s_deadline = now;
+        timer_wait_until(s_deadline);
+    }
+    else if (s_mode == FRAME_PACER_LOW_LATENCY && s_last_present > 0) {
+        // the swap after a vsync'd present returns right at vblank, so the next one is a period
+        // later; start just early enough for the frame to be ready in time
+        double vblank = s_last_present + s_period;
+        while (vblank < now)
+            vblank += s_period;
+        timer_wait_until(vblank - s_render_estimate - FRAME_PACER_VBLANK_MARGIN);
+    }
+
+    s_frame_start = timer_now();
+}
+
+void frame_pacer_rendered() {
+    double duration = timer_now() - s_frame_start;
+
+    // jumps up on slow frames, decays slowly, so a single spike doesn't cause a missed vblank
+    if (duration > s_render_estimate)
+        s_render_estimate = duration;
+    else
+        s_render_estimate = s_render_estimate * 0.98 + duration * 0.02;
+}
+
+void frame_pacer_presented() {
+    double now = timer_now();
+
+    if (s_last_present > 0) {
+        s_history[s_history_i] = now - s_last_present;
+        s_history_i = (s_history_i + 1) % FRAME_PACER_HISTORY;
+        s_history_count = min(s_history_count + 1, FRAME_PACER_HISTORY);
+    }
+    s_last_present = now;
+}
+
+void frame_pacer_resume() {
+    s_deadline = s_last_present = 0;
+}
+
+frame_pacer_stats_t frame_pacer_stats() {
+    frame_pacer_stats_t stats = { .frames = s_history_count };
+    if (s_history_count == 0)
+        return stats;
+
+    double sum = 0;
+    stats.min = stats.max = s_history[0];
+    for (int i = 0; i < s_history_count; i++) {
+        sum += s_history[i];
+        stats.min = min(stats.min, s_history[i]);
+        stats.max = max(stats.max, s_history[i]);
+    }
+    stats.mean = sum / s_history_count;
+
+    double variance = 0;
+    for (int i = 0; i < s_history_count; i++)
+        variance += (s_history[i] - stats.mean) * (s_history[i] - stats.mean);
+    stats.stddev = sqrt(variance / s_history_count);
+
+    return stats;
+}
+
+void frame_pacer_log_stats() {
+    frame_pacer_stats_t stats = frame_pacer_stats();
+    LOGF(
+        "last %d frames: mean %.3f ms, stddev %.3f ms, min %.3f ms, max %.3f ms",
+        stats.frames,
+        stats.mean * 1000,
+        stats.stddev * 1000,
+        stats.min * 1000,
+        stats.max * 1000
+    );
+}
@@ -0,0 +1,47 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <defines.h>
+
+#ifndef FRAME_PACER_HISTORY
+#define FRAME_PACER_HISTORY 256
+#endif
+
+// Headroom left before the predicted vblank in FRAME_PACER_LOW_LATENCY mode
+#ifndef FRAME_PACER_VBLANK_MARGIN
+#define FRAME_PACER_VBLANK_MARGIN 0.001
+#endif
+
+
+typedef enum {
+    FRAME_PACER_UNLIMITED,
+    FRAME_PACER_TARGET_FPS,     // hybrid sleep/spin limiter
+    FRAME_PACER_VSYNC,          // swap interval 1
+    FRAME_PACER_LOW_LATENCY,    // vsync, but the frame starts as late as possible before vblank
+} frame_pacer_mode_t;
+
+typedef struct frame_pacer_stats_s {
+    int     frames;
+    double  mean;       // seconds between presents
+    double  stddev;
+    double  min;
+    double  max;
+} frame_pacer_stats_t;
+
+
+// Must be called on the render thread after the window was created.
+void frame_pacer_init(frame_pacer_mode_t mode, int target_fps);
+bool frame_pacer_mode_from_name(const char* name, frame_pacer_mode_t* mode, int* target_fps);
+
+// Call order per frame: wait() -> draw -> rendered() -> EndDrawing() -> presented()
+void frame_pacer_wait();
+void frame_pacer_rendered();
+void frame_pacer_presented();
+// Forgets the last present, so a pause in rendering doesn't show up as one long frame.
+void frame_pacer_resume();
+
+frame_pacer_stats_t frame_pacer_stats();
+void frame_pacer_log_stats();
+
+
+#endif
@@ -0,0 +1,294 @@
+#include <gameplay.h>
+
+#include <assert.h>
+#include <math.h>
+
+#define SCOPE_NAME "gameplay"
+#include <logging.h>
+
+
+static void _step(gameplay_t* gameplay);
+static void _autoplay(gameplay_t* gameplay);
+static void _judge_input(gameplay_t* gameplay, const input_event_t* input);
+static void _sweep_misses(gameplay_t* gameplay);
+static void _update_timing_points(gameplay_t* gameplay);
+static judgement_t _judge_offset(const gameplay_t* gameplay, double offset);
+static void _count(gameplay_t* gameplay, judgement_t judgement);
+static void _hitsound(gameplay_t* gameplay, int column, int note, double time);
+
+
+bool gameplay_load(gameplay_t* gameplay, const beatmap_t* beatmap, bool autoplay, gameplay_hitsound_f on_hitsound) {
+    if (beatmap->CS < 1 || beatmap->CS > INPUT_MAX_COLUMNS) {
+        LOGF("Unsupported column count %.0f", beatmap->CS);
+        return false;
+    }
+
+    *gameplay = (gameplay_t){0};
+    gameplay->beatmap = beatmap;
+    gameplay->autoplay = autoplay;
+    gameplay->on_hitsound = on_hitsound;
+
+    // osu!mania judgement windows: https://osu.ppy.sh/wiki/en/Gameplay/Judgement/osu%21mania
+    gameplay->windows[JUDGEMENT_MAX]  = 16 / 1000.0f;
+    gameplay->windows[JUDGEMENT_300]  = (64 - 3 * beatmap->OD) / 1000.0f;
+    gameplay->windows[JUDGEMENT_200]  = (97 - 3 * beatmap->OD) / 1000.0f;
+    gameplay->windows[JUDGEMENT_100]  = (127 - 3 * beatmap->OD) / 1000.0f;
+    gameplay->windows[JUDGEMENT_50]   = (151 - 3 * beatmap->OD) / 1000.0f;
+    gameplay->windows[JUDGEMENT_MISS] = (188 - 3 * beatmap->OD) / 1000.0f;
+
+    LOG("preprocessing hit objects ...");
+    kv_init(gameplay->columns);
+    for (int i = 0; i < beatmap->CS; i++) {
+        column_t col;
+        kv_init(col);
+        kv_push(column_t, gameplay->columns, col);
+    }
+    for (int i = 0; i < kv_size(beatmap->notes); i++) {
+        beatmap_note_t note = kv_A(beatmap->notes, i);
+        column_t* column = &kv_A(gameplay->columns, note.column);
+
+        if (note.is_hold_note) {
+            note_event_t hold_start = { NOTE_HOLD_START, note.time_start / 1000.0f, i };
+            note_event_t hold_end = { NOTE_HOLD_END, note.time_end / 1000.0f, i };
+            kv_push(note_event_t, *column, hold_start);
+            kv_push(note_event_t, *column, hold_end);
+        }
+        else {
+            note_event_t event = { NOTE_CLICK, note.time_start / 1000.0f, i };
+            kv_push(note_event_t, *column, event);
+        }
+    }
+
+    gameplay_state_t* state = &gameplay->state;
+    state->timing_point = -1;
+    state->bpm = -1;
+    state->sv = beatmap->SV;
+    for (int i = 0; i < INPUT_MAX_COLUMNS; i++) {
+        state->cursors[i] = -1;
+        state->hit_anims[i] = -10;
+    }
+    gameplay->previous = *state;
+
+    return true;
+}
+
+void gameplay_destroy(gameplay_t* gameplay) {
+    for (int i = 0; i < kv_size(gameplay->columns); i++)
+        kv_destroy(kv_A(gameplay->columns, i));
+    kv_destroy(gameplay->columns);
+    kv_init(gameplay->columns);
+}
+
+void gameplay_update(gameplay_t* gameplay, double playback_pos) {
+    // the clock going back (a loop wrapping) can not be stepped through, going forward always
+    // is, a stall still judges the inputs it held up. Seeks forward call gameplay_seek() first.
+    if (playback_pos < gameplay->state.time - GAMEPLAY_TICK) {
+        gameplay_seek(gameplay, playback_pos);
+        return;
+    }
+
+    // ticks only depend on input timestamps, so the frame rate never changes the outcome
+    while (gameplay->state.time + GAMEPLAY_TICK <= playback_pos) {
+        gameplay->previous = gameplay->state;
+        _step(gameplay);
+    }
+}
+
+void gameplay_seek(gameplay_t* gameplay, double playback_pos) {
+    gameplay_state_t* state = &gameplay->state;
+
+    for (int ci = 0; ci < kv_size(gameplay->columns); ci++) {
+        column_t* col = &kv_A(gameplay->columns, ci);
+
+        // notes before the new position are skipped, a hold note that is in progress stays pending
+        int cursor = -1;
+        while (cursor + 1 < kv_size(*col) && kv_A(*col, cursor + 1).time < playback_pos)
+            cursor++;
+        if (cursor >= 0 && kv_A(*col, cursor).type == NOTE_HOLD_START)
+            state->hold_heads[ci] = JUDGEMENT_MAX;
+
+        state->cursors[ci] = cursor;
+        if (gameplay->autoplay)
+            state->held[ci] = cursor >= 0 && kv_A(*col, cursor).type == NOTE_HOLD_START;
+    }
+
+    state->timing_point = -1;
+    state->time = playback_pos;
+    _update_timing_points(gameplay);
+    gameplay->previous = *state;
+}
+
+double gameplay_interpolate(const gameplay_state_t* previous, const gameplay_state_t* state, double playback_pos) {
+    double alpha = (playback_pos - state->time) / GAMEPLAY_TICK;
+    alpha = CONSTRAIN(alpha, 0.0, 1.0);
+    return previous->time + (state->time - previous->time) * alpha;
+}
+
+float gameplay_accuracy(const gameplay_state_t* state) {
+    if (state->judged_count == 0)
+        return 1;
+
+    int points =
+        300 * (state->judgements[JUDGEMENT_MAX] + state->judgements[JUDGEMENT_300]) +
+        200 * state->judgements[JUDGEMENT_200] +
+        100 * state->judgements[JUDGEMENT_100] +
+        50 * state->judgements[JUDGEMENT_50];
+    return points / (300.0f * state->judged_count);
+}
+
+void _step(gameplay_t* gameplay) {
+    double tick_end = gameplay->state.time + GAMEPLAY_TICK;
+
+    if (!gameplay->autoplay) {
+        input_event_t input;
+        while (input_peek(&input) && input.time < tick_end) {
+            input_pop(&input);
+            _judge_input(gameplay, &input);
+        }
+    }
+
+    gameplay->state.time = tick_end;
+
+    if (gameplay->autoplay)
+        _autoplay(gameplay);
+    else
+        _sweep_misses(gameplay);
+
+    _update_timing_points(gameplay);
+}
+
+void _autoplay(gameplay_t* gameplay) {
+    gameplay_state_t* state = &gameplay->state;
+
+    for (int ci = 0; ci < kv_size(gameplay->columns); ci++) {
+        column_t* col = &kv_A(gameplay->columns, ci);
+
+        while (state->cursors[ci] + 1 < kv_size(*col)) {
+            note_event_t* event = &kv_A(*col, state->cursors[ci] + 1);
+            if (event->time > state->time)
+                break;
+
+            state->cursors[ci]++;
+            _hitsound(gameplay, ci, event->note, event->time);
+
+            if (event->type == NOTE_HOLD_START) {
+                state->held[ci] = true;
+                continue;
+            }
+
+            state->held[ci] = false;
+            state->hit_anims[ci] = event->time;
+            _count(gameplay, JUDGEMENT_MAX);
+        }
+    }
+}
+
+void _judge_input(gameplay_t* gameplay, const input_event_t* input) {
+    gameplay_state_t* state = &gameplay->state;
+    int ci = input->column;
+    column_t* col = &kv_A(gameplay->columns, ci);
+    int next = state->cursors[ci] + 1;
+
+    state->held[ci] = input->is_pressed;
+    if (!input->is_pressed)
+        state->hit_anims[ci] = input->time;
+
+    if (next >= kv_size(*col))
+        return;
+    note_event_t* event = &kv_A(*col, next);
+
+    if (input->is_pressed && event->type != NOTE_HOLD_END) {
+        judgement_t judgement = _judge_offset(gameplay, input->time - event->time);
+        if (fabs(input->time - event->time) > gameplay->windows[JUDGEMENT_MISS])
+            return;
+
+        state->cursors[ci]++;
+        if (event->type == NOTE_HOLD_START && judgement != JUDGEMENT_MISS) {
+            state->hold_heads[ci] = judgement;
+        }
+        else {
+            if (event->type == NOTE_HOLD_START)
+                state->cursors[ci]++;
+            _count(gameplay, judgement);
+        }
+
+        if (judgement != JUDGEMENT_MISS)
+            _hitsound(gameplay, ci, event->note, input->time);
+    }
+    else if (!input->is_pressed && event->type == NOTE_HOLD_END) {
+        judgement_t tail = (input->time < event->time - gameplay->windows[JUDGEMENT_50])
+            ? JUDGEMENT_MISS
+            : _judge_offset(gameplay, input->time - event->time);
+
+        state->cursors[ci]++;
+        _count(gameplay, max(state->hold_heads[ci], tail));
+    }
+}
+
+void _sweep_misses(gameplay_t* gameplay) {
+    gameplay_state_t* state = &gameplay->state;
+
+    for (int ci = 0; ci < kv_size(gameplay->columns); ci++) {
+        column_t* col = &kv_A(gameplay->columns, ci);
+
+        while (state->cursors[ci] + 1 < kv_size(*col)) {
+            note_event_t* event = &kv_A(*col, state->cursors[ci] + 1);
+
+            if (event->type == NOTE_HOLD_END && state->time > event->time + gameplay->windows[JUDGEMENT_50]) {
+                // held through the end of the note
+                state->cursors[ci]++;
+                _count(gameplay, state->hold_heads[ci]);
+            }
+            else if (event->type != NOTE_HOLD_END && state->time > event->time + gameplay->windows[JUDGEMENT_MISS]) {
+                state->cursors[ci] += (event->type == NOTE_HOLD_START) ? 2 : 1;
+                _count(gameplay, JUDGEMENT_MISS);
+            }
+            else {
+                break;
+            }
+        }
+    }
+}
+
+void _update_timing_points(gameplay_t* gameplay) {
+    gameplay_state_t* state = &gameplay->state;
+    const beatmap_t* beatmap = gameplay->beatmap;
+
+    while (state->timing_point + 1 < kv_size(beatmap->timing_points)) {
+        beatmap_timing_point_t* tm = &kv_A(beatmap->timing_points, state->timing_point + 1);
+        if (tm->time_start / 1000.0f > state->time)
+            break;
+
+        if (tm->is_uninherited)
+            state->bpm = 1.0f / tm->length * 60000;
+        state->sv = (tm->is_uninherited) ? (beatmap->SV) : (beatmap->SV * (-tm->length / 100.0f));
+        state->timing_point++;
+
+        LOGF(
+            "Timing Point: [%s] BPM: %7.0f, SV: %5.1f, Meter: %d",
+            (tm->is_uninherited) ? "!" : "+",
+            state->bpm,
+            state->sv,
+            tm->meter
+        );
+    }
+}
+
+judgement_t _judge_offset(const gameplay_t* gameplay, double offset) {
+    offset = fabs(offset);
+    for (judgement_t j = JUDGEMENT_MAX; j < JUDGEMENT_MISS; j++)
+        if (offset <= gameplay->windows[j])
+            return j;
+    return JUDGEMENT_MISS;
+}
+
+void _count(gameplay_t* gameplay, judgement_t judgement) {
+    assert(judgement < JUDGEMENT_COUNT);
+    gameplay->state.judgements[judgement]++;
+    gameplay->state.judged_count++;
+}
+
+void _hitsound(gameplay_t* gameplay, int column, int note, double time) {
+    if (gameplay->on_hitsound)
+        gameplay->on_hitsound(column, note, time);
+}
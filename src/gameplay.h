@@ -0,0 +1,84 @@
+#ifndef GAMEPLAY_H
+#define GAMEPLAY_H
+
+#include <kvec.h>
+
+#include <defines.h>
+#include <beatmap.h>
+#include <input.h>
+
+#ifndef GAMEPLAY_TICK_RATE
+#define GAMEPLAY_TICK_RATE 1000
+#endif
+
+#define GAMEPLAY_TICK (1.0 / GAMEPLAY_TICK_RATE)
+
+
+typedef enum {
+    NOTE_CLICK,
+    NOTE_HOLD_START,
+    NOTE_HOLD_END,
+} event_type_t;
+
+typedef struct note_event_s {
+    event_type_t type;
+    float time;
+    int note;   // in beatmap_t.notes
+} note_event_t;
+
+typedef kvec_t(note_event_t) column_t;
+
+// Ordered from best to worst
+typedef enum {
+    JUDGEMENT_MAX,
+    JUDGEMENT_300,
+    JUDGEMENT_200,
+    JUDGEMENT_100,
+    JUDGEMENT_50,
+    JUDGEMENT_MISS,
+    JUDGEMENT_COUNT,
+} judgement_t;
+
+// note is the index in beatmap_t.notes of the note that was hit
+typedef void (*gameplay_hitsound_f)(int column, int note, double time);
+
+// Everything that changes during play. Plain data, so it can be copied as a snapshot.
+typedef struct gameplay_state_s {
+    double      time;                           // playback position of the last tick
+    int         cursors[INPUT_MAX_COLUMNS];     // last judged event per column
+    bool        held[INPUT_MAX_COLUMNS];
+    double      hit_anims[INPUT_MAX_COLUMNS];   // playback position of the last hit or release
+    judgement_t hold_heads[INPUT_MAX_COLUMNS];
+    int         judgements[JUDGEMENT_COUNT];
+    int         judged_count;
+    int         timing_point;
+    float       bpm;
+    float       sv;
+} gameplay_state_t;
+
+typedef struct gameplay_s {
+    const beatmap_t*        beatmap;
+    kvec_t(column_t)        columns;
+    bool                    autoplay;
+    gameplay_hitsound_f     on_hitsound;
+    float                   windows[JUDGEMENT_COUNT];
+
+    gameplay_state_t        state;
+    gameplay_state_t        previous;
+} gameplay_t;
+
+
+bool gameplay_load(gameplay_t* gameplay, const beatmap_t* beatmap, bool autoplay, gameplay_hitsound_f on_hitsound);
+void gameplay_destroy(gameplay_t* gameplay);
+
+// Runs fixed GAMEPLAY_TICK steps until the simulation reaches playback_pos, however far ahead
+// it is. Seeks when playback_pos is behind.
+void gameplay_update(gameplay_t* gameplay, double playback_pos);
+void gameplay_seek(gameplay_t* gameplay, double playback_pos);
+
+// Playback position to render at, interpolated between two consecutive tick states.
+double gameplay_interpolate(const gameplay_state_t* previous, const gameplay_state_t* state, double playback_pos);
+float gameplay_accuracy(const gameplay_state_t* state);
+
+
+#endif
@@ -0,0 +1,167 @@
+#include <input.h>
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include <raylib.h>
+
+#include <input_evdev.h>
+#include <playback_clock.h>
+#include <ring.h>
+#define SCOPE_NAME "input"
+#include <logging.h>
+
+
+static const int s_keymaps[INPUT_MAX_COLUMNS][INPUT_MAX_COLUMNS] = {
+    { KEY_B },
+    { KEY_F, KEY_J },
+    { KEY_F, KEY_B, KEY_J },
+    { KEY_D, KEY_F, KEY_J, KEY_K },
+    { KEY_D, KEY_F, KEY_B, KEY_J, KEY_K },
+    { KEY_S, KEY_D, KEY_F, KEY_J, KEY_K, KEY_L },
+    { KEY_S, KEY_D, KEY_F, KEY_B, KEY_J, KEY_K, KEY_L },
+    { KEY_A, KEY_S, KEY_D, KEY_F, KEY_J, KEY_K, KEY_L, KEY_SEMICOLON },
+    { KEY_A, KEY_S, KEY_D, KEY_F, KEY_B, KEY_J, KEY_K, KEY_L, KEY_SEMICOLON },
+};
+
+static const char* s_backend_names[] = {
+    "raylib",
+    "evdev",
+    "replay",
+};
+
+static input_backend_id_t   s_backend = INPUT_BACKEND_RAYLIB;
+static const int*           s_keys = NULL;
+static int                  s_column_count = 0;
+static bool                 s_initialized = false;
+static atomic_bool          s_is_focused = true;
+static ring_t               s_queue;
+
+static void _poll_raylib();
+
+
+bool input_init(input_backend_id_t backend, int column_count, const char* replay_filepath) {
+    assert(!s_initialized);
+
+    if (column_count < 1 || column_count > INPUT_MAX_COLUMNS) {
+        LOGF("Unsupported column count %d", column_count);
+        return false;
+    }
+
+    s_backend = backend;
+    s_keys = s_keymaps[column_count - 1];
+    s_column_count = column_count;
+    ring_init(&s_queue, sizeof(input_event_t), INPUT_QUEUE_SIZE);
+
+#ifdef __linux__
+    bool ok = true;
+    if (backend == INPUT_BACKEND_EVDEV)
+        ok = input_evdev_open(s_keys, column_count);
+    else if (backend == INPUT_BACKEND_REPLAY)
+        ok = input_evdev_replay_open(replay_filepath, s_keys, column_count);
+#else
+    bool ok = backend == INPUT_BACKEND_RAYLIB;
+    if (!ok)
+        LOGF("Input backend \"%s\" is only available on Linux", s_backend_names[backend]);
+#endif
+
+    if (!ok) {
+        ring_destroy(&s_queue);
+        return false;
+    }
+
+    LOGF("using %s backend", s_backend_names[backend]);
+    s_initialized = true;
+    return true;
+}
+
+void input_shutdown() {
+    if (!s_initialized)
+        return;
+
+#ifdef __linux__
+    if (s_backend != INPUT_BACKEND_RAYLIB)
+        input_evdev_close();
+#endif
+
+    ring_destroy(&s_queue);
+    s_initialized = false;
+}
+
+bool input_backend_from_name(const char* name, input_backend_id_t* backend) {
+    for (int i = 0; i < STACKARRAY_SIZE(s_backend_names); i++) {
+        if (strcmp(name, s_backend_names[i]) == 0) {
+            *backend = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool input_capture_start(const char* filepath) {
+    assert(s_initialized);
+
+#ifdef __linux__
+    if (s_backend == INPUT_BACKEND_EVDEV)
+        return input_evdev_capture_start(filepath);
+#endif
+
+    LOG("Capturing is only supported with the evdev backend");
+    return false;
+}
+
+void input_poll_window() {
+    assert(s_initialized);
+
+    atomic_store_explicit(&s_is_focused, IsWindowFocused(), memory_order_relaxed);
+    if (s_backend == INPUT_BACKEND_RAYLIB)
+        _poll_raylib();
+}
+
+void input_poll() {
+    assert(s_initialized);
+
+    switch (s_backend) {
+#ifdef __linux__
+    case INPUT_BACKEND_EVDEV:
+        input_evdev_poll(atomic_load_explicit(&s_is_focused, memory_order_relaxed));
+        break;
+    case INPUT_BACKEND_REPLAY:
+        input_evdev_replay_poll(playback_clock_now());
+        break;
+#endif
+    default:
+        break;
+    }
+}
+
+bool input_peek(input_event_t* event) {
+    return s_initialized && ring_peek(&s_queue, event, 1) == 1;
+}
+
+bool input_pop(input_event_t* event) {
+    return s_initialized && ring_read(&s_queue, event, 1) == 1;
+}
+
+int input_column_key(int column) {
+    assert(s_initialized && column >= 0 && column < s_column_count);
+    return s_keys[column];
+}
+
+void _input_push_event(input_event_t event) {
+    if (ring_write(&s_queue, &event, 1) == 0)
+        LOG("Input queue overflow, dropping event");
+}
+
+void _poll_raylib() {
+    // GLFW does not expose event timestamps, so everything polled this frame happened "now"
+    double time = playback_clock_now();
+
+    for (int i = 0; i < s_column_count; i++) {
+        if (IsKeyPressed(s_keys[i]))
+            _input_push_event((input_event_t) { i, true, time });
+        if (IsKeyReleased(s_keys[i]))
+            _input_push_event((input_event_t) { i, false, time });
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <defines.h>
+
+#ifndef INPUT_QUEUE_SIZE
+#define INPUT_QUEUE_SIZE 256
+#endif
+
+#define INPUT_MAX_COLUMNS 9
+
+
+typedef enum {
+    INPUT_BACKEND_RAYLIB,   // GLFW key state, frame quantized
+    INPUT_BACKEND_EVDEV,    // /dev/input/event* with kernel timestamps (Linux only)
+    INPUT_BACKEND_REPLAY,   // captured evdev stream played back from a file (Linux only)
+} input_backend_id_t;
+
+typedef struct input_event_s {
+    int     column;
+    bool    is_pressed;
+    double  time;       // playback position in seconds
+} input_event_t;
+
+
+bool input_init(input_backend_id_t backend, int column_count, const char* replay_filepath);
+void input_shutdown();
+bool input_backend_from_name(const char* name, input_backend_id_t* backend);
+
+// Writes every key event read from evdev devices to a file that INPUT_BACKEND_REPLAY can read.
+bool input_capture_start(const char* filepath);
+
+// Must be called on the thread that owns the window, after raylib polled its events.
+void input_poll_window();
+
+// Reads pending events of the device backends. Event times are mapped with playback_clock_at().
+// The queue is single producer / single consumer: events are produced by whichever of the two
+// poll functions serves the active backend and consumed by one simulation thread.
+void input_poll();
+bool input_peek(input_event_t* event);
+bool input_pop(input_event_t* event);
+
+int input_column_key(int column);
+
+
+#endif
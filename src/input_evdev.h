@@ -0,0 +1,19 @@
+#ifndef INPUT_EVDEV_H
+#define INPUT_EVDEV_H
+
+#include <input.h>
+
+
+// Backend interface implemented by input_evdev_linux.c, only used by input.c.
+
+bool input_evdev_open(const int* column_keys, int column_count);
+bool input_evdev_replay_open(const char* filepath, const int* column_keys, int column_count);
+void input_evdev_close();
+bool input_evdev_capture_start(const char* filepath);
+void input_evdev_poll(bool is_focused);
+void input_evdev_replay_poll(double playback_pos);
+
+void _input_push_event(input_event_t event);
+
+
+#endif
@@ -0,0 +1,373 @@
+#include <input_evdev.h>
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+// linux/input.h defines KEY_* as well, so raylib.h can't be included here
+#include <playback_clock.h>
+#include <timer.h>
+#define SCOPE_NAME "evdev"
+#include <logging.h>
+
+#define EVDEV_DIRECTORY     "/dev/input"
+#define EVDEV_MAX_DEVICES   16
+#define EVDEV_READ_BATCH    64
+
+#define BITS_PER_LONG           (sizeof(unsigned long) * 8)
+#define BITS_TO_LONGS(n)        (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define TEST_BIT(bits, i)       (((bits)[(i) / BITS_PER_LONG] >> ((i) % BITS_PER_LONG)) & 1)
+
+
+typedef struct evdev_device_s {
+    int     fd;
+    bool    is_dropped;     // SYN_DROPPED received, ignoring events until the next SYN_REPORT
+    char    path[64];
+} evdev_device_t;
+
+// raylib key codes of printable keys are their ASCII values
+static const struct { int key; int code; } s_key_table[] = {
+    { 'A', KEY_A }, { 'B', KEY_B }, { 'C', KEY_C }, { 'D', KEY_D }, { 'E', KEY_E },
+    { 'F', KEY_F }, { 'G', KEY_G }, { 'H', KEY_H }, { 'I', KEY_I }, { 'J', KEY_J },
+    { 'K', KEY_K }, { 'L', KEY_L }, { 'M', KEY_M }, { 'N', KEY_N }, { 'O', KEY_O },
+    { 'P', KEY_P }, { 'Q', KEY_Q }, { 'R', KEY_R }, { 'S', KEY_S }, { 'T', KEY_T },
+    { 'U', KEY_U }, { 'V', KEY_V }, { 'W', KEY_W }, { 'X', KEY_X }, { 'Y', KEY_Y },
+    { 'Z', KEY_Z }, { ';', KEY_SEMICOLON }, { ',', KEY_COMMA }, { '.', KEY_DOT },
+    { '/', KEY_SLASH }, { ' ', KEY_SPACE },
+};
+
+static evdev_device_t       s_devices[EVDEV_MAX_DEVICES];
+static int                  s_device_count = 0;
+static int                  s_inotify_fd = -1;
+static int                  s_codes[INPUT_MAX_COLUMNS];
+static int                  s_column_count = 0;
+static bool                 s_held[INPUT_MAX_COLUMNS];
+static bool                 s_was_focused = true;
+static FILE*                s_capture = NULL;
+
+static struct input_event*  s_replay = NULL;
+static size_t               s_replay_size = 0;
+static size_t               s_replay_cursor = 0;
+static double               s_replay_start = 0;
+
+static bool _map_keys(const int* column_keys, int column_count);
+static int _column_from_code(int code);
+static double _event_time(const struct input_event* ev);
+static void _scan_devices();
+static void _open_device(const char* path);
+static void _close_device(int i);
+static void _read_device(evdev_device_t* device, bool is_focused);
+static void _resync_device(evdev_device_t* device);
+static void _handle_hotplug();
+static void _emit(int column, bool is_pressed, double time);
+
+
+bool input_evdev_open(const int* column_keys, int column_count) {
+    if (!_map_keys(column_keys, column_count))
+        return false;
+
+    s_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (s_inotify_fd == -1 || inotify_add_watch(s_inotify_fd, EVDEV_DIRECTORY, IN_CREATE | IN_ATTRIB) == -1)
+        LOGF("Device hot-plug is unavailable: %s", strerror(errno));
+
+    _scan_devices();
+    if (s_device_count == 0)
+        LOG("No keyboards found yet (is the user in the \"input\" group?)");
+
+    return true;
+}
+
+bool input_evdev_replay_open(const char* filepath, const int* column_keys, int column_count) {
+    if (!_map_keys(column_keys, column_count))
+        return false;
+
+    FILE* file = (filepath) ? fopen(filepath, "rb") : NULL;
+    if (file == NULL) {
+        LOGF("Failed to open replay \"%s\"", (filepath) ? filepath : "(null)");
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if (size <= 0 || size % sizeof(struct input_event) != 0) {
+        LOGF("\"%s\" is not an evdev stream", filepath);
+        fclose(file);
+        return false;
+    }
+
+    s_replay_size = size / sizeof(struct input_event);
+    s_replay = malloc(size);
+    bool ok = fread(s_replay, sizeof(struct input_event), s_replay_size, file) == s_replay_size;
+    fclose(file);
+
+    if (!ok) {
+        LOGF("Failed to read replay \"%s\"", filepath);
+        SAFE_DELETE(s_replay);
+        return false;
+    }
+
+    // timestamps are rebased so that the first record is playback position 0
+    s_replay_cursor = 0;
+    s_replay_start = _event_time(&s_replay[0]);
+
+    LOGF("replaying %zu events from \"%s\"", s_replay_size, filepath);
+    return true;
+}
+
+void input_evdev_close() {
+    while (s_device_count > 0)
+        _close_device(s_device_count - 1);
+
+    if (s_inotify_fd != -1) {
+        close(s_inotify_fd);
+        s_inotify_fd = -1;
+    }
+    if (s_capture) {
+        fclose(s_capture);
+        s_capture = NULL;
+    }
+
+    SAFE_DELETE(s_replay);
+    s_replay_size = s_replay_cursor = 0;
+}
+
+bool input_evdev_capture_start(const char* filepath) {
+    assert(s_capture == NULL);
+
+    s_capture = fopen(filepath, "wb");
+    if (s_capture == NULL) {
+        LOGF("Failed to create capture \"%s\"", filepath);
+        return false;
+    }
+
+    // captures store playback positions as timestamps, the anchor makes the first record 0
+    struct input_event anchor = { .type = EV_SYN, .code = SYN_REPORT };
+    fwrite(&anchor, sizeof(anchor), 1, s_capture);
+
+    LOGF("capturing to \"%s\"", filepath);
+    return true;
+}
+
+void input_evdev_poll(bool is_focused) {
+    _handle_hotplug();
+
+    if (!is_focused && s_was_focused) {
+        double now = playback_clock_at(timer_now());
+        for (int i = 0; i < s_column_count; i++)
+            if (s_held[i])
+                _emit(i, false, now);
+    }
+    s_was_focused = is_focused;
+
+    for (int i = 0; i < s_device_count; i++) {
+        _read_device(&s_devices[i], is_focused);
+
+        if (s_devices[i].fd == -1)
+            _close_device(i--);
+    }
+}
+
+void input_evdev_replay_poll(double playback_pos) {
+    while (s_replay_cursor < s_replay_size) {
+        const struct input_event* ev = &s_replay[s_replay_cursor];
+        double time = _event_time(ev) - s_replay_start;
+
+        if (time > playback_pos)
+            break;
+
+        int column = (ev->type == EV_KEY && ev->value != 2) ? _column_from_code(ev->code) : -1;
+        if (column != -1)
+            _emit(column, ev->value == 1, time);
+
+        s_replay_cursor++;
+    }
+}
+
+bool _map_keys(const int* column_keys, int column_count) {
+    assert(column_count <= INPUT_MAX_COLUMNS);
+
+    for (int i = 0; i < column_count; i++) {
+        s_codes[i] = -1;
+        for (int j = 0; j < STACKARRAY_SIZE(s_key_table); j++)
+            if (s_key_table[j].key == column_keys[i])
+                s_codes[i] = s_key_table[j].code;
+
+        if (s_codes[i] == -1) {
+            LOGF("Key %d has no evdev mapping", column_keys[i]);
+            return false;
+        }
+        s_held[i] = false;
+    }
+
+    s_column_count = column_count;
+    return true;
+}
+
+int _column_from_code(int code) {
+    for (int i = 0; i < s_column_count; i++)
+        if (s_codes[i] == code)
+            return i;
+    return -1;
+}
+
+double _event_time(const struct input_event* ev) {
+    return ev->input_event_sec + ev->input_event_usec / 1e6;
+}
+
+void _scan_devices() {
+    DIR* dir = opendir(EVDEV_DIRECTORY);
+    if (dir == NULL) {
+        LOGF("Failed to open " EVDEV_DIRECTORY ": %s", strerror(errno));
+        return;
+    }
+
+    char path[64];
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "event", 5) != 0)
+            continue;
+        snprintf(path, sizeof(path), EVDEV_DIRECTORY "/%s", entry->d_name);
+        _open_device(path);
+    }
+
+    closedir(dir);
+}
+
+void _open_device(const char* path) {
+    for (int i = 0; i < s_device_count; i++)
+        if (strcmp(s_devices[i].path, path) == 0)
+            return;
+
+    if (s_device_count == EVDEV_MAX_DEVICES)
+        return;
+
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1)
+        return;
+
+    // only devices that have every column key are treated as keyboards
+    unsigned long key_bits[BITS_TO_LONGS(KEY_CNT)] = {0};
+    bool is_keyboard = ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(key_bits)), key_bits) >= 0;
+    for (int i = 0; is_keyboard && i < s_column_count; i++)
+        is_keyboard = TEST_BIT(key_bits, s_codes[i]);
+
+    int clock_id = CLOCK_MONOTONIC;
+    if (!is_keyboard || ioctl(fd, EVIOCSCLOCKID, &clock_id) == -1) {
+        close(fd);
+        return;
+    }
+
+    char name[128] = "unknown";
+    ioctl(fd, EVIOCGNAME(sizeof(name)), name);
+
+    evdev_device_t* device = &s_devices[s_device_count++];
+    *device = (evdev_device_t) { .fd = fd };
+    snprintf(device->path, sizeof(device->path), "%s", path);
+
+    LOGF("keyboard \"%s\" (%s)", name, path);
+}
+
+void _close_device(int i) {
+    assert(i >= 0 && i < s_device_count);
+
+    if (s_devices[i].fd != -1) {
+        close(s_devices[i].fd);
+        LOGF("closed %s", s_devices[i].path);
+    }
+    s_devices[i] = s_devices[--s_device_count];
+}
+
+void _read_device(evdev_device_t* device, bool is_focused) {
+    struct input_event events[EVDEV_READ_BATCH];
+
+    while (true) {
+        ssize_t n = read(device->fd, events, sizeof(events));
+        if (n == -1) {
+            if (errno == ENODEV) {
+                close(device->fd);
+                device->fd = -1;
+                LOGF("disconnected %s", device->path);
+            }
+            return;
+        }
+
+        for (int i = 0; i < n / (ssize_t)sizeof(struct input_event); i++) {
+            const struct input_event* ev = &events[i];
+
+            if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+                device->is_dropped = true;
+            }
+            else if (ev->type == EV_SYN && ev->code == SYN_REPORT && device->is_dropped) {
+                device->is_dropped = false;
+                if (is_focused)
+                    _resync_device(device);
+            }
+            else if (ev->type == EV_KEY && ev->value != 2 && !device->is_dropped && is_focused) {
+                int column = _column_from_code(ev->code);
+                if (column != -1)
+                    _emit(column, ev->value == 1, playback_clock_at(_event_time(ev)));
+            }
+        }
+    }
+}
+
+void _resync_device(evdev_device_t* device) {
+    unsigned long key_state[BITS_TO_LONGS(KEY_CNT)] = {0};
+    if (ioctl(device->fd, EVIOCGKEY(sizeof(key_state)), key_state) == -1)
+        return;
+
+    double now = playback_clock_at(timer_now());
+    for (int i = 0; i < s_column_count; i++)
+        _emit(i, TEST_BIT(key_state, s_codes[i]), now);
+}
+
+void _handle_hotplug() {
+    if (s_inotify_fd == -1)
+        return;
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char path[64];
+    ssize_t n;
+
+    while ((n = read(s_inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char* p = buffer; p < buffer + n;) {
+            const struct inotify_event* ev = (const struct inotify_event*)p;
+            // udev applies permissions after the node is created, so IN_ATTRIB is retried too
+            if (ev->len > 0 && strncmp(ev->name, "event", 5) == 0) {
+                snprintf(path, sizeof(path), EVDEV_DIRECTORY "/%s", ev->name);
+                _open_device(path);
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
+
+void _emit(int column, bool is_pressed, double time) {
+    if (s_held[column] == is_pressed)
+        return;
+    s_held[column] = is_pressed;
+
+    _input_push_event((input_event_t) { column, is_pressed, time });
+
+    if (s_capture) {
+        struct input_event ev = {
+            .type = EV_KEY,
+            .code = s_codes[column],
+            .value = is_pressed,
+        };
+        ev.input_event_sec = (time_t)max(time, 0);
+        ev.input_event_usec = (suseconds_t)((max(time, 0) - ev.input_event_sec) * 1e6);
+        fwrite(&ev, sizeof(ev), 1, s_capture);
+    }
+}
@@ -1,6 +1,7 @@
 #include <logging.h>
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
@@ -19,6 +20,8 @@
 
 static kvec_t(log_callback_f) s_callbacks;
 static bool s_initialized = false;
+// held while callbacks run, every thread logs and the console lines must not interleave
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static void _raylib_log_callback(int logLevel, const char *text, va_list args);
 
@@ -47,12 +50,14 @@ void logging_shutdown() {
 void logging_register(log_callback_f consumer) {
     assert(s_initialized);
 
+    pthread_mutex_lock(&s_mutex);
     int last_null_i = -1;
     for (size_t i = 0; i < kv_size(s_callbacks); i++) {
         if (kv_A(s_callbacks, i) == NULL) {
             last_null_i = i;
         }
         else if (kv_A(s_callbacks, i) == consumer) {
+            pthread_mutex_unlock(&s_mutex);
             return;
         }
     }
@@ -63,17 +68,20 @@ void logging_register(log_callback_f consumer) {
     else {
         kv_push(log_callback_f, s_callbacks, consumer);
     }
+    pthread_mutex_unlock(&s_mutex);
 }
 
 void logging_unregister(log_callback_f consumer) {
     assert(s_initialized);
 
+    pthread_mutex_lock(&s_mutex);
     for (size_t i = 0; i < kv_size(s_callbacks); i++) {
         if (kv_A(s_callbacks, i) == consumer) {
             kv_A(s_callbacks, i) = NULL;
-            return;
+            break;
         }
     }
+    pthread_mutex_unlock(&s_mutex);
 }
 
 void _logging_push_entry(log_entry_t entry) {
@@ -83,9 +91,11 @@ void _logging_push_entry(log_entry_t entry) {
 		time(NULL), clock()
 	};
 
+    pthread_mutex_lock(&s_mutex);
 	for (size_t i = 0; i < kv_size(s_callbacks); i++)
         if (kv_A(s_callbacks, i) != NULL)
             kv_A(s_callbacks, i)(entry);
+    pthread_mutex_unlock(&s_mutex);
 
     _log_entry_destroy(&entry);
 }
@@ -115,9 +125,8 @@ log_msg_t _logging_create_msg_f(const char* scope, const char* fmt, ...) {
 }
 
 void _console_callback(log_entry_t entry) {
-	static char time_buffer[32];
+	char time_buffer[32] = {'\0'};
 	int bw = 0;
-	memset(time_buffer, 0, STACKARRAY_SIZE(time_buffer));
 
 	bw = snprintf(
 		time_buffer,
@@ -0,0 +1,515 @@
+#include <loudness.h>
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define CPU_COUNT() pthread_num_processors_np()
+#else
+#include <unistd.h>
+#define CPU_COUNT() ((int)sysconf(_SC_NPROCESSORS_ONLN))
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <raylib.h>
+#include <kvec.h>
+
+#include <decoder.h>
+#include <pcm_cache.h>
+#include <timer.h>
+#define SCOPE_NAME "loudness"
+#include <logging.h>
+
+#define RESULT_MAGIC 0x3253554Cu // "LUS2"
+
+// True peak interpolation, BS.1770-4 annex 2 asks for at least 4x with 12 taps per phase
+#define PHASES 4
+#define PHASE_TAPS 12
+
+// Gating blocks are 400 ms long and start every 100 ms
+#define SUBBLOCK 0.1
+#define BLOCK_SUBBLOCKS 4
+#define ABSOLUTE_GATE -70.0
+#define RELATIVE_GATE -10.0
+
+
+// K-weighting and true peak state of one thread
+typedef struct meter_s {
+    double      b[2][3];            // high shelf, then high pass
+    double      a[2][2];
+    double      z[2][2][DECODER_CHANNELS];
+    float       history[DECODER_CHANNELS][2 * PHASE_TAPS];  // every frame is written twice, so the taps are contiguous
+    int         history_pos;
+    float       peak;
+} meter_t;
+
+// Shared by the threads of loudness_measure()
+typedef struct measure_job_s {
+    const char*     filepath;
+    const char*     index_filepath;
+    int             sample_rate;
+    int             source_channels;
+    int             subblock_frames;
+    uint64_t*       bounds;         // chunk i covers [bounds[i], bounds[i + 1]), on subblock boundaries
+    float*          peaks;          // per chunk
+    double*         energies;       // mean square per subblock, negative until measured
+    int             subblock_count;
+    int             chunk_count;
+    atomic_int      next_chunk;
+    atomic_bool     has_failed;
+} measure_job_t;
+
+typedef struct result_header_s {
+    uint32_t    magic;
+    uint32_t    reserved;
+    double      integrated;
+    double      true_peak;
+} result_header_t;
+
+typedef struct scan_entry_s {
+    char*       filepath;
+    loudness_t  loudness;
+    atomic_int  state;              // 0 pending, 1 measured, -1 failed
+} scan_entry_t;
+
+static float                    s_taps[PHASE_TAPS][PHASES];
+static pthread_once_t           s_taps_once = PTHREAD_ONCE_INIT;
+
+static bool                     s_is_scanning = false;
+static pthread_t                s_thread;
+static kvec_t(scan_entry_t)     s_entries;
+static char                     s_directory[512];
+static atomic_bool              s_quit = false;
+static atomic_bool              s_is_done = false;
+
+static void* _measure_thread(void* arg);
+static bool _measure_chunk(measure_job_t* job, decoder_t* decoder, meter_t* meter, float* frames, int chunk);
+static void _meter_init(meter_t* meter, int sample_rate);
+static void _meter_run(meter_t* meter, const float* frames, int count, double* energy);
+static void _init_taps();
+static double _gate(const measure_job_t* job);
+static bool _block(const measure_job_t* job, int first, double* energy);
+static bool _load_result(const char* result_filepath, loudness_t* loudness);
+static void _save_result(const char* result_filepath, const loudness_t* loudness);
+static void* _scan_thread(void* arg);
+
+
+bool loudness_measure(const char* filepath, const char* index_filepath, int threads, loudness_t* loudness) {
+    decoder_t decoder;
+    if (!decoder_open(&decoder, filepath, index_filepath))
+        return false;
+
+    measure_job_t job = {
+        .filepath = filepath,
+        .index_filepath = index_filepath,
+        .sample_rate = decoder.sample_rate,
+        .source_channels = decoder.channels,
+        .subblock_frames = (int)lround(decoder.sample_rate * SUBBLOCK),
+    };
+    job.subblock_count = (int)((decoder.frame_count + job.subblock_frames - 1) / job.subblock_frames);
+    double length = decoder_length(&decoder);
+    decoder_close(&decoder);
+
+    if (threads <= 0)
+        threads = CPU_COUNT();
+    int chunk_count = max(1, min(2 * threads, (int)(length / LOUDNESS_MIN_CHUNK)));
+    chunk_count = min(chunk_count, max(1, job.subblock_count));
+    threads = max(1, min(threads, min(chunk_count, LOUDNESS_MAX_THREADS)));
+
+    job.bounds = malloc((chunk_count + 1) * sizeof(uint64_t));
+    job.peaks = calloc(chunk_count, sizeof(float));
+    job.energies = malloc(max(1, job.subblock_count) * sizeof(double));
+    if (!job.bounds || !job.peaks || !job.energies) {
+        LOG("Failed to allocate the measurement");
+        free(job.bounds);
+        free(job.peaks);
+        free(job.energies);
+        return false;
+    }
+    for (int i = 0; i <= chunk_count; i++)
+        job.bounds[i] = (uint64_t)(job.subblock_count * (int64_t)i / chunk_count) * job.subblock_frames;
+    for (int i = 0; i < job.subblock_count; i++)
+        job.energies[i] = -1;
+    job.chunk_count = chunk_count;
+    atomic_store(&job.next_chunk, 0);
+    atomic_store(&job.has_failed, false);
+
+    pthread_t pool[LOUDNESS_MAX_THREADS];
+    int started = 0;
+    while (started < threads - 1 && pthread_create(&pool[started], NULL, _measure_thread, &job) == 0)
+        started++;
+
+    // the calling thread helps out as well, at least one thread always runs
+    _measure_thread(&job);
+    for (int i = 0; i < started; i++)
+        pthread_join(pool[i], NULL);
+
+    bool ok = !atomic_load(&job.has_failed);
+    if (ok) {
+        float peak = 0;
+        for (int i = 0; i < chunk_count; i++)
+            peak = max(peak, job.peaks[i]);
+        loudness->integrated = _gate(&job);
+        loudness->true_peak = (peak > 0) ? 20 * log10(peak) : -200.0;
+    }
+
+    free(job.bounds);
+    free(job.peaks);
+    free(job.energies);
+    return ok;
+}
+
+bool loudness_get(const char* filepath, const char* directory, loudness_t* loudness) {
+    char result_filepath[512], index_filepath[512];
+    bool has_cache = directory && pcm_cache_filepath(filepath, directory, "loudness", result_filepath, STACKARRAY_SIZE(result_filepath));
+    if (has_cache && _load_result(result_filepath, loudness))
+        return true;
+
+    bool has_index = directory && pcm_cache_filepath(filepath, directory, "seek", index_filepath, STACKARRAY_SIZE(index_filepath));
+    double start = timer_now();
+    if (!loudness_measure(filepath, (has_index) ? index_filepath : NULL, 0, loudness)) {
+        LOGF("Failed to measure \"%s\"", filepath);
+        return false;
+    }
+    LOGF(
+        "\"%s\": %.1f LUFS, %.1f dBTP, measured in %.3f s",
+        GetFileName(filepath),
+        loudness->integrated,
+        loudness->true_peak,
+        timer_now() - start
+    );
+
+    if (has_cache)
+        _save_result(result_filepath, loudness);
+    return true;
+}
+
+float loudness_gain(const loudness_t* loudness, double target) {
+    double gain = min(target - loudness->integrated, LOUDNESS_MAX_PEAK - loudness->true_peak);
+    return (float)pow(10, gain / 20);
+}
+
+bool loudness_scan(const char* const* filepaths, int count, const char* directory) {
+    kv_init(s_entries);
+    for (int i = 0; i < count; i++) {
+        scan_entry_t entry = { .filepath = strdup(filepaths[i]) };
+        kv_push(scan_entry_t, s_entries, entry);
+    }
+    snprintf(s_directory, STACKARRAY_SIZE(s_directory), "%s", (directory) ? directory : "");
+    atomic_store(&s_quit, false);
+    atomic_store(&s_is_done, false);
+
+    if (pthread_create(&s_thread, NULL, _scan_thread, NULL) != 0) {
+        LOG("Failed to start the scan thread");
+        for (int i = 0; i < kv_size(s_entries); i++)
+            free(kv_A(s_entries, i).filepath);
+        kv_destroy(s_entries);
+        return false;
+    }
+    s_is_scanning = true;
+    return true;
+}
+
+bool loudness_result(const char* filepath, loudness_t* loudness) {
+    if (!s_is_scanning)
+        return false;
+
+    for (int i = 0; i < kv_size(s_entries); i++) {
+        scan_entry_t* entry = &kv_A(s_entries, i);
+        if (strcmp(entry->filepath, filepath) != 0)
+            continue;
+        if (atomic_load_explicit(&entry->state, memory_order_acquire) != 1)
+            return false;
+        *loudness = entry->loudness;
+        return true;
+    }
+    return false;
+}
+
+bool loudness_scan_wait(double timeout) {
+    double start = timer_now();
+    while (s_is_scanning && !atomic_load(&s_is_done) && timer_now() - start < timeout)
+        timer_sleep(LOUDNESS_INTERVAL);
+    return s_is_scanning && atomic_load(&s_is_done);
+}
+
+void loudness_shutdown() {
+    if (!s_is_scanning)
+        return;
+
+    atomic_store(&s_quit, true);
+    pthread_join(s_thread, NULL);
+    for (int i = 0; i < kv_size(s_entries); i++)
+        free(kv_A(s_entries, i).filepath);
+    kv_destroy(s_entries);
+    s_is_scanning = false;
+}
+
+void* _measure_thread(void* arg) {
+    measure_job_t* job = arg;
+    pthread_once(&s_taps_once, _init_taps);
+
+    decoder_t decoder;
+    if (!decoder_open(&decoder, job->filepath, job->index_filepath)) {
+        atomic_store(&job->has_failed, true);
+        return NULL;
+    }
+    meter_t meter;
+    float* frames = malloc(job->subblock_frames * DECODER_CHANNELS * sizeof(float));
+    if (!frames) {
+        atomic_store(&job->has_failed, true);
+        decoder_close(&decoder);
+        return NULL;
+    }
+
+    int chunk;
+    while (!atomic_load(&job->has_failed) && (chunk = atomic_fetch_add(&job->next_chunk, 1)) < job->chunk_count) {
+        if (!_measure_chunk(job, &decoder, &meter, frames, chunk)) {
+            LOGF("Failed to decode \"%s\"", job->filepath);
+            atomic_store(&job->has_failed, true);
+        }
+    }
+
+    free(frames);
+    decoder_close(&decoder);
+    return NULL;
+}
+
+bool _measure_chunk(measure_job_t* job, decoder_t* decoder, meter_t* meter, float* frames, int chunk) {
+    uint64_t start = job->bounds[chunk];
+    uint64_t end = job->bounds[chunk + 1];
+
+    // the filters start from silence, the frames before the chunk only bring them up to speed
+    uint64_t warmup = min(start, (uint64_t)(LOUDNESS_WARMUP * job->sample_rate));
+    _meter_init(meter, job->sample_rate);
+    if (!decoder_seek(decoder, start - warmup))
+        return false;
+    while (warmup > 0) {
+        int read = decoder_read(decoder, frames, (int)min(warmup, (uint64_t)job->subblock_frames));
+        if (read <= 0)
+            return false;
+        _meter_run(meter, frames, read, NULL);
+        warmup -= read;
+    }
+
+    // mono is decoded to two identical channels, but counts once
+    double weight = (job->source_channels == 1) ? 0.5 : 1.0;
+    for (uint64_t frame = start; frame < end; frame += job->subblock_frames) {
+        int read = decoder_read(decoder, frames, job->subblock_frames);
+        if (read <= 0)
+            break;
+
+        double energy = 0;
+        _meter_run(meter, frames, read, &energy);
+        // a partial subblock at the end is not part of any complete block
+        if (read < job->subblock_frames)
+            break;
+        job->energies[frame / job->subblock_frames] = energy * weight / read;
+    }
+
+    job->peaks[chunk] = meter->peak;
+    return true;
+}
+
+void _meter_init(meter_t* meter, int sample_rate) {
+    *meter = (meter_t){0};
+
+    // BS.1770 gives coefficients for 48 kHz, these come from the analog prototypes at any rate
+    double k = tan(M_PI * 1681.974450955533 / sample_rate);
+    double q = 0.7071752369554196;
+    double vh = pow(10, 3.999843853973347 / 20);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1 + k / q + k * k;
+    meter->b[0][0] = (vh + vb * k / q + k * k) / a0;
+    meter->b[0][1] = 2 * (k * k - vh) / a0;
+    meter->b[0][2] = (vh - vb * k / q + k * k) / a0;
+    meter->a[0][0] = 2 * (k * k - 1) / a0;
+    meter->a[0][1] = (1 - k / q + k * k) / a0;
+
+    k = tan(M_PI * 38.13547087602444 / sample_rate);
+    q = 0.5003270373238773;
+    a0 = 1 + k / q + k * k;
+    meter->b[1][0] = 1;
+    meter->b[1][1] = -2;
+    meter->b[1][2] = 1;
+    meter->a[1][0] = 2 * (k * k - 1) / a0;
+    meter->a[1][1] = (1 - k / q + k * k) / a0;
+}
+
+void _meter_run(meter_t* meter, const float* frames, int count, double* energy) {
+    int i = 0;
+#if defined(__SSE2__)
+    // both channels go through the filters at once, one per lane
+    __m128d b0[2], b1[2], b2[2], a1[2], a2[2], z1[2], z2[2];
+    for (int s = 0; s < 2; s++) {
+        b0[s] = _mm_set1_pd(meter->b[s][0]);
+        b1[s] = _mm_set1_pd(meter->b[s][1]);
+        b2[s] = _mm_set1_pd(meter->b[s][2]);
+        a1[s] = _mm_set1_pd(meter->a[s][0]);
+        a2[s] = _mm_set1_pd(meter->a[s][1]);
+        z1[s] = _mm_loadu_pd(meter->z[s][0]);
+        z2[s] = _mm_loadu_pd(meter->z[s][1]);
+    }
+    __m128d sum = _mm_setzero_pd();
+    for (; i < count; i++) {
+        __m128d x = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)(frames + i * DECODER_CHANNELS))));
+        for (int s = 0; s < 2; s++) {
+            __m128d y = _mm_add_pd(_mm_mul_pd(b0[s], x), z1[s]);
+            z1[s] = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b1[s], x), _mm_mul_pd(a1[s], y)), z2[s]);
+            z2[s] = _mm_sub_pd(_mm_mul_pd(b2[s], x), _mm_mul_pd(a2[s], y));
+            x = y;
+        }
+        sum = _mm_add_pd(sum, _mm_mul_pd(x, x));
+    }
+    for (int s = 0; s < 2; s++) {
+        _mm_storeu_pd(meter->z[s][0], z1[s]);
+        _mm_storeu_pd(meter->z[s][1], z2[s]);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, sum);
+    if (energy)
+        *energy += lanes[0] + lanes[1];
+#endif
+    for (; i < count; i++) {
+        for (int c = 0; c < DECODER_CHANNELS; c++) {
+            double x = frames[i * DECODER_CHANNELS + c];
+            for (int s = 0; s < 2; s++) {
+                double y = meter->b[s][0] * x + meter->z[s][0][c];
+                meter->z[s][0][c] = meter->b[s][1] * x - meter->a[s][0] * y + meter->z[s][1][c];
+                meter->z[s][1][c] = meter->b[s][2] * x - meter->a[s][1] * y;
+                x = y;
+            }
+            if (energy)
+                *energy += x * x;
+        }
+    }
+
+    // the history keeps running through the warmup, only the peak waits for the chunk
+    for (i = 0; i < count; i++) {
+        int pos = meter->history_pos;
+        for (int c = 0; c < DECODER_CHANNELS; c++) {
+            float x = frames[i * DECODER_CHANNELS + c];
+            meter->history[c][pos] = x;
+            meter->history[c][pos + PHASE_TAPS] = x;
+        }
+        meter->history_pos = (pos + 1) % PHASE_TAPS;
+        if (!energy)
+            continue;
+
+        for (int c = 0; c < DECODER_CHANNELS; c++) {
+            const float* taps = &meter->history[c][pos + 1];
+#if defined(__SSE2__)
+            // all four phases at once, one per lane
+            __m128 acc = _mm_setzero_ps();
+            for (int t = 0; t < PHASE_TAPS; t++)
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(taps[t]), _mm_loadu_ps(s_taps[t])));
+            acc = _mm_andnot_ps(_mm_set1_ps(-0.0f), acc);
+            acc = _mm_max_ps(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(1, 0, 3, 2)));
+            acc = _mm_max_ps(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(2, 3, 0, 1)));
+            meter->peak = max(meter->peak, _mm_cvtss_f32(acc));
+#else
+            for (int p = 0; p < PHASES; p++) {
+                float y = 0;
+                for (int t = 0; t < PHASE_TAPS; t++)
+                    y += taps[t] * s_taps[t][p];
+                meter->peak = max(meter->peak, fabsf(y));
+            }
+#endif
+        }
+    }
+}
+
+void _init_taps() {
+    // Hann windowed sinc cut off at the original Nyquist frequency, split into phases with
+    // the taps ordered from the oldest frame to the newest. Centered on a tap, so phase 0 is
+    // the frames themselves and a sample peak is never read lower than it is.
+    const int length = PHASES * PHASE_TAPS;
+    for (int n = 0; n < length; n++) {
+        double t = (n - length / 2) / (double)PHASES;
+        double sinc = (t == 0) ? 1 : sin(M_PI * t) / (M_PI * t);
+        double window = 0.5 - 0.5 * cos(2 * M_PI * n / length);
+        s_taps[PHASE_TAPS - 1 - n / PHASES][n % PHASES] = (float)(sinc * window);
+    }
+}
+
+double _gate(const measure_job_t* job) {
+    int block_count = 0;
+    double absolute_sum = 0;
+    double absolute_threshold = pow(10, (ABSOLUTE_GATE + 0.691) / 10);
+    double z;
+    for (int i = 0; i + BLOCK_SUBBLOCKS <= job->subblock_count; i++) {
+        if (_block(job, i, &z) && z > absolute_threshold) {
+            absolute_sum += z;
+            block_count++;
+        }
+    }
+    if (block_count == 0)
+        return ABSOLUTE_GATE;
+
+    double relative_threshold = absolute_sum / block_count * pow(10, RELATIVE_GATE / 10);
+    double sum = 0;
+    block_count = 0;
+    for (int i = 0; i + BLOCK_SUBBLOCKS <= job->subblock_count; i++) {
+        if (_block(job, i, &z) && z > absolute_threshold && z > relative_threshold) {
+            sum += z;
+            block_count++;
+        }
+    }
+    return (block_count > 0) ? -0.691 + 10 * log10(sum / block_count) : ABSOLUTE_GATE;
+}
+
+bool _block(const measure_job_t* job, int first, double* energy) {
+    *energy = 0;
+    for (int j = 0; j < BLOCK_SUBBLOCKS; j++) {
+        if (job->energies[first + j] < 0)
+            return false;
+        *energy += job->energies[first + j];
+    }
+    *energy /= BLOCK_SUBBLOCKS;
+    return true;
+}
+
+bool _load_result(const char* result_filepath, loudness_t* loudness) {
+    if (!FileExists(result_filepath))
+        return false;
+
+    unsigned int size = 0;
+    unsigned char* data = LoadFileData(result_filepath, &size);
+    if (!data)
+        return false;
+
+    result_header_t header = {0};
+    if (size == sizeof(header))
+        memcpy(&header, data, sizeof(header));
+    UnloadFileData(data);
+
+    if (header.magic != RESULT_MAGIC)
+        return false;
+    loudness->integrated = header.integrated;
+    loudness->true_peak = header.true_peak;
+    return true;
+}
+
+void _save_result(const char* result_filepath, const loudness_t* loudness) {
+    result_header_t header = { RESULT_MAGIC, 0, loudness->integrated, loudness->true_peak };
+    if (!SaveFileData(result_filepath, &header, sizeof(header)))
+        LOGF("Failed to write \"%s\"", result_filepath);
+}
+
+void* _scan_thread(void* arg) {
+    const char* directory = (s_directory[0]) ? s_directory : NULL;
+    for (int i = 0; i < kv_size(s_entries) && !atomic_load(&s_quit); i++) {
+        scan_entry_t* entry = &kv_A(s_entries, i);
+        bool ok = loudness_get(entry->filepath, directory, &entry->loudness);
+        atomic_store_explicit(&entry->state, (ok) ? 1 : -1, memory_order_release);
+    }
+    atomic_store(&s_is_done, true);
+    return NULL;
+}
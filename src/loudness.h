@@ -0,0 +1,65 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <stdint.h>
+
+#include <defines.h>
+
+// Integrated loudness music is normalized to, in LUFS
+#ifndef LOUDNESS_TARGET
+#define LOUDNESS_TARGET -14.0
+#endif
+
+// Normalizing never pushes the true peak above this, in dBTP
+#ifndef LOUDNESS_MAX_PEAK
+#define LOUDNESS_MAX_PEAK -1.0
+#endif
+
+// Decoded ahead of every chunk a thread measures, so the filters have settled at its start
+#ifndef LOUDNESS_WARMUP
+#define LOUDNESS_WARMUP 0.5
+#endif
+
+// Shortest piece of a file a thread measures, in seconds
+#ifndef LOUDNESS_MIN_CHUNK
+#define LOUDNESS_MIN_CHUNK 10.0
+#endif
+
+#ifndef LOUDNESS_MAX_THREADS
+#define LOUDNESS_MAX_THREADS 32
+#endif
+
+// How often loudness_scan_wait() checks on the scan thread
+#ifndef LOUDNESS_INTERVAL
+#define LOUDNESS_INTERVAL 0.005
+#endif
+
+
+typedef struct loudness_s {
+    double  integrated;     // LUFS, gated as in ITU-R BS.1770-4
+    double  true_peak;      // dBTP, from 4x oversampling
+} loudness_t;
+
+
+// Measures a whole file on up to threads threads, 0 for one per core. The seek index is
+// optional, see decoder_open().
+bool loudness_measure(const char* filepath, const char* index_filepath, int threads, loudness_t* loudness);
+
+// Loads the loudness of a file measured before from directory, or measures and stores it.
+// Results are named like the PCM cache, see pcm_cache_filepath().
+bool loudness_get(const char* filepath, const char* directory, loudness_t* loudness);
+
+// Linear gain that brings the file to target LUFS, limited by LOUDNESS_MAX_PEAK.
+float loudness_gain(const loudness_t* loudness, double target);
+
+// Runs loudness_get() over the files on a background thread. The file paths are copied.
+bool loudness_scan(const char* const* filepaths, int count, const char* directory);
+// Returns false while the file is not measured yet, or when measuring it failed.
+bool loudness_result(const char* filepath, loudness_t* loudness);
+// Waits up to timeout seconds for the scan to finish, returns whether it did.
+bool loudness_scan_wait(double timeout);
+// Stops the scan after the file being measured.
+void loudness_shutdown();
+
+
+#endif
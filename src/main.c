@@ -1,83 +1,165 @@
 #include <assert.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <raylib.h>
 #include <kvec.h>
+#include <ketopt.h>
 
 #include <logging.h>
 #include <beatmap.h>
+#include <export.h>
+#include <gameplay.h>
+#include <input.h>
+#include <loudness.h>
+#include <mixdown.h>
+#include <mixer.h>
+#include <music.h>
+#include <onset.h>
+#include <playback_clock.h>
+#include <practice.h>
+#include <render.h>
+#include <sample_bank.h>
+#include <task_graph.h>
+#include <timer.h>
+#include <waveform.h>
 #include <string.h>
 
-
-typedef enum {
-    NOTE_CLICK,
-    NOTE_HOLD_START,
-    NOTE_HOLD_END,
-} event_type_t;
-
-typedef struct note_event_s {
-    event_type_t type;
-    float time;
-} note_event_t;
-
-typedef kvec_t(note_event_t) column_t;
-
-static kvec_t(column_t) columns;
-static Sound hit;
-static Music audio;
+// How often the simulation wakes up while the music is paused
+#define SIMULATION_IDLE_INTERVAL 0.01
+
+// Playback waits this long for the loudness of a song measured for the first time, a result
+// that arrives later fades in over LOUDNESS_FADE seconds instead of jumping
+#define LOUDNESS_START_WAIT 0.5
+#define LOUDNESS_FADE 2.0
+
+enum {
+    OPTION_IDLE_FPS = 300,
+    OPTION_CHART,
+    OPTION_SCALE,
+    OPTION_EXPORT_FPS,
+    OPTION_EXPORT_AUDIO,
+    OPTION_MIXDOWN,
+    OPTION_MUSIC_BUFFER,
+    OPTION_MUSIC,
+    OPTION_MUSIC_CACHE,
+    OPTION_RATE,
+    OPTION_SAMPLE_BUDGET,
+    OPTION_LOUDNESS,
+    OPTION_CHECK_TIMING,
+};
+
+
+static gameplay_t gameplay;
 static beatmap_t beatmap;
-static const int width = 280;
-static const int height = 480;
-static const float line_y = height * 0.9f;
+static practice_t practice;
+static waveform_t waveform;
 
 static void init(int argc, const char *argv[]);
+static void start_playback();
+static void* simulate(void* arg);
+static bool task_window(void* data);
+static bool task_audio(void* data);
+static bool task_beatmap(void* data);
+static bool task_loudness(void* data);
+static bool task_input(void* data);
+static bool task_music(void* data);
+static bool task_gameplay(void* data);
+static bool task_waveform(void* data);
+static bool task_playfield(void* data);
+static bool task_mixer(void* data);
+static bool task_keysounds(void* data);
+static bool task_autoplay(void* data);
+static bool export_video();
+static bool export_mixdown();
+static bool check_timing();
 static void deinit();
-static void load_beatmap(const char* filepath);
-static void load_note_columns();
-static void draw_notes();
-static void draw_keys();
-static void draw_info();
+static void parse_args(int argc, const char *argv[]);
+static void resolve_path(char* dest, int size, const char* path);
+static bool load_beatmap(const char* filepath);
+static bool start_input();
 static void update_input();
-static void update_autoplayer();
-static void update_difficulty();
+static void play_hitsound(int column, int note, double time);
+static bool load_keysounds();
+static void load_autoplay_hitsounds();
+static void schedule_autoplay_hitsounds(double playback_pos);
+static void seek_autoplay_hitsounds(double playback_pos);
+static int compare_hits(const void* a, const void* b);
 static void update_events();
+static void update_loudness();
+static void log_first_frame();
 
 
-static float    bpm = -1;
-static int      last_event = -1;
-static int      last_timing_point = -1;
-static int      last_hit_col_i[9] = {-1};
-static int      hit_note_count = 0;
-static float    time_window = 1;
-static int      last_hit_i = -1;
 static float    vol = 0.3;
-static double   hit_anims[9] = {-10};
-static float    pos = 0;
+static bool     autoplay = true;
+
+static input_backend_id_t input_backend = INPUT_BACKEND_RAYLIB;
+static render_config_t render_config = { FRAME_PACER_VSYNC, 0, 0, PLAYFIELD_GL_DYNAMIC, 1 };
+static const char* beatmap_path = NULL;
+static char     replay_path[512] = {'\0'};
+static char     capture_path[512] = {'\0'};
+static char     hitsound_path[512] = {'\0'};
+static char     export_path[512] = {'\0'};
+static char     export_audio_path[512] = {'\0'};
+static int      export_fps = 60;
+typedef struct autoplay_hit_s {
+    double  time;
+    int     note;
+} autoplay_hit_t;
+
+static kvec_t(autoplay_hit_t) autoplay_hits;
+static kvec_t(int) note_samples;    // sample bank id of every note, -1 plays the default hitsound
+static size_t   sample_budget = SAMPLE_BANK_DEFAULT_BUDGET;
+static int      autoplay_cursor = 0;
+static char     mixdown_path[512] = {'\0'};
+static music_config_t music_config = { MUSIC_STREAM, MUSIC_DEFAULT_BUFFER, NULL, PCM_CACHE_RAW, STRETCH_TEMPO, 1 };
+static char     cache_path[512] = {'\0'};
+static bool     is_normalized = true;
+static double   loudness_target = LOUDNESS_TARGET;
+static bool     is_gain_known = false;
+static float    gain = 1;
+static float    gain_start = 1;
+static float    gain_target = 1;
+static double   gain_fade_start = 0;
+static bool     is_timing_checked = false;
+static bool     has_waveform = false;
+static double   start_time = 0;
+static bool     is_first_frame_logged = false;
+
 int main(int argc, const char *argv[]) {
     init(argc, argv);
 
-    LOG("playing");
-    while (!WindowShouldClose()) {
-        pos = GetMusicTimePlayed(audio);
-
-        BeginDrawing();
-        ClearBackground(WHITE);
-
-        DrawLine(0, line_y, width, line_y, LIGHTGRAY);
-
-        draw_notes();
-        draw_keys();
-        draw_info();
-
-        UpdateMusicStream(audio);
-        update_input();
-        update_autoplayer();
-        update_difficulty();
+    if (export_path[0]) {
+        bool ok = export_video();
+        deinit();
+        return (ok) ? 0 : -1;
+    }
+    if (mixdown_path[0]) {
+        bool ok = export_mixdown();
+        deinit();
+        return (ok) ? 0 : -1;
+    }
+    if (is_timing_checked) {
+        bool ok = check_timing();
+        deinit();
+        return (ok) ? 0 : -1;
+    }
 
-        EndDrawing();
+    start_playback();
+    LOG("playing");
+    // the window has to stay on the main thread, the simulation gets its own
+    pthread_t simulation;
+    if (pthread_create(&simulation, NULL, simulate, NULL) != 0) {
+        LOG("Failed to create simulation thread");
+        deinit();
+        return -1;
     }
+    render_run();
+    pthread_join(simulation, NULL);
 
     deinit();
     return 0;
@@ -85,249 +167,536 @@ int main(int argc, const char *argv[]) {
 
 
 void init(int argc, const char *argv[]) {
+    start_time = timer_now();
     logging_init();
+    parse_args(argc, argv);
 
-    if (argc <= 1) {
-        printf("Usage: %s <.osu file>\n", GetFileName(argv[0]));
-        exit(0);
+    ChangeDirectory(GetDirectoryPath(argv[0]));
+    resolve_path(hitsound_path, STACKARRAY_SIZE(hitsound_path), "assets/hit2.wav");
+    resolve_path(cache_path, STACKARRAY_SIZE(cache_path), "cache");
+    music_config.cache_directory = cache_path;
+
+    // offline runs have no window or audio device to overlap the loading with, playback
+    // loads the chart in start_playback()
+    if (export_path[0] || mixdown_path[0] || is_timing_checked) {
+        if (!load_beatmap(beatmap_path) || !start_input())
+            exit(-1);
     }
+}
 
-    ChangeDirectory(GetDirectoryPath(argv[0]));
+void start_playback() {
+    // the window, the audio device and the chart load at the same time, the window and GL
+    // steps are pinned to this thread, the main one
+    task_graph_t graph;
+    task_graph_init(&graph);
+    int window = task_graph_add(&graph, "window", task_window, NULL, NULL, 0);
+    int audio = task_graph_add(&graph, "audio", task_audio, NULL, NULL, 0);
+    int chart = task_graph_add(&graph, "beatmap", task_beatmap, NULL, NULL, 0);
+    task_graph_add(&graph, "loudness", task_loudness, NULL, (int[]) { chart }, 1);
+    task_graph_add(&graph, "input", task_input, NULL, (int[]) { chart }, 1);
+    task_graph_add(&graph, "music", task_music, NULL, (int[]) { chart, audio }, 2);
+    int columns = task_graph_add(&graph, "gameplay", task_gameplay, NULL, (int[]) { chart }, 1);
+    int timeline = task_graph_add(&graph, "waveform", task_waveform, NULL, (int[]) { chart }, 1);
+    int playfield = task_graph_add(&graph, "playfield", task_playfield, NULL, (int[]) { window, columns, timeline }, 3);
+    int mixer = task_graph_add(&graph, "mixer", task_mixer, NULL, (int[]) { audio }, 1);
+    int keysounds = task_graph_add(&graph, "keysounds", task_keysounds, NULL, (int[]) { chart, mixer }, 2);
+    task_graph_add(&graph, "autoplay", task_autoplay, NULL, (int[]) { keysounds }, 1);
+    task_graph_pin(&graph, window);
+    task_graph_pin(&graph, playfield);
+
+    bool ok = task_graph_run(&graph, 0);
+    task_graph_log_trace(&graph);
+    task_graph_destroy(&graph);
+    if (!ok)
+        exit(-1);
 
-    InitWindow(width, height, "CMania");
-    // SetTargetFPS(60);
+    if (is_normalized)
+        loudness_scan_wait(LOUDNESS_START_WAIT);
+    update_loudness();
+    if (!music_play())
+        exit(-1);
+    SetMasterVolume(0.1);
+}
 
+void* simulate(void* arg) {
+    while (!render_should_close()) {
+        // commands go first, so seeks and loop starts show in this iteration's position
+        update_input();
+
+        unsigned int pass;
+        double playback_pos = playback_clock_sync(music_time_played_pass(&pass), music_is_playing());
+
+        input_poll();
+        if (practice_update(&practice, &gameplay, pass))
+            seek_autoplay_hitsounds(practice.start);
+        sample_bank_update(playback_pos);
+        update_loudness();
+        log_first_frame();
+        schedule_autoplay_hitsounds(playback_pos);
+        gameplay_update(&gameplay, playback_pos);
+        render_publish(&gameplay, vol, music_rate());
+
+        // nothing advances while paused, only render commands need to be picked up
+        timer_sleep(music_is_playing() ? GAMEPLAY_TICK : SIMULATION_IDLE_INTERVAL);
+    }
+    return NULL;
+}
+
+bool task_window(void* data) {
+    return render_start(render_config);
+}
+
+bool task_audio(void* data) {
     InitAudioDevice();
     if (!IsAudioDeviceReady()) {
         LOG("Failed to initialize audio");
-        exit(-1);
+        return false;
     }
+    return true;
+}
 
-    hit = LoadSound("./assets/hit2.wav");
-    if (!IsSoundReady(hit)) {
-        LOG("Could not load hit sound");
-        exit(-1);
-    }
-    SetSoundVolume(hit, 1);
+bool task_beatmap(void* data) {
+    return load_beatmap(beatmap_path);
+}
 
-    load_beatmap(argv[1]);
-    load_note_columns();
+bool task_loudness(void* data) {
+    // measured once per song and cached, on the first play the gain comes in when it is done
+    const char* audio_filepath = beatmap.audio_filename;
+    if (is_normalized)
+        loudness_scan(&audio_filepath, 1, cache_path);
+    return true;
+}
 
-    audio = LoadMusicStream(beatmap.audio_filename);
-    if (!IsMusicReady(audio)) {
-        LOG("Failed to load audio");
-        exit(-1);
-    }
-    SetMusicVolume(audio, 0.75f);
+bool task_input(void* data) {
+    return start_input();
+}
 
-    PlayMusicStream(audio);
-    SetMasterVolume(0.1);
+bool task_music(void* data) {
+    // decoding starts on its own thread and overlaps with the rest of the loading
+    if (!music_init(beatmap.audio_filename, music_config))
+        return false;
+    playback_clock_set_rate(music_rate());
+    return true;
 }
 
-void deinit() {
-    CloseAudioDevice();
-    CloseWindow();
-    logging_shutdown();
+bool task_gameplay(void* data) {
+    // autoplay hitsounds are scheduled ahead from the chart instead of when the simulation reaches them
+    if (!gameplay_load(&gameplay, &beatmap, autoplay, (autoplay) ? NULL : play_hitsound))
+        return false;
+    practice_init(&practice);
+    return true;
 }
 
-void draw_notes() {
-    for (int ci = 0; ci < kv_size(columns); ci++) {
-        column_t* col = &kv_A(columns, ci);
+bool task_waveform(void* data) {
+    // built in the background, the timeline shows up once it is ready
+    has_waveform = waveform_load(&waveform, beatmap.audio_filename, cache_path);
+    return true;
+}
 
-        for (int i = last_hit_col_i[ci] + 1; i < kv_size(*col); i++) {
-            note_event_t* event = &kv_A(*col, i);
+bool task_playfield(void* data) {
+    return render_load(&gameplay, &beatmap, (has_waveform) ? &waveform : NULL);
+}
 
-            if (i > last_hit_col_i[ci] + 1 && event->time >= pos + time_window)
-                break;
+bool task_mixer(void* data) {
+    return mixer_init(hitsound_path);
+}
 
-            if (event->type == NOTE_CLICK) {
-                float current_y = line_y + (pos - event->time) * height;
-                DrawRectangle(
-                    10 + (width - 20) / beatmap.CS * ci,
-                    current_y - 10,
-                    (width - 20) / beatmap.CS,
-                    10,
-                    RED
-                );
-            }
-            else if (event->type == NOTE_HOLD_START && i + 1 < kv_size(*col)) {
-                note_event_t* next_event = &kv_A(*col, i + 1);
-
-                float current_event_y = line_y + (pos - event->time) * height;
-                float next_event_y = line_y + (pos - next_event->time) * height;
-
-                DrawRectangle(
-                    10 + (width - 20) / beatmap.CS * ci,
-                    next_event_y,
-                    (width - 20) / beatmap.CS,
-                    current_event_y - next_event_y,
-                    RED
-                );
-            }
-            else if (event->type == NOTE_HOLD_END && i == last_hit_col_i[ci] + 1) {
-                float current_y = line_y + (pos - event->time) * height;
-
-                DrawRectangle(
-                    10 + (width - 20) / beatmap.CS * ci,
-                    current_y,
-                    (width - 20) / beatmap.CS,
-                    line_y - current_y,
-                    RED
-                );
-            }
-        }
-    }
+bool task_keysounds(void* data) {
+    // keysounds are converted to the device rate, which the mixer knows
+    return load_keysounds();
 }
 
-void update_autoplayer() {
-    for (int ci = 0; ci < kv_size(columns); ci++) {
-        column_t* col = &kv_A(columns, ci);
-        note_event_t* event = &kv_A(*col, last_hit_col_i[ci] + 1);
+bool task_autoplay(void* data) {
+    load_autoplay_hitsounds();
+    return true;
+}
 
-        if (event->type == NOTE_CLICK) {
-            if (event->time <= pos) {
-                last_hit_col_i[ci]++;
-                hit_anims[ci] = GetTime();
-                hit_note_count++;
-                PlaySound(hit);
-            }
-        }
-        else if (event->type == NOTE_HOLD_START) {
-            if (event->time <= pos) {
-                last_hit_col_i[ci]++;
-                PlaySound(hit);
-            }
-        }
-        else if (event->type == NOTE_HOLD_END) {
-            hit_anims[ci] = GetTime();
-            if (event->time <= pos) {
-                last_hit_col_i[ci]++;
-                hit_note_count++;
-                PlaySound(hit);
-            }
-        }
+bool export_video() {
+    export_config_t config = {
+        .video_filepath = export_path,
+        .audio_filepath = (export_audio_path[0]) ? export_audio_path : NULL,
+        .music_filepath = beatmap.audio_filename,
+        .hitsound_filepath = hitsound_path,
+        .fps = export_fps,
+        .width = 280,
+        .height = 480,
+    };
+    return export_run(&beatmap, autoplay, config);
+}
 
-        hit_note_count = max(hit_note_count, last_hit_col_i[ci]);
-    }
+bool export_mixdown() {
+    mixdown_t mixdown;
+    if (!mixdown_init(&mixdown, beatmap.audio_filename, hitsound_path))
+        return false;
+
+    bool ok = mixdown_play(&mixdown, &beatmap, autoplay) && mixdown_export(&mixdown, mixdown_path);
+    mixdown_destroy(&mixdown);
+    return ok;
 }
 
-void update_difficulty() {
-    if (last_timing_point + 1 >= kv_size(beatmap.timing_points))
-        return;
+bool check_timing() {
+    onset_envelope_t envelope;
+    if (!onset_envelope_get(beatmap.audio_filename, cache_path, &envelope))
+        return false;
+
+    onset_report_t report;
+    bool ok = onset_check(&beatmap, &envelope, &report);
+    if (ok)
+        onset_report_print(&report);
+    else
+        LOG("No section of the chart has a clear enough beat to check");
+
+    onset_report_destroy(&report);
+    onset_envelope_destroy(&envelope);
+    return ok;
+}
 
-    beatmap_timing_point_t* tm = &kv_A(beatmap.timing_points, last_timing_point + 1);
-    if (tm->time_start / 1000.0f <= pos) {
-        if (tm->is_uninherited)
-            bpm = 1.0f / tm->length * 60000;
-        LOGF(
-            "Timing Point: [%s] BPM: %7.0f, SV: %5.1f, Meter: %d",
-            (tm->is_uninherited) ? "!" : "+",
-            bpm,
-            (tm->is_uninherited) ? (beatmap.SV) : (beatmap.SV * (-tm->length / 100.0f)),
-            tm->meter
-        );
-        last_timing_point++;
-    }
+void deinit() {
+    render_stop();
+    waveform_destroy(&waveform);
+    input_shutdown();
+    practice_destroy(&practice);
+    gameplay_destroy(&gameplay);
+    kv_destroy(autoplay_hits);
+    kv_destroy(note_samples);
+    mixer_shutdown();
+    sample_bank_shutdown();
+    music_shutdown();
+    loudness_shutdown();
+    if (IsAudioDeviceReady())
+        CloseAudioDevice();
+    logging_shutdown();
 }
 
-void draw_keys() {
-    for (int i = 0; i < beatmap.CS; i++) {
-        float opacity = 1 - min((GetTime() - hit_anims[i]) / 0.2f, 1);
+void play_hitsound(int column, int note, double time) {
+    // a keysound that is not loaded yet is replaced by the default hitsound rather than waited for
+    sample_t* sample = sample_bank_acquire(kv_A(note_samples, note));
+    mixer_play(time, beatmap_note_volume(&beatmap, &kv_A(beatmap.notes, note)), sample);
+}
 
-        DrawRectangle(
-            10 + (width - 20) / beatmap.CS * i,
-            line_y,
-            (width - 20) / beatmap.CS,
-            height * 0.2f,
-            Fade(BLACK, 0.75f * opacity)
-        );
+bool load_keysounds() {
+    // the working directory is the beatmap's folder by now
+    kv_init(note_samples);
+    if (!sample_bank_init(".", mixer_sample_rate(), sample_budget))
+        return false;
+
+    for (int i = 0; i < kv_size(beatmap.notes); i++) {
+        const beatmap_note_t* note = &kv_A(beatmap.notes, i);
+        char filename[256];
+        int id = (beatmap_note_sample(&beatmap, note, filename, STACKARRAY_SIZE(filename))) ? sample_bank_add(filename) : -1;
+        kv_push(int, note_samples, id);
+        sample_bank_schedule(id, note->time_start / 1000.0);
     }
+
+    return sample_bank_start();
 }
 
-void draw_info() {
-    beatmap_timing_point_t* tm = &kv_A(beatmap.timing_points, last_timing_point);
-    DrawFPS(0, 0);
-    DrawText(TextFormat("vol %.2f", vol), 0, 21, 16, ORANGE);
-    DrawText(TextFormat("Note %d/%d", hit_note_count, kv_size(beatmap.notes)), 0, 38, 16, RED);
-    DrawText(TextFormat("BPM %.0f", bpm), 0, 54, 16, BLACK);
-    DrawText(
-        TextFormat(
-            "SV %.1f",
-            (tm->is_uninherited) ? (beatmap.SV) : (beatmap.SV * (-tm->length / 100.0f))
-        ),
-        0,
-        70,
-        16,
-        DARKGRAY
-    );
-}
-
-void load_note_columns() {
-    LOG("preprocessing hit objects ...");
-    kv_init(columns);
-    kv_resize(column_t, columns, beatmap.CS);
-    for (int i = 0; i < beatmap.CS; i++) {
-        column_t col;
-        kv_init(col);
-        kv_push(column_t, columns, col);
-    }
+void load_autoplay_hitsounds() {
+    kv_init(autoplay_hits);
+    if (!autoplay)
+        return;
+
+    // same times as the autoplayer hits, hold notes without a keysound sound at both ends
     for (int i = 0; i < kv_size(beatmap.notes); i++) {
         beatmap_note_t note = kv_A(beatmap.notes, i);
-        column_t* column = &kv_A(columns, note.column);
+        autoplay_hit_t head = { note.time_start / 1000.0f, i };
+        kv_push(autoplay_hit_t, autoplay_hits, head);
+        if (note.is_hold_note && kv_A(note_samples, i) < 0) {
+            autoplay_hit_t tail = { note.time_end / 1000.0f, i };
+            kv_push(autoplay_hit_t, autoplay_hits, tail);
+        }
+    }
+    qsort(autoplay_hits.a, kv_size(autoplay_hits), sizeof(autoplay_hit_t), compare_hits);
+}
+
+void schedule_autoplay_hitsounds(double playback_pos) {
+    // the lookahead is in device time
+    double horizon = playback_pos + MIXER_LOOKAHEAD * music_rate();
+    // hits after the end of a loop never come, the first ones of the next pass are scheduled after the wrap
+    if (practice.is_looping)
+        horizon = min(horizon, practice.end);
+    while (autoplay_cursor < kv_size(autoplay_hits) && kv_A(autoplay_hits, autoplay_cursor).time < horizon) {
+        autoplay_hit_t hit = kv_A(autoplay_hits, autoplay_cursor++);
+        play_hitsound(0, hit.note, hit.time);
+    }
+}
+
+void seek_autoplay_hitsounds(double playback_pos) {
+    mixer_reset();
+    autoplay_cursor = 0;
+    while (autoplay_cursor < kv_size(autoplay_hits) && kv_A(autoplay_hits, autoplay_cursor).time < playback_pos)
+        autoplay_cursor++;
+}
+
+int compare_hits(const void* a, const void* b) {
+    double ta = ((const autoplay_hit_t*)a)->time, tb = ((const autoplay_hit_t*)b)->time;
+    return (ta > tb) - (ta < tb);
+}
 
-        if (note.is_hold_note) {
-            note_event_t hold_start = { NOTE_HOLD_START, note.time_start / 1000.0f };
-            note_event_t hold_end = { NOTE_HOLD_END, note.time_end / 1000.0f };
-            kv_push(note_event_t, *column, hold_start);
-            kv_push(note_event_t, *column, hold_end);
+void parse_args(int argc, const char *argv[]) {
+    static ko_longopt_t longopts[] = {
+        { "input",   ko_required_argument, 'i' },
+        { "replay",  ko_required_argument, 'r' },
+        { "capture", ko_required_argument, 'c' },
+        { "fps",     ko_required_argument, 'f' },
+        { "idle-fps", ko_required_argument, OPTION_IDLE_FPS },
+        { "chart",   ko_required_argument, OPTION_CHART },
+        { "scale",   ko_required_argument, OPTION_SCALE },
+        { "export",  ko_required_argument, 'e' },
+        { "export-fps", ko_required_argument, OPTION_EXPORT_FPS },
+        { "export-audio", ko_required_argument, OPTION_EXPORT_AUDIO },
+        { "mixdown", ko_required_argument, OPTION_MIXDOWN },
+        { "music-buffer", ko_required_argument, OPTION_MUSIC_BUFFER },
+        { "music", ko_required_argument, OPTION_MUSIC },
+        { "music-cache", ko_required_argument, OPTION_MUSIC_CACHE },
+        { "rate", ko_required_argument, OPTION_RATE },
+        { "sample-budget", ko_required_argument, OPTION_SAMPLE_BUDGET },
+        { "loudness", ko_required_argument, OPTION_LOUDNESS },
+        { "check-timing", ko_no_argument, OPTION_CHECK_TIMING },
+        { NULL, 0, 0 }
+    };
+    ketopt_t opt = KETOPT_INIT;
+    int c;
+
+    while ((c = ketopt(&opt, argc, (char**)argv, 1, "i:r:c:f:e:", longopts)) >= 0) {
+        if (c == 'i') {
+            if (!input_backend_from_name(opt.arg, &input_backend)) {
+                printf("Unknown input backend \"%s\"\n", opt.arg);
+                exit(-1);
+            }
+            autoplay = false;
+        }
+        else if (c == 'r') {
+            resolve_path(replay_path, STACKARRAY_SIZE(replay_path), opt.arg);
+            input_backend = INPUT_BACKEND_REPLAY;
+            autoplay = false;
+        }
+        else if (c == 'c') {
+            resolve_path(capture_path, STACKARRAY_SIZE(capture_path), opt.arg);
+        }
+        else if (c == 'f') {
+            if (!frame_pacer_mode_from_name(opt.arg, &render_config.pacing, &render_config.target_fps)) {
+                printf("Unknown frame pacing \"%s\"\n", opt.arg);
+                exit(-1);
+            }
+        }
+        else if (c == OPTION_IDLE_FPS) {
+            render_config.idle_fps = atoi(opt.arg);
+            if (render_config.idle_fps < 0) {
+                printf("Invalid idle frame rate \"%s\"\n", opt.arg);
+                exit(-1);
+            }
+        }
+        else if (c == OPTION_CHART) {
+            if (!playfield_gl_mode_from_name(opt.arg, &render_config.chart_mode)) {
+                printf("Unknown chart mode \"%s\"\n", opt.arg);
+                exit(-1);
+            }
+        }
+        else if (c == OPTION_SCALE) {
+            render_config.playfield_scale = atof(opt.arg);
+            if (render_config.playfield_scale <= 0 || render_config.playfield_scale > 1) {
+                printf("Playfield scale must be within (0, 1], got \"%s\"\n", opt.arg);
+                exit(-1);
+            }
+        }
+        else if (c == 'e') {
+            // "|command" pipes the stream into a program
+            if (opt.arg[0] == '|')
+                snprintf(export_path, STACKARRAY_SIZE(export_path), "%s", opt.arg);
+            else
+                resolve_path(export_path, STACKARRAY_SIZE(export_path), opt.arg);
+        }
+        else if (c == OPTION_EXPORT_FPS) {
+            export_fps = atoi(opt.arg);
+            if (export_fps <= 0) {
+                printf("Invalid export frame rate \"%s\"\n", opt.arg);
+                exit(-1);
+            }
+        }
+        else if (c == OPTION_EXPORT_AUDIO) {
+            resolve_path(export_audio_path, STACKARRAY_SIZE(export_audio_path), opt.arg);
+        }
+        else if (c == OPTION_MIXDOWN) {
+            resolve_path(mixdown_path, STACKARRAY_SIZE(mixdown_path), opt.arg);
+        }
+        else if (c == OPTION_MUSIC_BUFFER) {
+            music_config.buffer = atof(opt.arg) / 1000;
+            if (music_config.buffer <= 0) {
+                printf("Invalid music buffer \"%s\"\n", opt.arg);
+                exit(-1);
+            }
+        }
+        else if (c == OPTION_MUSIC) {
+            if (!music_mode_from_name(opt.arg, &music_config.mode)) {
+                printf("Unknown music mode \"%s\"\n", opt.arg);
+                exit(-1);
+            }
+        }
+        else if (c == OPTION_MUSIC_CACHE) {
+            if (!pcm_cache_format_from_name(opt.arg, &music_config.cache_format)) {
+                printf("Unknown music cache format \"%s\"\n", opt.arg);
+                exit(-1);
+            }
+        }
+        else if (c == OPTION_RATE) {
+            if (!stretch_mode_from_name(opt.arg, &music_config.stretch, &music_config.rate)) {
+                printf("Rate must be within %.1f..%.1f or dt, ht, nc, got \"%s\"\n", STRETCH_MIN_RATE, STRETCH_MAX_RATE, opt.arg);
+                exit(-1);
+            }
+        }
+        else if (c == OPTION_SAMPLE_BUDGET) {
+            int megabytes = atoi(opt.arg);
+            if (megabytes <= 0) {
+                printf("Invalid sample budget \"%s\"\n", opt.arg);
+                exit(-1);
+            }
+            sample_budget = (size_t)megabytes << 20;
+        }
+        else if (c == OPTION_LOUDNESS) {
+            char* end;
+            loudness_target = strtod(opt.arg, &end);
+            is_normalized = strcmp(opt.arg, "off") != 0;
+            if (is_normalized && (end == opt.arg || *end || loudness_target > 0)) {
+                printf("Loudness must be a negative LUFS value or off, got \"%s\"\n", opt.arg);
+                exit(-1);
+            }
+        }
+        else if (c == OPTION_CHECK_TIMING) {
+            is_timing_checked = true;
         }
         else {
-            note_event_t event = { NOTE_CLICK, note.time_start / 1000.0f };
-            kv_push(note_event_t, *column, event);
+            opt.ind = argc;
+            break;
         }
     }
-    // for (int i = 0; i < kv_size(columns); i++) {
-    //     LOGF("Column %d: %d notes", i + 1, kv_size(kv_A(columns, i)));
-    // }
+
+    if (opt.ind >= argc) {
+        printf(
+            "Usage: %s [options] <.osu file>\n"
+            "  -i, --input <raylib|evdev>   play with the keyboard instead of autoplay\n"
+            "  -r, --replay <file>          play back a captured evdev stream\n"
+            "  -c, --capture <file>         capture evdev key events to a file\n"
+            "  -f, --fps <n|vsync|low-latency|unlimited>\n"
+            "                               frame pacing, vsync by default\n"
+            "      --idle-fps <n>           redraw rate while paused, 0 (default) waits for input\n"
+            "      --chart <dynamic|static> lay notes out every frame (default) or keep the chart\n"
+            "                               on the GPU and scroll it in the shader\n"
+            "      --scale <f>              render the playfield at a fraction of the window\n"
+            "                               resolution and upscale it, 1 by default\n"
+            "  -e, --export <file.y4m|\"|command\">\n"
+            "                               render the play offline instead of playing it\n"
+            "      --export-fps <n>         frame rate of the export, 60 by default\n"
+            "      --export-audio <file.wav> mix music and hitsounds of the export\n"
+            "      --mixdown <file.wav>     only mix music and hitsounds of the play, no video\n"
+            "      --music-buffer <ms>      music decoded ahead of the audio device, 250 by default\n"
+            "      --music <stream|memory>  decode while playing (default) or decode the whole song\n"
+            "                               up front, which makes seeks exact\n"
+            "      --music-cache <raw|qoa|off>\n"
+            "                               keep songs decoded in memory mode in cache/, raw by default\n"
+            "      --rate <0.5..2|dt|ht|nc> play faster or slower with the pitch kept, nc raises it like\n"
+            "                               nightcore, [ and ] change the rate while playing\n"
+            "      --sample-budget <MiB>    memory for decoded keysounds, 64 by default\n"
+            "      --loudness <LUFS|off>    normalize the music to this loudness, -14 by default\n"
+            "      --check-timing           compare the timing points with the onsets of the music,\n"
+            "                               print the sections that are off and exit\n",
+            GetFileName(argv[0])
+        );
+        exit(0);
+    }
+    beatmap_path = argv[opt.ind];
+}
+
+void resolve_path(char* dest, int size, const char* path) {
+    // the working directory changes during init()
+    if (path[0] == '/')
+        snprintf(dest, size, "%s", path);
+    else
+        snprintf(dest, size, "%s/%s", GetWorkingDirectory(), path);
 }
 
-void load_beatmap(const char* filepath) {
+bool load_beatmap(const char* filepath) {
     if (!beatmap_load(filepath, &beatmap, false))
-        exit(-1);
+        return false;
     beatmap_debug_print(&beatmap);
 
+    // the paths the beatmap refers to are relative to its folder
     ChangeDirectory(GetDirectoryPath(filepath));
     if (!FileExists(beatmap.audio_filename)) {
         LOGF("File \"%s\" does not exists", beatmap.audio_filename);
-        exit(-1);
+        return false;
     }
+    return true;
 }
 
-void update_input() {
-    if (IsKeyPressed(KEY_SPACE)) {
-        if (IsMusicStreamPlaying(audio))
-            PauseMusicStream(audio);
-        else
-            ResumeMusicStream(audio);
+bool start_input() {
+    if (!input_init(input_backend, beatmap.CS, replay_path)) {
+        LOG("Failed to initialize input");
+        return false;
     }
-    float wh = GetMouseWheelMove();
-    if (wh != 0) {
-        vol = max(0, min(1, vol + wh * 0.05f));
-        SetMasterVolume(vol);
+    return !capture_path[0] || input_capture_start(capture_path);
+}
+
+void update_input() {
+    render_command_t command;
+    while (render_pop_command(&command)) {
+        if (command.type == RENDER_COMMAND_TOGGLE_PAUSE) {
+            if (music_is_playing())
+                music_pause();
+            else
+                music_resume();
+        }
+        else if (command.type == RENDER_COMMAND_VOLUME) {
+            vol = max(0, min(1, vol + command.value));
+            SetMasterVolume(vol);
+        }
+        else if (command.type == RENDER_COMMAND_RATE) {
+            // rounded so repeated steps land on whole percents
+            double rate = round((music_rate() + command.value) * 100) / 100;
+            music_set_rate(rate);
+            playback_clock_set_rate(music_rate());
+        }
+        else if (command.type == RENDER_COMMAND_SEEK) {
+            double pos = min(gameplay.state.time + command.value, music_length());
+            practice_clear(&practice);
+            music_seek(pos);
+            gameplay_seek(&gameplay, pos);
+            seek_autoplay_hitsounds(pos);
+        }
+        else if (command.type == RENDER_COMMAND_LOOP_START) {
+            practice_mark_start(&practice, &gameplay);
+        }
+        else if (command.type == RENDER_COMMAND_LOOP_END) {
+            if (practice_mark_end(&practice, &gameplay))
+                seek_autoplay_hitsounds(practice.start);
+        }
+        else if (command.type == RENDER_COMMAND_LOOP_CLEAR) {
+            practice_clear(&practice);
+        }
     }
-    // if (IsKeyPressed(KEY_ENTER)) {
-    //     hit_note_count = 0;
-    //     for (int i = 0; i < beatmap.CS; i++)
-    //         last_hit_col_i[i] = -1;
-    //     SeekMusicStream(audio, 0);
-    // }
-    // if (IsKeyPressed(KEY_LEFT)) {
-    //     hit_note_count = 0;
-    //     for (int i = 0; i < beatmap.CS; i++)
-    //         last_hit_col_i[i] = -1;
-    //     SeekMusicStream(audio, max(0, pos - 5));
-    // }
-    if (IsKeyPressed(KEY_RIGHT)) {
-        SeekMusicStream(audio, min(pos + 5, GetMusicTimeLength(audio)));
+}
+
+void log_first_frame() {
+    double presented = render_first_frame_time();
+    if (is_first_frame_logged || presented == 0)
+        return;
+    LOGF("First frame %.3f s after the start", presented - start_time);
+    is_first_frame_logged = true;
+}
+
+void update_loudness() {
+    loudness_t loudness;
+    if (!is_gain_known && loudness_result(beatmap.audio_filename, &loudness)) {
+        gain_start = gain;
+        gain_target = loudness_gain(&loudness, loudness_target);
+        gain_fade_start = (music_is_playing()) ? timer_now() : -LOUDNESS_FADE;
+        is_gain_known = true;
+        LOGF("%.1f LUFS, %+.1f dB to %.0f LUFS", loudness.integrated, 20 * log10f(gain_target), loudness_target);
     }
+    if (gain == gain_target)
+        return;
+
+    double progress = min((timer_now() - gain_fade_start) / LOUDNESS_FADE, 1.0);
+    gain = (progress < 1) ? gain_start + (gain_target - gain_start) * (float)progress : gain_target;
+    music_set_gain(gain);
 }
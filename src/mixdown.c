@@ -0,0 +1,155 @@
+#include <mixdown.h>
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <gameplay.h>
+#include <input.h>
+#include <playback_clock.h>
+#include <timer.h>
+#define SCOPE_NAME "mixdown"
+#include <logging.h>
+
+
+static mixdown_t*       s_playing = NULL;
+static const beatmap_t* s_beatmap = NULL;
+
+static bool _load_wave(const char* filepath, int sample_rate, Wave* wave);
+static void _on_hitsound(int column, int note, double time);
+
+
+bool mixdown_init(mixdown_t* mixdown, const char* music_filepath, const char* hitsound_filepath) {
+    *mixdown = (mixdown_t){0};
+    kv_init(mixdown->hits);
+
+    if (!_load_wave(music_filepath, 0, &mixdown->music))
+        return false;
+    if (!_load_wave(hitsound_filepath, mixdown->music.sampleRate, &mixdown->hitsound)) {
+        mixdown_destroy(mixdown);
+        return false;
+    }
+    return true;
+}
+
+void mixdown_destroy(mixdown_t* mixdown) {
+    if (mixdown->music.data)
+        UnloadWave(mixdown->music);
+    if (mixdown->hitsound.data)
+        UnloadWave(mixdown->hitsound);
+    kv_destroy(mixdown->hits);
+    *mixdown = (mixdown_t){0};
+}
+
+double mixdown_length(const mixdown_t* mixdown) {
+    return (double)mixdown->music.frameCount / mixdown->music.sampleRate;
+}
+
+void mixdown_add_hit(mixdown_t* mixdown, double time, float volume) {
+    mixdown_hit_t hit = { time, volume };
+    kv_push(mixdown_hit_t, mixdown->hits, hit);
+}
+
+bool mixdown_play(mixdown_t* mixdown, const beatmap_t* beatmap, bool autoplay) {
+    gameplay_t gameplay;
+    if (!gameplay_load(&gameplay, beatmap, autoplay, _on_hitsound))
+        return false;
+    s_playing = mixdown;
+    s_beatmap = beatmap;
+
+    double length = mixdown_length(mixdown);
+    double start = timer_now();
+    int hits_before = kv_size(mixdown->hits);
+
+    // nothing is drawn, so the clock advances in fixed steps instead of following a device
+    for (double pos = 0; pos < length + MIXDOWN_STEP; pos += MIXDOWN_STEP) {
+        double clamped = min(pos, length);
+        playback_clock_sync(clamped, false);
+        input_poll();
+        gameplay_update(&gameplay, clamped);
+    }
+
+    double elapsed = timer_now() - start;
+    LOGF(
+        "simulated %.1f s in %.3f s (%.0fx real time), %d hitsounds",
+        length,
+        elapsed,
+        length / max(elapsed, 1e-6),
+        (int)kv_size(mixdown->hits) - hits_before
+    );
+
+    s_playing = NULL;
+    s_beatmap = NULL;
+    gameplay_destroy(&gameplay);
+    return true;
+}
+
+bool mixdown_export(const mixdown_t* mixdown, const char* filepath) {
+    const Wave* music = &mixdown->music;
+    const Wave* hitsound = &mixdown->hitsound;
+    size_t frames = music->frameCount;
+
+    float* mix = malloc(frames * MIXDOWN_CHANNELS * sizeof(float));
+    short* samples = malloc(frames * MIXDOWN_CHANNELS * sizeof(short));
+    if (!mix || !samples) {
+        LOG("Failed to allocate the mix buffer");
+        free(mix);
+        free(samples);
+        return false;
+    }
+
+    const float* music_samples = music->data;
+    for (size_t i = 0; i < frames * MIXDOWN_CHANNELS; i++)
+        mix[i] = music_samples[i] * MIXDOWN_MUSIC_VOLUME;
+
+    // every hit starts on the sample its timestamp falls on, independent of any frame rate
+    const float* hit_samples = hitsound->data;
+    for (int h = 0; h < kv_size(mixdown->hits); h++) {
+        const mixdown_hit_t* hit = &kv_A(mixdown->hits, h);
+        long long offset = llround(hit->time * music->sampleRate);
+
+        for (size_t i = 0; i < hitsound->frameCount; i++) {
+            long long frame = offset + (long long)i;
+            if (frame < 0)
+                continue;
+            if (frame >= (long long)frames)
+                break;
+            for (int c = 0; c < MIXDOWN_CHANNELS; c++)
+                mix[frame * MIXDOWN_CHANNELS + c] += hit_samples[i * MIXDOWN_CHANNELS + c] * hit->volume;
+        }
+    }
+
+    for (size_t i = 0; i < frames * MIXDOWN_CHANNELS; i++)
+        samples[i] = (short)lrintf(CONSTRAIN(mix[i], -1.0f, 1.0f) * 32767);
+
+    Wave wave = {
+        .frameCount = frames,
+        .sampleRate = music->sampleRate,
+        .sampleSize = 16,
+        .channels = MIXDOWN_CHANNELS,
+        .data = samples,
+    };
+    bool ok = ExportWave(wave, filepath);
+    if (ok)
+        LOGF("wrote %.1f s with %d hitsounds to \"%s\"", mixdown_length(mixdown), (int)kv_size(mixdown->hits), filepath);
+    else
+        LOGF("Failed to write \"%s\"", filepath);
+
+    free(mix);
+    free(samples);
+    return ok;
+}
+
+bool _load_wave(const char* filepath, int sample_rate, Wave* wave) {
+    *wave = LoadWave(filepath);
+    if (!IsWaveReady(*wave)) {
+        LOGF("Failed to load \"%s\"", filepath);
+        return false;
+    }
+
+    WaveFormat(wave, (sample_rate > 0) ? sample_rate : (int)wave->sampleRate, 32, MIXDOWN_CHANNELS);
+    return true;
+}
+
+void _on_hitsound(int column, int note, double time) {
+    mixdown_add_hit(s_playing, time, beatmap_volume_at(s_beatmap, time));
+}
@@ -0,0 +1,46 @@
+#ifndef MIXDOWN_H
+#define MIXDOWN_H
+
+#include <kvec.h>
+#include <raylib.h>
+
+#include <defines.h>
+#include <beatmap.h>
+
+#define MIXDOWN_CHANNELS 2
+#define MIXDOWN_MUSIC_VOLUME 0.75f
+
+// Simulation step of mixdown_play()
+#ifndef MIXDOWN_STEP
+#define MIXDOWN_STEP 0.1
+#endif
+
+
+typedef struct mixdown_hit_s {
+    double  time;
+    float   volume;
+} mixdown_hit_t;
+
+// Offline mix of the music and every hitsound of a play, no audio device involved.
+typedef struct mixdown_s {
+    Wave                    music;      // float samples, MIXDOWN_CHANNELS channels
+    Wave                    hitsound;   // same format as the music
+    kvec_t(mixdown_hit_t)   hits;
+} mixdown_t;
+
+
+bool mixdown_init(mixdown_t* mixdown, const char* music_filepath, const char* hitsound_filepath);
+void mixdown_destroy(mixdown_t* mixdown);
+
+double mixdown_length(const mixdown_t* mixdown);
+void mixdown_add_hit(mixdown_t* mixdown, double time, float volume);
+
+// Simulates the whole play on a virtual clock and adds its hitsounds with timing point volumes.
+// Input comes from the input module (replay backend) unless autoplay is set.
+bool mixdown_play(mixdown_t* mixdown, const beatmap_t* beatmap, bool autoplay);
+
+// Writes a 16-bit WAV at the sample rate of the music.
+bool mixdown_export(const mixdown_t* mixdown, const char* filepath);
+
+
+#endif
@@ -0,0 +1,233 @@
+#include <mixer.h>
+
+#include <math.h>
+#include <stdatomic.h>
+
+#include <raylib.h>
+
+#include <decoder.h>
+#include <music.h>
+#include <playback_clock.h>
+#include <ring.h>
+#define SCOPE_NAME "mixer"
+#include <logging.h>
+
+#define MIXER_CHANNELS 2
+
+
+typedef struct trigger_s {
+    double          time;
+    float           volume;
+    unsigned int    generation;
+    sample_t*       sample;
+} trigger_t;
+
+typedef struct voice_s {
+    bool            is_active;
+    int             frame;      // next hitsound frame
+    int             delay;      // frames of the current period to skip before starting
+    float           volume;
+    sample_t*       sample;     // referenced while the voice plays it, NULL for the default hitsound
+    const float*    frames;
+    int             frame_count;
+} voice_t;
+
+// Only the audio callback touches the pending triggers and the voices, the simulation
+// thread talks to it through the ring and the generation counter
+static bool             s_is_ready = false;
+static Wave             s_hitsound;
+static int              s_sample_rate;
+static ring_t           s_queue;
+static atomic_uint      s_generation = 0;
+static trigger_t        s_pending[MIXER_QUEUE_SIZE];
+static int              s_pending_count = 0;
+static voice_t          s_voices[MIXER_VOICES];
+static atomic_int       s_played = 0;
+static atomic_int       s_late = 0;
+static atomic_int       s_dropped = 0;
+static atomic_int       s_stolen = 0;
+
+static void _process(void* buffer, unsigned int frames);
+static void _start(int delay, float volume, sample_t* sample);
+static void _stop(voice_t* voice);
+static int _device_sample_rate();
+
+
+bool mixer_init(const char* hitsound_filepath) {
+    if (!decoder_load_wave(hitsound_filepath, &s_hitsound)) {
+        LOGF("Failed to load \"%s\"", hitsound_filepath);
+        return false;
+    }
+
+    int sample_rate = _device_sample_rate();
+    // same format as the device, the callback only has to add samples
+    WaveFormat(&s_hitsound, sample_rate, 32, MIXER_CHANNELS);
+
+    if (!ring_init(&s_queue, sizeof(trigger_t), MIXER_QUEUE_SIZE)) {
+        UnloadWave(s_hitsound);
+        return false;
+    }
+
+    s_sample_rate = sample_rate;
+    s_pending_count = 0;
+    for (int i = 0; i < MIXER_VOICES; i++)
+        s_voices[i] = (voice_t){0};
+    atomic_store(&s_played, 0);
+    atomic_store(&s_late, 0);
+    atomic_store(&s_dropped, 0);
+    atomic_store(&s_stolen, 0);
+
+    AttachAudioMixedProcessor(_process);
+    s_is_ready = true;
+    LOGF("%d voices at %d Hz", MIXER_VOICES, sample_rate);
+    return true;
+}
+
+void mixer_shutdown() {
+    if (!s_is_ready)
+        return;
+
+    DetachAudioMixedProcessor(_process);
+    s_is_ready = false;
+
+    // hands the references of everything still queued or playing back to the sample bank
+    trigger_t trigger;
+    while (ring_read(&s_queue, &trigger, 1))
+        sample_bank_release(trigger.sample);
+    for (int i = 0; i < s_pending_count; i++)
+        sample_bank_release(s_pending[i].sample);
+    s_pending_count = 0;
+    for (int v = 0; v < MIXER_VOICES; v++)
+        _stop(&s_voices[v]);
+
+    mixer_stats_t stats = mixer_stats();
+    LOGF("played %d hitsounds, %d late, %d dropped, %d cut short", stats.played, stats.late, stats.dropped, stats.stolen);
+
+    ring_destroy(&s_queue);
+    UnloadWave(s_hitsound);
+}
+
+void mixer_play(double time, float volume, sample_t* sample) {
+    if (!s_is_ready) {
+        sample_bank_release(sample);
+        return;
+    }
+
+    trigger_t trigger = { time, volume, atomic_load_explicit(&s_generation, memory_order_relaxed), sample };
+    if (ring_write(&s_queue, &trigger, 1) == 0) {
+        atomic_fetch_add_explicit(&s_dropped, 1, memory_order_relaxed);
+        sample_bank_release(sample);
+    }
+}
+
+void mixer_reset() {
+    atomic_fetch_add_explicit(&s_generation, 1, memory_order_release);
+}
+
+mixer_stats_t mixer_stats() {
+    return (mixer_stats_t) {
+        atomic_load_explicit(&s_played, memory_order_relaxed),
+        atomic_load_explicit(&s_late, memory_order_relaxed),
+        atomic_load_explicit(&s_dropped, memory_order_relaxed),
+        atomic_load_explicit(&s_stolen, memory_order_relaxed),
+    };
+}
+
+int mixer_sample_rate() {
+    return s_sample_rate;
+}
+
+void _process(void* buffer, unsigned int frames) {
+    float* out = buffer;
+    unsigned int generation = atomic_load_explicit(&s_generation, memory_order_acquire);
+
+    // hitsounds line up with the music of this period, which raylib mixed right before. The
+    // simulation's clock is only an estimate of it. At other rates a playback second is not a
+    // device second.
+    double pos;
+    if (!music_period_position(&pos))
+        pos = playback_clock_now();
+    double rate = playback_clock_rate();
+
+    trigger_t trigger;
+    while (s_pending_count < MIXER_QUEUE_SIZE && ring_read(&s_queue, &trigger, 1))
+        s_pending[s_pending_count++] = trigger;
+
+    int kept = 0;
+    for (int i = 0; i < s_pending_count; i++) {
+        trigger_t* t = &s_pending[i];
+        if (t->generation != generation) {
+            sample_bank_release(t->sample);
+            continue;
+        }
+
+        long long offset = llround((t->time - pos) / rate * s_sample_rate);
+        if (offset >= (long long)frames) {
+            s_pending[kept++] = *t;
+        }
+        else if ((pos - t->time) / rate > MIXER_MAX_LATENESS) {
+            atomic_fetch_add_explicit(&s_dropped, 1, memory_order_relaxed);
+            sample_bank_release(t->sample);
+        }
+        else {
+            if (offset < 0)
+                atomic_fetch_add_explicit(&s_late, 1, memory_order_relaxed);
+            _start(max(offset, 0), t->volume, t->sample);
+        }
+    }
+    s_pending_count = kept;
+
+    for (int v = 0; v < MIXER_VOICES; v++) {
+        voice_t* voice = &s_voices[v];
+        if (!voice->is_active)
+            continue;
+
+        int count = min((int)frames - voice->delay, voice->frame_count - voice->frame);
+        float* dest = out + voice->delay * MIXER_CHANNELS;
+        const float* src = voice->frames + voice->frame * MIXER_CHANNELS;
+        for (int i = 0; i < count * MIXER_CHANNELS; i++)
+            dest[i] += src[i] * voice->volume;
+
+        voice->frame += count;
+        voice->delay = 0;
+        if (voice->frame >= voice->frame_count)
+            _stop(voice);
+    }
+}
+
+int _device_sample_rate() {
+    // raylib does not expose the device rate, but every sound is converted to it on load
+    Sound probe = LoadSoundFromWave(s_hitsound);
+    int sample_rate = probe.stream.sampleRate;
+    UnloadSound(probe);
+    return sample_rate;
+}
+
+void _start(int delay, float volume, sample_t* sample) {
+    voice_t* voice = &s_voices[0];
+    for (int v = 0; v < MIXER_VOICES; v++) {
+        if (!s_voices[v].is_active) {
+            voice = &s_voices[v];
+            break;
+        }
+        if (s_voices[v].frame > voice->frame)
+            voice = &s_voices[v];
+    }
+
+    if (voice->is_active) {
+        atomic_fetch_add_explicit(&s_stolen, 1, memory_order_relaxed);
+        _stop(voice);
+    }
+    atomic_fetch_add_explicit(&s_played, 1, memory_order_relaxed);
+
+    // the reference keeps the frames loaded until the voice is done with them
+    *voice = (voice_t){ true, 0, delay, volume, sample };
+    voice->frames = (sample) ? sample->frames : s_hitsound.data;
+    voice->frame_count = (sample) ? sample->frame_count : (int)s_hitsound.frameCount;
+}
+
+void _stop(voice_t* voice) {
+    if (voice->is_active)
+        sample_bank_release(voice->sample);
+    *voice = (voice_t){0};
+}
@@ -0,0 +1,55 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+#include <defines.h>
+#include <sample_bank.h>
+
+// Hitsounds that can overlap, the oldest one is cut when all voices are busy
+#ifndef MIXER_VOICES
+#define MIXER_VOICES 32
+#endif
+
+// Triggers waiting to be picked up by the audio callback
+#ifndef MIXER_QUEUE_SIZE
+#define MIXER_QUEUE_SIZE 256
+#endif
+
+// Triggers that reach the callback later than this are dropped instead of played
+#ifndef MIXER_MAX_LATENESS
+#define MIXER_MAX_LATENESS 0.05
+#endif
+
+// How far ahead of the playback position known hitsounds are scheduled
+#ifndef MIXER_LOOKAHEAD
+#define MIXER_LOOKAHEAD 0.1
+#endif
+
+
+typedef struct mixer_stats_s {
+    int played;
+    int late;       // queued after the music of their sample was mixed, started at the beginning of a period
+    int dropped;    // too late or no room in the queue
+    int stolen;     // voices cut short by a newer hitsound
+} mixer_stats_t;
+
+
+// Mixes hitsounds in the audio device callback, on top of everything raylib plays.
+// Requires an initialized audio device.
+bool mixer_init(const char* hitsound_filepath);
+void mixer_shutdown();
+
+// Schedules a hitsound at a playback position, it starts on the exact sample when it arrives
+// in time and at the start of the next period otherwise. Hitsounds play at their own speed
+// whatever the playback rate. Plays sample, NULL for the default hitsound, and releases it
+// once done. Single producer.
+void mixer_play(double time, float volume, sample_t* sample);
+
+// Drops every scheduled hitsound that has not started yet, e.g. after a seek.
+void mixer_reset();
+
+mixer_stats_t mixer_stats();
+// Rate of the audio device, which hitsounds have to be converted to.
+int mixer_sample_rate();
+
+
+#endif
@@ -0,0 +1,558 @@
+#include <music.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include <raylib.h>
+
+#include <decoder.h>
+#include <ring.h>
+#include <stretch.h>
+#include <timer.h>
+#define SCOPE_NAME "music"
+#include <logging.h>
+
+// The position is published together with the seek generation and the loop pass it belongs to
+#define POSITION_FRAME_BITS 40
+#define POSITION_FRAME_MASK ((1ull << POSITION_FRAME_BITS) - 1)
+#define POSITION_COUNTER_MASK 0xFFF
+#define POSITION_PASS(position) ((unsigned int)((position) >> POSITION_FRAME_BITS) & POSITION_COUNTER_MASK)
+#define POSITION_GENERATION(position) ((unsigned int)((position) >> (POSITION_FRAME_BITS + 12)))
+#define POSITION_PACK(generation, pass, frame) ( \
+    ((uint64_t)((generation) & POSITION_COUNTER_MASK) << (POSITION_FRAME_BITS + 12)) | \
+    ((uint64_t)((pass) & POSITION_COUNTER_MASK) << POSITION_FRAME_BITS) | \
+    ((frame) & POSITION_FRAME_MASK))
+
+// Loop points are published as one value, so readers never see the start of one loop with
+// the end of another
+#define LOOP_PACK(start, end) (((uint64_t)(start) << 32) | (uint32_t)(end))
+#define LOOP_START(loop) ((loop) >> 32)
+#define LOOP_END(loop) ((loop) & 0xFFFFFFFF)
+
+// Waiting for the first chunks before starting the stream
+#define MUSIC_PREFILL_TIMEOUT 1.0
+
+
+typedef struct chunk_s {
+    unsigned int    generation;
+    int             count;
+    bool            is_last;
+    uint64_t        frame;
+    float           samples[MUSIC_CHUNK_FRAMES * DECODER_CHANNELS];
+} chunk_t;
+
+static bool             s_is_ready = false;
+static music_config_t   s_config;
+static const char*      s_filepath;
+static decoder_t        s_decoder;
+static AudioStream      s_stream;
+static ring_t           s_ring;
+static pthread_t        s_thread;
+static atomic_bool      s_quit = false;
+
+// Seeks bump the generation, chunks and positions of older generations are discarded
+static atomic_uint      s_generation = 0;
+static atomic_uint_least64_t s_seek_frame = 0;
+static atomic_uint_least64_t s_position = 0;
+static atomic_uint      s_finished_generation = 0xFFFFFFFF;
+static atomic_uint_least64_t s_loop = 0;       // LOOP_PACK(), an end of 0 plays straight through
+// Wraps since the last seek the reads made (by the decode thread in stream mode, the callback
+// in memory mode) and the output played, POSITION_PACK() with the count as the pass
+static atomic_uint_least64_t s_wraps_read = 0;
+static atomic_uint_least64_t s_wraps_played = 0;
+
+// Only touched by the audio callback
+static chunk_t          s_chunk;
+static int              s_chunk_offset = 0;
+static unsigned int     s_pull_generation = 0;
+static uint64_t         s_read_frame = 0;       // source position of the next frame read
+static bool             s_has_data = false;     // since the last seek, only later gaps are underruns
+static stretch_t        s_stretch;
+static bool             s_is_stretched = false;
+static stretch_read_f   s_read;
+
+// After a wrap the source restarts at the loop start while the stretcher keeps counting on, so
+// its positions are mapped back by an offset. Stretched output reaches a wrap a little after
+// the reads did, until then it keeps the previous offset.
+static int64_t          s_read_offset = 0;
+static int64_t          s_output_offset = 0;
+static bool             s_has_wrap = false;
+static int64_t          s_wrap_position = 0;    // where the output switches to s_read_offset
+static unsigned int     s_loop_pass = 0;
+static unsigned int     s_read_wrap_count = 0;      // memory mode
+static unsigned int     s_played_wrap_count = 0;
+
+// Song position of the first frame the music rendered in the current device period, set by
+// the first callback of a period and taken by the hitsound mixer at its end
+static _Atomic double   s_period_position = 0;
+static atomic_bool      s_has_period = false;
+
+// Rate changes are picked up by the next audio callback
+static _Atomic double   s_rate = 1.0;
+
+// Memory mode, the callback only reads the samples once s_is_loaded is set
+static Wave             s_pcm;
+static atomic_bool      s_is_loaded = false;
+static atomic_bool      s_has_failed = false;
+
+static atomic_int       s_underruns = 0;
+static atomic_uint_least64_t s_underrun_frames = 0;
+
+static void* _decode_thread(void* arg);
+static void* _load_thread(void* arg);
+static void _pull(void* buffer, unsigned int frames);
+static int _read_stream(void* user, float* frames, int count);
+static int _read_memory(void* user, float* frames, int count);
+static void _wrap(uint64_t from, uint64_t to);
+static void _publish_position(unsigned int generation, uint64_t frame);
+
+
+bool music_mode_from_name(const char* name, music_mode_t* mode) {
+    if (strcmp(name, "stream") == 0)
+        *mode = MUSIC_STREAM;
+    else if (strcmp(name, "memory") == 0)
+        *mode = MUSIC_MEMORY;
+    else
+        return false;
+    return true;
+}
+
+bool music_init(const char* filepath, music_config_t config) {
+    s_config = config;
+    s_filepath = filepath;
+
+    // the MP3 seek index is kept next to the decoded files
+    char index_filepath[512];
+    bool has_index = pcm_cache_filepath(filepath, config.cache_directory, "seek", index_filepath, STACKARRAY_SIZE(index_filepath));
+    if (!decoder_open(&s_decoder, filepath, (has_index) ? index_filepath : NULL))
+        return false;
+
+    bool is_memory = config.mode == MUSIC_MEMORY;
+    s_read = (is_memory) ? _read_memory : _read_stream;
+    if (!stretch_init(&s_stretch, s_decoder.sample_rate, config.stretch, config.rate, s_read, NULL)) {
+        decoder_close(&s_decoder);
+        return false;
+    }
+
+    int capacity = max(2, (int)(config.buffer * s_decoder.sample_rate / MUSIC_CHUNK_FRAMES));
+    if (!ring_init(&s_ring, sizeof(chunk_t), capacity)) {
+        stretch_destroy(&s_stretch);
+        decoder_close(&s_decoder);
+        return false;
+    }
+
+    atomic_store(&s_quit, false);
+    atomic_store(&s_generation, 0);
+    atomic_store(&s_seek_frame, 0);
+    atomic_store(&s_position, POSITION_PACK(0, 0, 0));
+    atomic_store(&s_finished_generation, 0xFFFFFFFF);
+    atomic_store(&s_loop, 0);
+    atomic_store(&s_wraps_read, 0);
+    atomic_store(&s_wraps_played, 0);
+    atomic_store(&s_underruns, 0);
+    atomic_store(&s_underrun_frames, 0);
+    atomic_store(&s_is_loaded, false);
+    atomic_store(&s_has_failed, false);
+    atomic_store(&s_rate, s_stretch.rate);
+    atomic_store(&s_has_period, false);
+    s_chunk = (chunk_t){ .generation = 0xFFFFFFFF };
+    s_chunk_offset = 0;
+    s_pull_generation = 0;
+    s_read_frame = 0;
+    s_has_data = false;
+    s_is_stretched = false;
+    s_read_offset = 0;
+    s_output_offset = 0;
+    s_has_wrap = false;
+    s_loop_pass = 0;
+    s_pcm = (Wave){0};
+
+    if (pthread_create(&s_thread, NULL, (is_memory) ? _load_thread : _decode_thread, NULL) != 0) {
+        LOG("Failed to start the decode thread");
+        ring_destroy(&s_ring);
+        stretch_destroy(&s_stretch);
+        decoder_close(&s_decoder);
+        return false;
+    }
+
+    // raylib resamples the stream to the device rate
+    s_stream = LoadAudioStream(s_decoder.sample_rate, 32, DECODER_CHANNELS);
+    SetAudioStreamCallback(s_stream, _pull);
+    SetAudioStreamVolume(s_stream, MUSIC_VOLUME);
+
+    s_is_ready = true;
+    if (is_memory)
+        LOGF("%.1f s at %d Hz, decoding to memory", decoder_length(&s_decoder), s_decoder.sample_rate);
+    else
+        LOGF(
+            "%.1f s at %d Hz, %.0f ms buffer",
+            decoder_length(&s_decoder),
+            s_decoder.sample_rate,
+            s_ring.capacity * MUSIC_CHUNK_FRAMES * 1000.0 / s_decoder.sample_rate
+        );
+    return true;
+}
+
+void music_shutdown() {
+    if (!s_is_ready)
+        return;
+
+    UnloadAudioStream(s_stream);
+    atomic_store(&s_quit, true);
+    pthread_join(s_thread, NULL);
+
+    music_stats_t stats = music_stats();
+    LOGF("%d underruns, %.1f ms of silence", stats.underruns, stats.underrun_frames * 1000.0 / s_decoder.sample_rate);
+
+    ring_destroy(&s_ring);
+    stretch_destroy(&s_stretch);
+    decoder_close(&s_decoder);
+    if (s_pcm.data)
+        UnloadWave(s_pcm);
+    s_pcm = (Wave){0};
+    s_is_ready = false;
+}
+
+bool music_play() {
+    if (s_config.mode == MUSIC_MEMORY) {
+        // the load thread started in music_init(), so usually most of the work is already done
+        double start = timer_now();
+        while (!atomic_load(&s_is_loaded) && !atomic_load(&s_has_failed))
+            timer_sleep(MUSIC_DECODE_INTERVAL);
+        if (atomic_load(&s_has_failed))
+            return false;
+        if (timer_now() - start > MUSIC_DECODE_INTERVAL)
+            LOGF("waited %.3f s for the decoded music", timer_now() - start);
+        PlayAudioStream(s_stream);
+        return true;
+    }
+
+    // avoids starting with an underrun
+    double deadline = timer_now() + MUSIC_PREFILL_TIMEOUT;
+    while (ring_size(&s_ring) < s_ring.capacity / 2 && timer_now() < deadline)
+        timer_sleep(MUSIC_DECODE_INTERVAL);
+
+    PlayAudioStream(s_stream);
+    return true;
+}
+
+void music_pause() {
+    PauseAudioStream(s_stream);
+}
+
+void music_resume() {
+    ResumeAudioStream(s_stream);
+}
+
+bool music_is_playing() {
+    unsigned int generation = atomic_load(&s_generation);
+    return IsAudioStreamPlaying(s_stream) && atomic_load(&s_finished_generation) != generation;
+}
+
+double music_time_played() {
+    return (double)(atomic_load(&s_position) & POSITION_FRAME_MASK) / s_decoder.sample_rate;
+}
+
+double music_time_played_pass(unsigned int* pass) {
+    uint64_t position = atomic_load(&s_position);
+    *pass = POSITION_PASS(position);
+    return (double)(position & POSITION_FRAME_MASK) / s_decoder.sample_rate;
+}
+
+bool music_period_position(double* position) {
+    if (!atomic_exchange_explicit(&s_has_period, false, memory_order_relaxed))
+        return false;
+    *position = atomic_load_explicit(&s_period_position, memory_order_relaxed);
+    return true;
+}
+
+double music_length() {
+    return decoder_length(&s_decoder);
+}
+
+void music_seek(double time) {
+    uint64_t frame = (uint64_t)(CONSTRAIN(time, 0, music_length()) * s_decoder.sample_rate);
+
+    atomic_store(&s_seek_frame, frame);
+    unsigned int generation = atomic_fetch_add(&s_generation, 1) + 1;
+    unsigned int pass = POSITION_PASS(atomic_load(&s_position));
+    atomic_store(&s_position, POSITION_PACK(generation, pass, frame));
+}
+
+bool music_set_loop(double start, double end) {
+    start = CONSTRAIN(start, 0, music_length());
+    end = CONSTRAIN(end, 0, music_length());
+    if (end - start < MUSIC_MIN_LOOP) {
+        LOGF("Loop %.3f - %.3f s is shorter than %.1f s", start, end, MUSIC_MIN_LOOP);
+        return false;
+    }
+
+    uint64_t start_frame = (uint64_t)(start * s_decoder.sample_rate);
+    uint64_t end_frame = (uint64_t)(end * s_decoder.sample_rate);
+    if (end_frame > 0xFFFFFFFF) {
+        LOG("Loop points past the first 2^32 frames are not supported");
+        return false;
+    }
+
+    // the seek makes the decode thread and the callback drop whatever they have past the end
+    atomic_store(&s_loop, LOOP_PACK(start_frame, end_frame));
+    music_seek(start);
+    LOGF("looping %.3f - %.3f s", start, end);
+    return true;
+}
+
+void music_clear_loop() {
+    // reads check the loop again after counting a wrap, so either they play straight on or the
+    // wrap counts here. Audio of another pass is queued then, the seek drops it.
+    uint64_t loop = atomic_exchange(&s_loop, 0);
+    unsigned int generation = atomic_load(&s_generation) & POSITION_COUNTER_MASK;
+    uint64_t read = atomic_load(&s_wraps_read);
+    uint64_t played = atomic_load(&s_wraps_played);
+    unsigned int played_count = (POSITION_GENERATION(played) == generation) ? POSITION_PASS(played) : 0;
+    if (loop != 0 && POSITION_GENERATION(read) == generation && POSITION_PASS(read) != played_count)
+        music_seek(music_time_played());
+}
+
+void music_set_rate(double rate) {
+    atomic_store(&s_rate, CONSTRAIN(rate, STRETCH_MIN_RATE, STRETCH_MAX_RATE));
+}
+
+double music_rate() {
+    return atomic_load(&s_rate);
+}
+
+void music_set_gain(float gain) {
+    if (s_is_ready)
+        SetAudioStreamVolume(s_stream, MUSIC_VOLUME * gain);
+}
+
+music_stats_t music_stats() {
+    return (music_stats_t) {
+        atomic_load(&s_underruns),
+        atomic_load(&s_underrun_frames),
+        (s_config.mode == MUSIC_MEMORY)
+            ? music_length() - music_time_played()
+            : (double)ring_size(&s_ring) * MUSIC_CHUNK_FRAMES / s_decoder.sample_rate,
+    };
+}
+
+void* _decode_thread(void* arg) {
+    static chunk_t chunk;
+    unsigned int generation = atomic_load(&s_generation) - 1;
+    uint64_t frame = 0;
+    bool has_ended = false;
+    unsigned int wraps = 0;
+
+    while (!atomic_load(&s_quit)) {
+        unsigned int latest = atomic_load_explicit(&s_generation, memory_order_acquire);
+        if (latest != generation) {
+            generation = latest;
+            wraps = 0;
+            frame = atomic_load(&s_seek_frame);
+            has_ended = !decoder_seek(&s_decoder, frame);
+            if (has_ended)
+                LOGF("Failed to seek to frame %llu", (unsigned long long)frame);
+        }
+
+        if (has_ended || ring_space(&s_ring) == 0) {
+            timer_sleep(MUSIC_DECODE_INTERVAL);
+            continue;
+        }
+
+        // chunks stop at the end of the loop, the next one starts over at its start
+        uint64_t loop = atomic_load(&s_loop);
+        bool is_looping = LOOP_END(loop) > frame;
+        int count = (is_looping) ? min(MUSIC_CHUNK_FRAMES, LOOP_END(loop) - frame) : MUSIC_CHUNK_FRAMES;
+
+        chunk.generation = generation;
+        chunk.frame = frame;
+        chunk.count = decoder_read(&s_decoder, chunk.samples, count);
+        chunk.is_last = chunk.count < count;
+        ring_write(&s_ring, &chunk, 1);
+
+        frame += chunk.count;
+        has_ended = chunk.is_last;
+        if (is_looping && !has_ended && frame == LOOP_END(loop)) {
+            atomic_store(&s_wraps_read, POSITION_PACK(generation, wraps + 1, 0));
+            if (atomic_load(&s_loop) != loop) {
+                // cleared meanwhile, the music plays on from the end of the loop
+                atomic_store(&s_wraps_read, POSITION_PACK(generation, wraps, 0));
+                continue;
+            }
+            wraps++;
+            frame = LOOP_START(loop);
+            has_ended = !decoder_seek(&s_decoder, frame);
+            if (has_ended)
+                LOGF("Failed to seek to frame %llu", (unsigned long long)frame);
+        }
+    }
+    return NULL;
+}
+
+void* _load_thread(void* arg) {
+    Wave pcm;
+    bool is_cached;
+    if (!pcm_cache_load(s_filepath, s_config.cache_directory, s_config.cache_format, &pcm, &is_cached)) {
+        atomic_store(&s_has_failed, true);
+        return NULL;
+    }
+    s_pcm = pcm;
+    atomic_store_explicit(&s_is_loaded, true, memory_order_release);
+
+    // playback does not wait for the cache, the samples are only read from here on
+    if (!is_cached)
+        pcm_cache_store(s_filepath, s_config.cache_directory, s_config.cache_format, &s_pcm);
+    return NULL;
+}
+
+void _pull(void* buffer, unsigned int frames) {
+    float* out = buffer;
+    unsigned int generation = atomic_load_explicit(&s_generation, memory_order_acquire);
+    if (generation != s_pull_generation) {
+        s_pull_generation = generation;
+        s_read_frame = atomic_load(&s_seek_frame);
+        s_has_data = false;
+        s_is_stretched = false;
+        s_read_offset = 0;
+        s_output_offset = 0;
+        s_has_wrap = false;
+        s_read_wrap_count = 0;
+        s_played_wrap_count = 0;
+    }
+
+    // once stretched the source is ahead of the output, so it stays stretched until a seek
+    double rate = atomic_load(&s_rate);
+    if (rate != 1.0 && !s_is_stretched) {
+        stretch_reset(&s_stretch, s_read_frame + s_read_offset);
+        s_is_stretched = true;
+    }
+
+    // raylib can split a device period into several calls, only the first one starts it
+    if (!atomic_load_explicit(&s_has_period, memory_order_relaxed)) {
+        double start = (s_is_stretched) ? stretch_position(&s_stretch) : (double)(s_read_frame + s_read_offset);
+        atomic_store_explicit(&s_period_position, (start - s_output_offset) / s_decoder.sample_rate, memory_order_relaxed);
+        atomic_store_explicit(&s_has_period, true, memory_order_relaxed);
+    }
+
+    int done;
+    bool has_ended;
+    double position;
+    if (s_is_stretched) {
+        stretch_set_rate(&s_stretch, rate);
+        done = stretch_process(&s_stretch, out, frames);
+        has_ended = stretch_is_finished(&s_stretch);
+        position = stretch_position(&s_stretch);
+    }
+    else {
+        // a read that comes up short only tells on the next one whether the source ended
+        int read = s_read(NULL, out, frames);
+        done = max(read, 0);
+        has_ended = read < 0;
+        if (!has_ended && done < (int)frames) {
+            read = s_read(NULL, out + done * DECODER_CHANNELS, frames - done);
+            done += max(read, 0);
+            has_ended = read < 0;
+        }
+        position = s_read_frame + s_read_offset;
+    }
+
+    if (s_has_wrap && position >= s_wrap_position) {
+        s_output_offset = s_read_offset;
+        s_has_wrap = false;
+        s_loop_pass++;
+        s_played_wrap_count++;
+    }
+    position -= s_output_offset;
+
+    // an empty buffer right after a seek is expected, only running dry mid-stream counts
+    if (done < (int)frames && !has_ended && s_has_data) {
+        atomic_fetch_add(&s_underruns, 1);
+        atomic_fetch_add(&s_underrun_frames, frames - done);
+    }
+    s_has_data |= done > 0;
+    if (has_ended)
+        atomic_store(&s_finished_generation, generation);
+
+    memset(out + done * DECODER_CHANNELS, 0, (frames - done) * DECODER_CHANNELS * sizeof(float));
+    _publish_position(generation, (uint64_t)position);
+    atomic_store(&s_wraps_played, POSITION_PACK(generation, s_played_wrap_count, 0));
+}
+
+int _read_stream(void* user, float* frames, int count) {
+    int done = 0;
+    while (done < count) {
+        bool is_current = s_chunk.generation == s_pull_generation;
+        if (is_current && s_chunk_offset < s_chunk.count) {
+            int n = min(count - done, s_chunk.count - s_chunk_offset);
+            memcpy(frames + done * DECODER_CHANNELS, s_chunk.samples + s_chunk_offset * DECODER_CHANNELS, n * DECODER_CHANNELS * sizeof(float));
+            done += n;
+            s_chunk_offset += n;
+            s_read_frame = s_chunk.frame + s_chunk_offset;
+            continue;
+        }
+
+        if (is_current && s_chunk.is_last)
+            return (done > 0) ? done : -1;
+        if (!ring_read(&s_ring, &s_chunk, 1))
+            break;
+        s_chunk_offset = 0;
+
+        // the decode thread only jumps within a generation at the end of the loop
+        if (s_chunk.generation == s_pull_generation && s_chunk.frame != s_read_frame) {
+            _wrap(s_read_frame, s_chunk.frame);
+            s_read_frame = s_chunk.frame;
+        }
+    }
+    return done;
+}
+
+int _read_memory(void* user, float* frames, int count) {
+    if (!atomic_load_explicit(&s_is_loaded, memory_order_acquire))
+        return 0;
+
+    int done = 0;
+    while (done < count) {
+        // the loop applies once the reads reach its end from before it
+        uint64_t loop = atomic_load_explicit(&s_loop, memory_order_relaxed);
+        bool is_looping = LOOP_END(loop) != 0 && s_read_frame <= LOOP_END(loop);
+        if (is_looping && s_read_frame == LOOP_END(loop)) {
+            atomic_store(&s_wraps_read, POSITION_PACK(s_pull_generation, s_read_wrap_count + 1, 0));
+            if (atomic_load(&s_loop) == loop) {
+                s_read_wrap_count++;
+                _wrap(s_read_frame, LOOP_START(loop));
+                s_read_frame = LOOP_START(loop);
+            }
+            else {
+                atomic_store(&s_wraps_read, POSITION_PACK(s_pull_generation, s_read_wrap_count, 0));
+                continue;
+            }
+        }
+
+        uint64_t end = (is_looping) ? min(LOOP_END(loop), s_pcm.frameCount) : s_pcm.frameCount;
+        if (s_read_frame >= end)
+            return (done > 0) ? done : -1;
+
+        int n = min((uint64_t)(count - done), end - s_read_frame);
+        memcpy(frames + done * DECODER_CHANNELS, (float*)s_pcm.data + s_read_frame * DECODER_CHANNELS, n * DECODER_CHANNELS * sizeof(float));
+        s_read_frame += n;
+        done += n;
+    }
+    return done;
+}
+
+void _wrap(uint64_t from, uint64_t to) {
+    // MUSIC_MIN_LOOP is longer than the stretcher reads ahead, so one wrap is pending at most
+    s_wrap_position = from + s_read_offset;
+    s_read_offset += from - to;
+    s_has_wrap = true;
+}
+
+void _publish_position(unsigned int generation, uint64_t frame) {
+    // a seek that happened during the callback wins
+    uint64_t position = atomic_load(&s_position);
+    while (POSITION_GENERATION(position) == (generation & POSITION_COUNTER_MASK)) {
+        if (atomic_compare_exchange_weak(&s_position, &position, POSITION_PACK(generation, s_loop_pass, frame)))
+            break;
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef MUSIC_H
+#define MUSIC_H
+
+#include <stdint.h>
+
+#include <defines.h>
+#include <pcm_cache.h>
+#include <stretch.h>
+
+// Frames handed from the decode thread to the audio callback at once
+#ifndef MUSIC_CHUNK_FRAMES
+#define MUSIC_CHUNK_FRAMES 512
+#endif
+
+// Decoded audio kept ahead of the audio callback, covers stalls of the decode thread
+#ifndef MUSIC_DEFAULT_BUFFER
+#define MUSIC_DEFAULT_BUFFER 0.25
+#endif
+
+// How often the decode thread checks for room in the buffer and for seeks
+#ifndef MUSIC_DECODE_INTERVAL
+#define MUSIC_DECODE_INTERVAL 0.005
+#endif
+
+// Shortest A-B loop, the stretcher reads ahead of the output by less than this
+#ifndef MUSIC_MIN_LOOP
+#define MUSIC_MIN_LOOP 0.5
+#endif
+
+#define MUSIC_VOLUME 0.75f
+
+
+typedef enum {
+    MUSIC_STREAM,   // decoded while playing
+    MUSIC_MEMORY,   // decoded once up front, seeks are exact and free
+} music_mode_t;
+
+typedef struct music_config_s {
+    music_mode_t        mode;
+    double              buffer;             // seconds decoded ahead, stream mode only
+    const char*         cache_directory;    // memory mode only
+    pcm_cache_format_t  cache_format;
+    stretch_mode_t      stretch;
+    double              rate;               // 1 plays the music unchanged
+} music_config_t;
+
+typedef struct music_stats_s {
+    int         underruns;          // audio callbacks that ran out of decoded audio
+    uint64_t    underrun_frames;    // silence played because of them
+    double      buffered;           // seconds of decoded audio ahead of the callback
+} music_stats_t;
+
+
+bool music_mode_from_name(const char* name, music_mode_t* mode);
+
+// Music is decoded on its own thread, either into a lock-free ring that the audio callback
+// pulls from or, in memory mode, into one buffer the callback plays from. Nothing has to be
+// called per frame. Requires an initialized audio device.
+bool music_init(const char* filepath, music_config_t config);
+void music_shutdown();
+
+// Waits for enough decoded audio, the whole track in memory mode.
+bool music_play();
+void music_pause();
+void music_resume();
+bool music_is_playing();
+
+// Position of the next frame the audio callback mixes.
+double music_time_played();
+// Position of the first frame the music rendered in the current device period, for processors
+// that run after it in the same audio callback. False when it rendered nothing since the last
+// call, e.g. while paused.
+bool music_period_position(double* position);
+double music_length();
+void music_seek(double time);
+
+// Seeks to start and from then on plays [start, end) over and over. The audio callback wraps
+// from end back to start on the exact sample. Fails for loops shorter than MUSIC_MIN_LOOP.
+bool music_set_loop(double start, double end);
+// The current pass plays on past the end of the loop. When the reads already wrapped back to
+// the start, the audio queued for the next pass is dropped with a seek to the current position.
+void music_clear_loop();
+// Same as music_time_played(), along with the number of loop passes played so far (wrapping at
+// 4096). Both are read at once, so a wrap never shows in one of them but not the other.
+double music_time_played_pass(unsigned int* pass);
+
+// Playback speed, from STRETCH_MIN_RATE to STRETCH_MAX_RATE. Positions stay in song time.
+void music_set_rate(double rate);
+double music_rate();
+
+// Scales MUSIC_VOLUME, for loudness normalization. Applied by raylib's mixer, costs nothing
+// in the audio callback.
+void music_set_gain(float gain);
+
+music_stats_t music_stats();
+
+
+#endif
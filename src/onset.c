@@ -0,0 +1,717 @@
+#include <onset.h>
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define CPU_COUNT() pthread_num_processors_np()
+#else
+#include <unistd.h>
+#define CPU_COUNT() ((int)sysconf(_SC_NPROCESSORS_ONLN))
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <raylib.h>
+
+#include <decoder.h>
+#include <pcm_cache.h>
+#include <timer.h>
+#define SCOPE_NAME "onset"
+#include <logging.h>
+
+#define ENVELOPE_MAGIC 0x31534E4Fu // "ONS1"
+
+// A real frame is transformed as a complex one of half the size
+#define POINTS (ONSET_FFT_SIZE / 2)
+
+// Magnitudes are compressed with log(1 + COMPRESSION * x) before they are differenced, so
+// quiet onsets count as well
+#define COMPRESSION 100.0f
+
+// The envelope has the average of this many seconds to either side of a value taken off
+#define MEAN_SPAN 0.1
+
+// Frames decoded at once
+#define READ_FRAMES 4096
+
+// Offsets tried per side of a window at most
+#define MAX_STEPS 128
+
+
+// Shared by the threads of onset_envelope()
+typedef struct envelope_job_s {
+    const char*     filepath;
+    const char*     index_filepath;
+    int             sample_rate;
+    uint64_t        frame_count;
+    int*            bounds;         // chunk i computes values [bounds[i], bounds[i + 1])
+    float*          values;
+    int             chunk_count;
+    atomic_int      next_chunk;
+    atomic_bool     has_failed;
+} envelope_job_t;
+
+// Work space of one thread
+typedef struct analyzer_s {
+    float*      mono;
+    int         mono_capacity;
+    float       stereo[READ_FRAMES * DECODER_CHANNELS];
+    float       re[POINTS];
+    float       im[POINTS];
+    float       spectra[2][POINTS + 1];     // log magnitudes of the previous and the current frame
+} analyzer_t;
+
+typedef struct envelope_header_s {
+    uint32_t    magic;
+    uint32_t    rate;
+    uint32_t    fft_size;
+    uint32_t    count;
+} envelope_header_t;
+
+// Beats of a section measured together
+typedef struct window_s {
+    double      time;           // middle, ms
+    float       offset;
+    float       confidence;
+} window_t;
+
+static float                    s_window[ONSET_FFT_SIZE];
+static int                      s_reversed[POINTS];
+static float                    s_twiddle_re[POINTS];       // the stage of half size h at [h, 2h)
+static float                    s_twiddle_im[POINTS];
+static float                    s_unpack_re[POINTS + 1];
+static float                    s_unpack_im[POINTS + 1];
+static pthread_once_t           s_tables_once = PTHREAD_ONCE_INIT;
+
+static void* _envelope_thread(void* arg);
+static bool _analyze_chunk(envelope_job_t* job, decoder_t* decoder, analyzer_t* analyzer, int chunk);
+static bool _read_mono(envelope_job_t* job, decoder_t* decoder, analyzer_t* analyzer, int64_t start, int64_t end);
+static void _spectrum(analyzer_t* analyzer, const float* samples, float* spectrum);
+static float _bin(const float* re, const float* im, int k);
+#if defined(__SSE2__)
+static __m128 _log_ps(__m128 x);
+#endif
+static float _flux(const float* before, const float* current);
+static void _fft(float* re, float* im);
+static void _init_tables();
+static int64_t _center(const envelope_job_t* job, int value);
+static void _subtract_mean(onset_envelope_t* envelope);
+static bool _measure_window(const onset_envelope_t* envelope, double start, double length, int beats, double search, window_t* window);
+static float _sample(const onset_envelope_t* envelope, double position);
+static float _weighted_median(window_t* windows, int count);
+static int _compare_offsets(const void* a, const void* b);
+static bool _load_envelope(const char* envelope_filepath, onset_envelope_t* envelope);
+static void _save_envelope(const char* envelope_filepath, const onset_envelope_t* envelope);
+
+
+bool onset_envelope(const char* filepath, const char* index_filepath, int threads, onset_envelope_t* envelope) {
+    decoder_t decoder;
+    if (!decoder_open(&decoder, filepath, index_filepath))
+        return false;
+
+    envelope_job_t job = {
+        .filepath = filepath,
+        .index_filepath = index_filepath,
+        .sample_rate = decoder.sample_rate,
+        .frame_count = decoder.frame_count,
+    };
+    double length = decoder_length(&decoder);
+    decoder_close(&decoder);
+
+    // a value for every frame center within the file
+    int count = (int)(job.frame_count * ONSET_RATE / job.sample_rate);
+    if (count <= 0) {
+        LOGF("\"%s\" is empty", filepath);
+        return false;
+    }
+
+    if (threads <= 0)
+        threads = CPU_COUNT();
+    int chunk_count = max(1, min(2 * threads, (int)(length / ONSET_MIN_CHUNK)));
+    chunk_count = min(chunk_count, count);
+    threads = max(1, min(threads, min(chunk_count, ONSET_MAX_THREADS)));
+
+    job.bounds = malloc((chunk_count + 1) * sizeof(int));
+    job.values = calloc(count, sizeof(float));
+    if (!job.bounds || !job.values) {
+        LOG("Failed to allocate the envelope");
+        free(job.bounds);
+        free(job.values);
+        return false;
+    }
+    for (int i = 0; i <= chunk_count; i++)
+        job.bounds[i] = (int)((int64_t)count * i / chunk_count);
+    job.chunk_count = chunk_count;
+    atomic_store(&job.next_chunk, 0);
+    atomic_store(&job.has_failed, false);
+
+    pthread_t pool[ONSET_MAX_THREADS];
+    int started = 0;
+    while (started < threads - 1 && pthread_create(&pool[started], NULL, _envelope_thread, &job) == 0)
+        started++;
+
+    // the calling thread helps out as well, at least one thread always runs
+    _envelope_thread(&job);
+    for (int i = 0; i < started; i++)
+        pthread_join(pool[i], NULL);
+
+    free(job.bounds);
+    if (atomic_load(&job.has_failed)) {
+        free(job.values);
+        return false;
+    }
+
+    *envelope = (onset_envelope_t) { ONSET_RATE, count, job.values };
+    _subtract_mean(envelope);
+    return true;
+}
+
+bool onset_envelope_get(const char* filepath, const char* directory, onset_envelope_t* envelope) {
+    char envelope_filepath[512], index_filepath[512];
+    bool has_cache = directory && pcm_cache_filepath(filepath, directory, "onset", envelope_filepath, STACKARRAY_SIZE(envelope_filepath));
+    if (has_cache && _load_envelope(envelope_filepath, envelope))
+        return true;
+
+    bool has_index = directory && pcm_cache_filepath(filepath, directory, "seek", index_filepath, STACKARRAY_SIZE(index_filepath));
+    double start = timer_now();
+    if (!onset_envelope(filepath, (has_index) ? index_filepath : NULL, 0, envelope)) {
+        LOGF("Failed to analyze \"%s\"", filepath);
+        return false;
+    }
+    LOGF("\"%s\": %d onset values, computed in %.3f s", GetFileName(filepath), envelope->count, timer_now() - start);
+
+    if (has_cache)
+        _save_envelope(envelope_filepath, envelope);
+    return true;
+}
+
+void onset_envelope_destroy(onset_envelope_t* envelope) {
+    free(envelope->values);
+    *envelope = (onset_envelope_t){0};
+}
+
+bool onset_check(const beatmap_t* beatmap, const onset_envelope_t* envelope, onset_report_t* report) {
+    *report = (onset_report_t){0};
+    kv_init(report->sections);
+
+    // sections end with the next one, the last one with the chart
+    double song_end = envelope->count * 1000.0 / envelope->rate;
+    double chart_end = 0;
+    for (int i = 0; i < kv_size(beatmap->notes); i++) {
+        const beatmap_note_t* note = &kv_A(beatmap->notes, i);
+        chart_end = max(chart_end, (double)max(note->time_start, note->time_end));
+    }
+    if (chart_end <= 0)
+        chart_end = song_end;
+
+    kvec_t(window_t) windows;
+    kv_init(windows);
+    kvec_t(int) firsts;             // first window of every section, and one past the last
+    kv_init(firsts);
+
+    for (int i = 0; i < kv_size(beatmap->timing_points); i++) {
+        const beatmap_timing_point_t* point = &kv_A(beatmap->timing_points, i);
+        if (!point->is_uninherited || point->length <= 0)
+            continue;
+
+        double end = min(chart_end, song_end);
+        for (int j = i + 1; j < kv_size(beatmap->timing_points); j++) {
+            if (kv_A(beatmap->timing_points, j).is_uninherited) {
+                end = min(end, (double)kv_A(beatmap->timing_points, j).time_start);
+                break;
+            }
+        }
+        if (end <= point->time_start)
+            continue;
+
+        onset_section_t section = {
+            .timing_point = i,
+            .time_start = point->time_start,
+            .time_end = (int)end,
+            .bpm = 60000.0f / point->length,
+        };
+        kv_push(onset_section_t, report->sections, section);
+        kv_push(int, firsts, kv_size(windows));
+
+        // beyond a quarter beat the onsets of the next subdivision would match as well
+        double search = min(ONSET_SEARCH, point->length / 4);
+        int beats = (int)((end - point->time_start) / point->length);
+        for (int beat = 0; beat + ONSET_WINDOW_BEATS / 2 <= beats; beat += ONSET_WINDOW_BEATS) {
+            window_t window;
+            int window_beats = min(ONSET_WINDOW_BEATS, beats - beat);
+            double start = point->time_start + beat * (double)point->length;
+            if (_measure_window(envelope, start, point->length, window_beats, search, &window) && window.confidence >= ONSET_MIN_CONFIDENCE)
+                kv_push(window_t, windows, window);
+        }
+    }
+    kv_push(int, firsts, kv_size(windows));
+
+    // the offset of every section as a line through those of its windows, its slope is the drift
+    for (int i = 0; i < kv_size(report->sections); i++) {
+        onset_section_t* section = &kv_A(report->sections, i);
+        const window_t* first = &kv_A(windows, kv_A(firsts, i));
+        int count = kv_A(firsts, i + 1) - kv_A(firsts, i);
+        section->window_count = count;
+        section->suggested_bpm = section->bpm;
+        if (count == 0)
+            continue;
+
+        double weights = 0, time = 0, offset = 0;
+        for (int j = 0; j < count; j++) {
+            weights += first[j].confidence;
+            time += first[j].confidence * first[j].time;
+            offset += first[j].confidence * first[j].offset;
+        }
+        time /= weights;
+        offset /= weights;
+
+        // too few windows for the slope to mean anything
+        double slope = 0;
+        if (count >= 3) {
+            double covariance = 0, variance = 0;
+            for (int j = 0; j < count; j++) {
+                covariance += first[j].confidence * (first[j].time - time) * (first[j].offset - offset);
+                variance += first[j].confidence * (first[j].time - time) * (first[j].time - time);
+            }
+            slope = (variance > 0) ? covariance / variance : 0;
+        }
+
+        // beat k of the section is really at time_start + offset + k * length * (1 + slope)
+        section->offset = (float)(offset + slope * (section->time_start - time));
+        section->drift = (float)(slope * (section->time_end - section->time_start));
+        section->suggested_bpm = (float)(section->bpm / (1 + slope));
+    }
+
+    // sorts the windows, so only once the sections are done with them
+    report->window_count = kv_size(windows);
+    bool ok = report->window_count > 0;
+    if (ok)
+        report->offset = _weighted_median(windows.a, kv_size(windows));
+
+    for (int i = 0; ok && i < kv_size(report->sections); i++) {
+        onset_section_t* section = &kv_A(report->sections, i);
+        section->is_flagged =
+            section->window_count > 0 &&
+            (fabsf(section->offset - report->offset) > ONSET_TOLERANCE || fabsf(section->drift) > ONSET_TOLERANCE);
+        report->flagged_count += section->is_flagged;
+    }
+
+    kv_destroy(windows);
+    kv_destroy(firsts);
+    return ok;
+}
+
+void onset_report_destroy(onset_report_t* report) {
+    kv_destroy(report->sections);
+    *report = (onset_report_t){0};
+}
+
+void onset_report_print(const onset_report_t* report) {
+    LOGF(
+        "Suggested offset %+.1f ms from %d windows, %d of %d sections flagged",
+        report->offset,
+        report->window_count,
+        report->flagged_count,
+        (int)kv_size(report->sections)
+    );
+    for (int i = 0; i < kv_size(report->sections); i++) {
+        const onset_section_t* section = &kv_A(report->sections, i);
+        if (section->window_count == 0) {
+            LOGF("  %8d ms %8.3f BPM: no clear beat", section->time_start, section->bpm);
+            continue;
+        }
+        LOGF(
+            "%c %8d ms %8.3f BPM: offset %+6.1f ms, drift %+6.1f ms over %d windows%s",
+            (section->is_flagged) ? '!' : ' ',
+            section->time_start,
+            section->bpm,
+            section->offset,
+            section->drift,
+            section->window_count,
+            (section->is_flagged) ? TextFormat(", try %d ms at %.3f BPM", (int)lround(section->time_start + section->offset), section->suggested_bpm) : ""
+        );
+    }
+}
+
+void* _envelope_thread(void* arg) {
+    envelope_job_t* job = arg;
+    pthread_once(&s_tables_once, _init_tables);
+
+    decoder_t decoder;
+    if (!decoder_open(&decoder, job->filepath, job->index_filepath)) {
+        atomic_store(&job->has_failed, true);
+        return NULL;
+    }
+    analyzer_t* analyzer = calloc(1, sizeof(analyzer_t));
+    if (!analyzer) {
+        atomic_store(&job->has_failed, true);
+        decoder_close(&decoder);
+        return NULL;
+    }
+
+    int chunk;
+    while (!atomic_load(&job->has_failed) && (chunk = atomic_fetch_add(&job->next_chunk, 1)) < job->chunk_count) {
+        if (!_analyze_chunk(job, &decoder, analyzer, chunk)) {
+            LOGF("Failed to decode \"%s\"", job->filepath);
+            atomic_store(&job->has_failed, true);
+        }
+    }
+
+    free(analyzer->mono);
+    free(analyzer);
+    decoder_close(&decoder);
+    return NULL;
+}
+
+bool _analyze_chunk(envelope_job_t* job, decoder_t* decoder, analyzer_t* analyzer, int chunk) {
+    int first = job->bounds[chunk];
+    int last = job->bounds[chunk + 1];
+
+    // the flux of the first value is the difference to the frame before the chunk
+    int previous = max(first - 1, 0);
+    int64_t start = _center(job, previous) - ONSET_FFT_SIZE / 2;
+    int64_t end = _center(job, last - 1) + ONSET_FFT_SIZE / 2;
+    if (!_read_mono(job, decoder, analyzer, start, end))
+        return false;
+
+    float* before = analyzer->spectra[0];
+    float* current = analyzer->spectra[1];
+    _spectrum(analyzer, analyzer->mono + (_center(job, previous) - ONSET_FFT_SIZE / 2 - start), before);
+    for (int i = first; i < last; i++) {
+        _spectrum(analyzer, analyzer->mono + (_center(job, i) - ONSET_FFT_SIZE / 2 - start), current);
+
+        job->values[i] = _flux(before, current);
+
+        float* swap = before;
+        before = current;
+        current = swap;
+    }
+    return true;
+}
+
+bool _read_mono(envelope_job_t* job, decoder_t* decoder, analyzer_t* analyzer, int64_t start, int64_t end) {
+    int length = (int)(end - start);
+    if (length > analyzer->mono_capacity) {
+        float* mono = realloc(analyzer->mono, length * sizeof(float));
+        if (!mono)
+            return false;
+        analyzer->mono = mono;
+        analyzer->mono_capacity = length;
+    }
+    memset(analyzer->mono, 0, length * sizeof(float));
+
+    // frames before the start or past the end of the file stay silent
+    int64_t from = max(start, 0);
+    int64_t to = min(end, (int64_t)job->frame_count);
+    if (from >= to)
+        return true;
+    if (!decoder_seek(decoder, (uint64_t)from))
+        return false;
+
+    for (int64_t frame = from; frame < to;) {
+        int read = decoder_read(decoder, analyzer->stereo, (int)min(to - frame, (int64_t)READ_FRAMES));
+        if (read <= 0)
+            break;
+        float* mono = analyzer->mono + (frame - start);
+        for (int i = 0; i < read; i++)
+            mono[i] = 0.5f * (analyzer->stereo[i * DECODER_CHANNELS] + analyzer->stereo[i * DECODER_CHANNELS + 1]);
+        frame += read;
+    }
+    return true;
+}
+
+void _spectrum(analyzer_t* analyzer, const float* samples, float* spectrum) {
+    float* re = analyzer->re;
+    float* im = analyzer->im;
+
+    // even samples are the real parts, odd ones the imaginary parts, stored bit reversed
+    for (int j = 0; j < POINTS; j++) {
+        int r = s_reversed[j];
+        re[r] = samples[2 * j] * s_window[2 * j];
+        im[r] = samples[2 * j + 1] * s_window[2 * j + 1];
+    }
+    _fft(re, im);
+
+    // the spectrum of the real frame from that of the half size complex one, bins 0 to N / 2
+    int k = 1;
+#if defined(__SSE2__)
+    // bin k pairs with bin N / 2 - k, four of those are read backwards
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 compression = _mm_set1_ps(COMPRESSION);
+    for (; k + 4 <= POINTS; k += 4) {
+        __m128 a_re = _mm_loadu_ps(re + k);
+        __m128 a_im = _mm_loadu_ps(im + k);
+        __m128 b_re = _mm_loadu_ps(re + POINTS - k - 3);
+        __m128 b_im = _mm_loadu_ps(im + POINTS - k - 3);
+        b_re = _mm_shuffle_ps(b_re, b_re, _MM_SHUFFLE(0, 1, 2, 3));
+        b_im = _mm_shuffle_ps(b_im, b_im, _MM_SHUFFLE(0, 1, 2, 3));
+        __m128 even_re = _mm_mul_ps(half, _mm_add_ps(a_re, b_re));
+        __m128 even_im = _mm_mul_ps(half, _mm_sub_ps(a_im, b_im));
+        __m128 odd_re = _mm_mul_ps(half, _mm_add_ps(a_im, b_im));
+        __m128 odd_im = _mm_mul_ps(half, _mm_sub_ps(b_re, a_re));
+        __m128 w_re = _mm_loadu_ps(s_unpack_re + k);
+        __m128 w_im = _mm_loadu_ps(s_unpack_im + k);
+        __m128 x_re = _mm_add_ps(even_re, _mm_sub_ps(_mm_mul_ps(w_re, odd_re), _mm_mul_ps(w_im, odd_im)));
+        __m128 x_im = _mm_add_ps(even_im, _mm_add_ps(_mm_mul_ps(w_re, odd_im), _mm_mul_ps(w_im, odd_re)));
+        __m128 magnitude = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x_re, x_re), _mm_mul_ps(x_im, x_im)));
+        _mm_storeu_ps(spectrum + k, _log_ps(_mm_add_ps(one, _mm_mul_ps(compression, magnitude))));
+    }
+#endif
+    for (; k <= POINTS; k++)
+        spectrum[k] = _bin(re, im, k);
+    spectrum[0] = _bin(re, im, 0);
+}
+
+float _bin(const float* re, const float* im, int k) {
+    int a = k & (POINTS - 1);
+    int b = (POINTS - k) & (POINTS - 1);
+    float even_re = 0.5f * (re[a] + re[b]);
+    float even_im = 0.5f * (im[a] - im[b]);
+    float odd_re = 0.5f * (im[a] + im[b]);
+    float odd_im = -0.5f * (re[a] - re[b]);
+    float x_re = even_re + s_unpack_re[k] * odd_re - s_unpack_im[k] * odd_im;
+    float x_im = even_im + s_unpack_re[k] * odd_im + s_unpack_im[k] * odd_re;
+    return logf(1 + COMPRESSION * sqrtf(x_re * x_re + x_im * x_im));
+}
+
+#if defined(__SSE2__)
+__m128 _log_ps(__m128 x) {
+    // log2 of the exponent and of the mantissa in [1, 2) apart, the latter as a polynomial
+    // within 1e-4, for positive x
+    __m128i bits = _mm_castps_si128(x);
+    __m128 exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+    __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000)));
+    __m128 p = _mm_set1_ps(-0.080010853f);
+    p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(0.63551097f));
+    p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-2.0994020f));
+    p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(4.0496166f));
+    p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-2.5056146f));
+    return _mm_mul_ps(_mm_add_ps(exponent, p), _mm_set1_ps((float)M_LN2));
+}
+#endif
+
+float _flux(const float* before, const float* current) {
+    // only rising bins, falling ones are the decay of earlier onsets
+    int k = 0;
+    float flux = 0;
+#if defined(__SSE2__)
+    __m128 sum = _mm_setzero_ps();
+    for (; k + 4 <= POINTS + 1; k += 4)
+        sum = _mm_add_ps(sum, _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(current + k), _mm_loadu_ps(before + k)), _mm_setzero_ps()));
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    flux = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; k <= POINTS; k++)
+        flux += max(current[k] - before[k], 0.0f);
+    return flux;
+}
+
+void _fft(float* re, float* im) {
+    // in place, radix 2, decimation in time, the input is already bit reversed
+    for (int half = 1; half < POINTS; half <<= 1) {
+        const float* w_re = s_twiddle_re + half;
+        const float* w_im = s_twiddle_im + half;
+        for (int k = 0; k < POINTS; k += 2 * half) {
+            float* a_re = re + k;
+            float* a_im = im + k;
+            float* b_re = a_re + half;
+            float* b_im = a_im + half;
+            int j = 0;
+#if defined(__SSE2__)
+            // four butterflies at once from the third stage on
+            for (; j + 4 <= half; j += 4) {
+                __m128 wr = _mm_loadu_ps(w_re + j);
+                __m128 wi = _mm_loadu_ps(w_im + j);
+                __m128 br = _mm_loadu_ps(b_re + j);
+                __m128 bi = _mm_loadu_ps(b_im + j);
+                __m128 tr = _mm_sub_ps(_mm_mul_ps(br, wr), _mm_mul_ps(bi, wi));
+                __m128 ti = _mm_add_ps(_mm_mul_ps(br, wi), _mm_mul_ps(bi, wr));
+                __m128 ar = _mm_loadu_ps(a_re + j);
+                __m128 ai = _mm_loadu_ps(a_im + j);
+                _mm_storeu_ps(b_re + j, _mm_sub_ps(ar, tr));
+                _mm_storeu_ps(b_im + j, _mm_sub_ps(ai, ti));
+                _mm_storeu_ps(a_re + j, _mm_add_ps(ar, tr));
+                _mm_storeu_ps(a_im + j, _mm_add_ps(ai, ti));
+            }
+#endif
+            for (; j < half; j++) {
+                float tr = b_re[j] * w_re[j] - b_im[j] * w_im[j];
+                float ti = b_re[j] * w_im[j] + b_im[j] * w_re[j];
+                b_re[j] = a_re[j] - tr;
+                b_im[j] = a_im[j] - ti;
+                a_re[j] += tr;
+                a_im[j] += ti;
+            }
+        }
+    }
+}
+
+void _init_tables() {
+    // a full scale sine peaks at 1 before the compression
+    double scale = 4.0 / ONSET_FFT_SIZE;
+    for (int n = 0; n < ONSET_FFT_SIZE; n++)
+        s_window[n] = (float)(scale * (0.5 - 0.5 * cos(2 * M_PI * n / ONSET_FFT_SIZE)));
+
+    int bits = 0;
+    while ((1 << bits) < POINTS)
+        bits++;
+    for (int j = 0; j < POINTS; j++) {
+        int r = 0;
+        for (int bit = 0; bit < bits; bit++)
+            r |= ((j >> bit) & 1) << (bits - 1 - bit);
+        s_reversed[j] = r;
+    }
+
+    for (int half = 1; half < POINTS; half <<= 1) {
+        for (int j = 0; j < half; j++) {
+            s_twiddle_re[half + j] = (float)cos(-M_PI * j / half);
+            s_twiddle_im[half + j] = (float)sin(-M_PI * j / half);
+        }
+    }
+    for (int k = 0; k <= POINTS; k++) {
+        s_unpack_re[k] = (float)cos(-2 * M_PI * k / ONSET_FFT_SIZE);
+        s_unpack_im[k] = (float)sin(-2 * M_PI * k / ONSET_FFT_SIZE);
+    }
+}
+
+int64_t _center(const envelope_job_t* job, int value) {
+    return (int64_t)llround((double)value * job->sample_rate / ONSET_RATE);
+}
+
+void _subtract_mean(onset_envelope_t* envelope) {
+    int span = (int)lround(MEAN_SPAN * envelope->rate);
+    double* sums = malloc((envelope->count + 1) * sizeof(double));
+    if (!sums)
+        return;
+
+    sums[0] = 0;
+    for (int i = 0; i < envelope->count; i++)
+        sums[i + 1] = sums[i] + envelope->values[i];
+    for (int i = 0; i < envelope->count; i++) {
+        int first = max(i - span, 0);
+        int last = min(i + span + 1, envelope->count);
+        double mean = (sums[last] - sums[first]) / (last - first);
+        envelope->values[i] = (float)max(envelope->values[i] - mean, 0.0);
+    }
+    free(sums);
+}
+
+bool _measure_window(const onset_envelope_t* envelope, double start, double length, int beats, double search, window_t* window) {
+    int steps = min((int)(search * envelope->rate / 1000), MAX_STEPS);
+    if (steps < 1)
+        return false;
+
+    // the envelope summed over the beats, with the beats shifted by whole values
+    float scores[2 * MAX_STEPS + 1];
+    double total = 0;
+    int best = 0;
+    for (int d = 0; d <= 2 * steps; d++) {
+        float score = 0;
+        for (int k = 0; k < beats; k++)
+            score += _sample(envelope, (start + k * length) * envelope->rate / 1000 + d - steps);
+        scores[d] = score;
+        total += score;
+        if (score > scores[best])
+            best = d;
+    }
+
+    // at either end the best offset probably lies beyond the search
+    double mean = total / (2 * steps + 1);
+    if (mean <= 0 || best == 0 || best == 2 * steps)
+        return false;
+
+    // the peak of a parabola through the best shift and its neighbours
+    float below = scores[best - 1], above = scores[best + 1];
+    float curvature = below - 2 * scores[best] + above;
+    float shift = (curvature < 0) ? 0.5f * (below - above) / curvature : 0;
+
+    window->time = start + beats * length / 2;
+    window->offset = (best - steps + shift) * 1000.0f / envelope->rate;
+    window->confidence = (float)(scores[best] / mean);
+    return true;
+}
+
+float _sample(const onset_envelope_t* envelope, double position) {
+    int i = (int)floor(position);
+    if (i < 0 || i + 1 >= envelope->count)
+        return 0;
+    float t = (float)(position - i);
+    return envelope->values[i] + t * (envelope->values[i + 1] - envelope->values[i]);
+}
+
+float _weighted_median(window_t* windows, int count) {
+    qsort(windows, count, sizeof(window_t), _compare_offsets);
+    double total = 0;
+    for (int i = 0; i < count; i++)
+        total += windows[i].confidence;
+
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += windows[i].confidence;
+        if (sum >= total / 2)
+            return windows[i].offset;
+    }
+    return windows[count - 1].offset;
+}
+
+int _compare_offsets(const void* a, const void* b) {
+    float x = ((const window_t*)a)->offset;
+    float y = ((const window_t*)b)->offset;
+    return (x > y) - (x < y);
+}
+
+bool _load_envelope(const char* envelope_filepath, onset_envelope_t* envelope) {
+    if (!FileExists(envelope_filepath))
+        return false;
+
+    unsigned int size = 0;
+    unsigned char* data = LoadFileData(envelope_filepath, &size);
+    if (!data)
+        return false;
+
+    envelope_header_t header = {0};
+    if (size >= sizeof(header))
+        memcpy(&header, data, sizeof(header));
+
+    bool is_valid =
+        header.magic == ENVELOPE_MAGIC &&
+        header.rate == ONSET_RATE &&
+        header.fft_size == ONSET_FFT_SIZE &&
+        header.count > 0 &&
+        size == sizeof(header) + header.count * sizeof(float);
+
+    float* values = (is_valid) ? malloc(header.count * sizeof(float)) : NULL;
+    if (values) {
+        memcpy(values, data + sizeof(header), header.count * sizeof(float));
+        *envelope = (onset_envelope_t) { header.rate, header.count, values };
+    }
+    else {
+        LOGF("Ignoring stale envelope \"%s\"", envelope_filepath);
+    }
+    UnloadFileData(data);
+    return values != NULL;
+}
+
+void _save_envelope(const char* envelope_filepath, const onset_envelope_t* envelope) {
+    envelope_header_t header = { ENVELOPE_MAGIC, envelope->rate, ONSET_FFT_SIZE, envelope->count };
+    unsigned int size = sizeof(header) + envelope->count * sizeof(float);
+
+    unsigned char* data = malloc(size);
+    if (!data)
+        return;
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), envelope->values, envelope->count * sizeof(float));
+
+    if (!SaveFileData(envelope_filepath, data, size))
+        LOGF("Failed to write \"%s\"", envelope_filepath);
+    free(data);
+}
@@ -0,0 +1,98 @@
+#ifndef ONSET_H
+#define ONSET_H
+
+#include <stdint.h>
+
+#include <kvec.h>
+
+#include <defines.h>
+#include <beatmap.h>
+
+// Envelope values per second
+#ifndef ONSET_RATE
+#define ONSET_RATE 200
+#endif
+
+// Samples of the mono mix every value is computed from, a power of two
+#ifndef ONSET_FFT_SIZE
+#define ONSET_FFT_SIZE 1024
+#endif
+
+// Shortest piece of a file a thread analyzes, in seconds
+#ifndef ONSET_MIN_CHUNK
+#define ONSET_MIN_CHUNK 10.0
+#endif
+
+#ifndef ONSET_MAX_THREADS
+#define ONSET_MAX_THREADS 32
+#endif
+
+// Beats of a section whose offset is measured together
+#ifndef ONSET_WINDOW_BEATS
+#define ONSET_WINDOW_BEATS 16
+#endif
+
+// Farthest from the chart's beats the onsets are looked for, in ms. Never more than a
+// quarter of a beat, so offsets of more than that are not found.
+#ifndef ONSET_SEARCH
+#define ONSET_SEARCH 60.0
+#endif
+
+// Sections whose offset differs from the global one or drifts by more than this are
+// flagged, in ms
+#ifndef ONSET_TOLERANCE
+#define ONSET_TOLERANCE 8.0
+#endif
+
+// Windows whose best offset scores less than this many times their average are left out,
+// they are breaks or have no clear beat
+#ifndef ONSET_MIN_CONFIDENCE
+#define ONSET_MIN_CONFIDENCE 1.3
+#endif
+
+
+// Spectral flux of the mono mix, above its local average
+typedef struct onset_envelope_s {
+    int     rate;           // values per second, value i is at i / rate seconds
+    int     count;
+    float*  values;
+} onset_envelope_t;
+
+// Offsets are what to add to the chart's times so its beats land on the onsets
+typedef struct onset_section_s {
+    int     timing_point;   // uninherited, index into the beatmap's timing_points
+    int     time_start;     // ms
+    int     time_end;
+    float   bpm;
+    float   offset;         // at time_start, ms
+    float   drift;          // of the offset from time_start to time_end, ms
+    float   suggested_bpm;  // without the drift
+    int     window_count;   // that had a clear beat
+    bool    is_flagged;
+} onset_section_t;
+
+typedef struct onset_report_s {
+    float                       offset;     // suggested for the whole chart, ms
+    int                         window_count;
+    int                         flagged_count;
+    kvec_t(onset_section_t)     sections;
+} onset_report_t;
+
+
+// Computes the envelope of a whole file on up to threads threads, 0 for one per core. The
+// seek index is optional, see decoder_open().
+bool onset_envelope(const char* filepath, const char* index_filepath, int threads, onset_envelope_t* envelope);
+
+// Loads the envelope of a file computed before from directory, or computes and stores it.
+// Envelopes are named like the PCM cache, see pcm_cache_filepath().
+bool onset_envelope_get(const char* filepath, const char* directory, onset_envelope_t* envelope);
+void onset_envelope_destroy(onset_envelope_t* envelope);
+
+// Correlates the envelope with the beats of every uninherited timing point of the beatmap.
+// Returns false when no section had a clear beat.
+bool onset_check(const beatmap_t* beatmap, const onset_envelope_t* envelope, onset_report_t* report);
+void onset_report_destroy(onset_report_t* report);
+void onset_report_print(const onset_report_t* report);
+
+
+#endif
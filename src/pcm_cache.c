@@ -0,0 +1,155 @@
+#include <pcm_cache.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define MAKE_DIRECTORY(path) _mkdir(path)
+#define FULL_PATH(path, dest) _fullpath(dest, path, sizeof(dest))
+#else
+#define MAKE_DIRECTORY(path) mkdir(path, 0755)
+#define FULL_PATH(path, dest) realpath(path, dest)
+#endif
+
+#include <decoder.h>
+#include <timer.h>
+#define SCOPE_NAME "pcm_cache"
+#include <logging.h>
+
+
+static bool _hash_file(const char* filepath, uint64_t* hash);
+static uint64_t _fnv(uint64_t hash, const void* data, size_t size);
+static bool _decode(const char* filepath, Wave* wave);
+
+
+bool pcm_cache_format_from_name(const char* name, pcm_cache_format_t* format) {
+    if (strcmp(name, "off") == 0)
+        *format = PCM_CACHE_OFF;
+    else if (strcmp(name, "raw") == 0)
+        *format = PCM_CACHE_RAW;
+    else if (strcmp(name, "qoa") == 0)
+        *format = PCM_CACHE_QOA;
+    else
+        return false;
+    return true;
+}
+
+bool pcm_cache_load(const char* filepath, const char* directory, pcm_cache_format_t format, Wave* wave, bool* is_cached) {
+    double start = timer_now();
+    char cache_filepath[512];
+
+    *is_cached = false;
+    if (
+        format != PCM_CACHE_OFF &&
+        pcm_cache_filepath(filepath, directory, (format == PCM_CACHE_QOA) ? "qoa" : "wav", cache_filepath, STACKARRAY_SIZE(cache_filepath)) &&
+        FileExists(cache_filepath)
+    ) {
+        if (decoder_load_wave(cache_filepath, wave)) {
+            WaveFormat(wave, wave->sampleRate, 32, DECODER_CHANNELS);
+            LOGF("loaded \"%s\" from the cache in %.3f s", GetFileName(filepath), timer_now() - start);
+            *is_cached = true;
+            return true;
+        }
+        LOGF("Ignoring unreadable cache file \"%s\"", cache_filepath);
+    }
+
+    if (!_decode(filepath, wave))
+        return false;
+    LOGF("decoded \"%s\" in %.3f s", GetFileName(filepath), timer_now() - start);
+    return true;
+}
+
+bool pcm_cache_store(const char* filepath, const char* directory, pcm_cache_format_t format, const Wave* wave) {
+    double start = timer_now();
+    char cache_filepath[512];
+
+    if (format == PCM_CACHE_OFF)
+        return false;
+    if (!pcm_cache_filepath(filepath, directory, (format == PCM_CACHE_QOA) ? "qoa" : "wav", cache_filepath, STACKARRAY_SIZE(cache_filepath)))
+        return false;
+
+    bool ok;
+    if (format == PCM_CACHE_QOA) {
+        // QOA only encodes 16-bit samples
+        Wave quantized = WaveCopy(*wave);
+        WaveFormat(&quantized, quantized.sampleRate, 16, DECODER_CHANNELS);
+        ok = ExportWave(quantized, cache_filepath);
+        UnloadWave(quantized);
+    }
+    else {
+        ok = ExportWave(*wave, cache_filepath);
+    }
+
+    if (ok)
+        LOGF("stored \"%s\" in %.3f s", GetFileName(cache_filepath), timer_now() - start);
+    else
+        LOGF("Failed to write \"%s\"", cache_filepath);
+    return ok;
+}
+
+bool pcm_cache_filepath(const char* filepath, const char* directory, const char* extension, char* dest, int size) {
+    uint64_t hash;
+    if (!directory || !_hash_file(filepath, &hash))
+        return false;
+
+    MAKE_DIRECTORY(directory);
+    snprintf(dest, size, "%s/%016llx.%s", directory, (unsigned long long)hash, extension);
+    return true;
+}
+
+bool _hash_file(const char* filepath, uint64_t* hash) {
+    // every load looks the cache up, so the song is not read for it. A file that is replaced
+    // or edited changes size or time and gets a new entry.
+    char path[4096];
+    struct stat info;
+    if (!FULL_PATH(filepath, path) || stat(path, &info) != 0)
+        return false;
+
+    uint64_t fields[2] = { (uint64_t)info.st_size, (uint64_t)info.st_mtime };
+    *hash = _fnv(14695981039346656037ull, path, strlen(path));
+    *hash = _fnv(*hash, fields, sizeof(fields));
+    return true;
+}
+
+uint64_t _fnv(uint64_t hash, const void* data, size_t size) {
+    // FNV-1a
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+bool _decode(const char* filepath, Wave* wave) {
+    decoder_t decoder;
+    if (!decoder_open(&decoder, filepath, NULL))
+        return false;
+
+    float* samples = malloc(decoder.frame_count * DECODER_CHANNELS * sizeof(float));
+    if (!samples) {
+        LOGF("Failed to allocate %llu frames", (unsigned long long)decoder.frame_count);
+        decoder_close(&decoder);
+        return false;
+    }
+
+    // chunks of the stream decode in parallel, one thread per core
+    uint64_t frames = decoder_decode_all(&decoder, filepath, samples, 0);
+    *wave = (Wave) {
+        .frameCount = frames,
+        .sampleRate = decoder.sample_rate,
+        .sampleSize = 32,
+        .channels = DECODER_CHANNELS,
+        .data = samples,
+    };
+
+    decoder_close(&decoder);
+    if (frames == 0) {
+        free(samples);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,30 @@
+#ifndef PCM_CACHE_H
+#define PCM_CACHE_H
+
+#include <raylib.h>
+
+#include <defines.h>
+
+
+typedef enum {
+    PCM_CACHE_OFF,
+    PCM_CACHE_RAW,  // float WAV, bit-exact
+    PCM_CACHE_QOA,  // 16-bit QOA, about a tenth of the size
+} pcm_cache_format_t;
+
+
+bool pcm_cache_format_from_name(const char* name, pcm_cache_format_t* format);
+
+// Decodes a whole file into float stereo, or loads it from directory when it was stored before.
+// Cached files are named after a hash of the absolute path, size and modification time of the file.
+bool pcm_cache_load(const char* filepath, const char* directory, pcm_cache_format_t format, Wave* wave, bool* is_cached);
+
+// Stores a decoded file so the next pcm_cache_load() of it skips decoding. Can take seconds for QOA.
+bool pcm_cache_store(const char* filepath, const char* directory, pcm_cache_format_t format, const Wave* wave);
+
+// Path of a file derived from filepath in directory, named after a hash of where the file is,
+// its size and modification time, so it costs no read of the file. Creates the directory.
+bool pcm_cache_filepath(const char* filepath, const char* directory, const char* extension, char* dest, int size);
+
+
+#endif
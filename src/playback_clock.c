@@ -0,0 +1,82 @@
+#include <playback_clock.h>
+
+#include <math.h>
+#include <stdatomic.h>
+
+#include <timer.h>
+
+
+// Written by the simulation thread only, read from any thread through a sequence lock
+static atomic_uint      s_sequence = 0;
+static _Atomic double   s_anchor_time = 0;
+static _Atomic double   s_anchor_pos = 0;
+static atomic_bool      s_is_running = false;
+static _Atomic double   s_rate = 1;
+static bool             s_is_synced = false;
+
+static void _publish(double time, double pos, bool is_running, double rate);
+
+
+double playback_clock_sync(double playback_pos, bool is_running) {
+    double now = timer_now();
+    double anchor_pos = playback_pos;
+    bool was_running = atomic_load_explicit(&s_is_running, memory_order_relaxed);
+
+    if (s_is_synced && was_running && is_running) {
+        double predicted = s_anchor_pos + (now - s_anchor_time) * s_rate;
+        double error = playback_pos - predicted;
+
+        if (fabs(error) <= PLAYBACK_CLOCK_SNAP_THRESHOLD)
+            anchor_pos = predicted + error * PLAYBACK_CLOCK_CORRECTION;
+    }
+
+    _publish(now, anchor_pos, is_running, s_rate);
+    s_is_synced = true;
+    return anchor_pos;
+}
+
+void playback_clock_set_rate(double rate) {
+    double now = timer_now();
+    _publish(now, playback_clock_at(now), playback_clock_is_running(), rate);
+}
+
+double playback_clock_rate() {
+    return atomic_load_explicit(&s_rate, memory_order_relaxed);
+}
+
+double playback_clock_at(double time) {
+    unsigned int sequence;
+    double anchor_time, anchor_pos, rate;
+    bool is_running;
+
+    do {
+        sequence = atomic_load_explicit(&s_sequence, memory_order_acquire);
+        anchor_time = atomic_load_explicit(&s_anchor_time, memory_order_relaxed);
+        anchor_pos = atomic_load_explicit(&s_anchor_pos, memory_order_relaxed);
+        is_running = atomic_load_explicit(&s_is_running, memory_order_relaxed);
+        rate = atomic_load_explicit(&s_rate, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((sequence & 1) || sequence != atomic_load_explicit(&s_sequence, memory_order_relaxed));
+
+    if (!is_running)
+        return anchor_pos;
+    return anchor_pos + (time - anchor_time) * rate;
+}
+
+double playback_clock_now() {
+    return playback_clock_at(timer_now());
+}
+
+bool playback_clock_is_running() {
+    return atomic_load_explicit(&s_is_running, memory_order_relaxed);
+}
+
+void _publish(double time, double pos, bool is_running, double rate) {
+    atomic_fetch_add_explicit(&s_sequence, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&s_anchor_time, time, memory_order_relaxed);
+    atomic_store_explicit(&s_anchor_pos, pos, memory_order_relaxed);
+    atomic_store_explicit(&s_is_running, is_running, memory_order_relaxed);
+    atomic_store_explicit(&s_rate, rate, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s_sequence, 1, memory_order_release);
+}
@@ -0,0 +1,32 @@
+#ifndef PLAYBACK_CLOCK_H
+#define PLAYBACK_CLOCK_H
+
+#include <defines.h>
+
+#ifndef PLAYBACK_CLOCK_SNAP_THRESHOLD
+#define PLAYBACK_CLOCK_SNAP_THRESHOLD 0.05
+#endif
+
+#ifndef PLAYBACK_CLOCK_CORRECTION
+#define PLAYBACK_CLOCK_CORRECTION 0.1
+#endif
+
+
+// The music position reported by the audio backend only advances once per audio period,
+// so it is smoothed into a continuous clock anchored on timer_now(). Errors larger than
+// PLAYBACK_CLOCK_SNAP_THRESHOLD (seeks) are applied immediately.
+// Only one thread may sync the clock, reading it is safe from any thread.
+double playback_clock_sync(double playback_pos, bool is_running);
+
+// Playback seconds per real second. The clock is re-anchored, so the position does not jump.
+// Called from the thread that syncs the clock.
+void playback_clock_set_rate(double rate);
+double playback_clock_rate();
+
+// Converts a timer_now() timestamp into a playback position.
+double playback_clock_at(double time);
+double playback_clock_now();
+bool playback_clock_is_running();
+
+
+#endif
@@ -0,0 +1,260 @@
+#include <playfield.h>
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+
+static void _build_scroll(playfield_t* playfield);
+static void _build_chart(playfield_t* playfield);
+static int _compare_chart_quads(const void* a, const void* b);
+static void _build_notes(playfield_t* playfield, const gameplay_state_t* state, double pos);
+static void _build_keys(playfield_t* playfield, const gameplay_state_t* state, double pos);
+static void _push_note(playfield_t* playfield, int column_begin, float x, float y, float height);
+static void _push_quad(playfield_t* playfield, float x, float y, float width, float height, Color color);
+
+
+void playfield_init(playfield_t* playfield, const gameplay_t* gameplay, float width, float height) {
+    *playfield = (playfield_t){0};
+    playfield->gameplay = gameplay;
+    playfield->column_count = kv_size(gameplay->columns);
+    playfield->width = width;
+    playfield->height = height;
+    playfield->line_y = height * 0.9f;
+    playfield->column_x = 10;
+    playfield->column_width = (width - 20) / playfield->column_count;
+    playfield->note_height = 10;
+    playfield->scroll_speed = height;
+    playfield->build_notes = true;
+    playfield->merge_notes = true;
+    kv_init(playfield->scroll);
+    for (int i = 0; i < INPUT_MAX_COLUMNS; i++)
+        kv_init(playfield->distances[i]);
+    kv_init(playfield->chart);
+    kv_init(playfield->chart_reach);
+    kv_init(playfield->quads);
+
+    _build_scroll(playfield);
+    _build_chart(playfield);
+}
+
+void playfield_destroy(playfield_t* playfield) {
+    kv_destroy(playfield->scroll);
+    for (int i = 0; i < INPUT_MAX_COLUMNS; i++)
+        kv_destroy(playfield->distances[i]);
+    kv_destroy(playfield->chart);
+    kv_destroy(playfield->chart_reach);
+    kv_destroy(playfield->quads);
+    *playfield = (playfield_t){0};
+}
+
+void playfield_build(playfield_t* playfield, const gameplay_state_t* state, double pos) {
+    playfield->quads.n = 0;
+
+    _push_quad(playfield, 0, playfield->line_y, playfield->width, 1, LIGHTGRAY);
+    playfield->notes_begin = kv_size(playfield->quads);
+    if (playfield->build_notes)
+        _build_notes(playfield, state, pos);
+    playfield->notes_end = kv_size(playfield->quads);
+    _build_keys(playfield, state, pos);
+}
+
+double playfield_distance(const playfield_t* playfield, double time) {
+    // last speed change at or before time
+    int lo = 0, hi = kv_size(playfield->scroll);
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (kv_A(playfield->scroll, mid).time <= time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0)
+        return time;
+    const playfield_scroll_t* scroll = &kv_A(playfield->scroll, lo - 1);
+    return scroll->distance + (time - scroll->time) * scroll->multiplier;
+}
+
+void playfield_chart_range(const playfield_t* playfield, double distance, int* first, int* count) {
+    float below = (playfield->height - playfield->line_y) / playfield->scroll_speed;
+    float above = playfield->line_y / playfield->scroll_speed;
+
+    // everything before first ends below the screen
+    int lo = 0, hi = kv_size(playfield->chart_reach);
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (kv_A(playfield->chart_reach, mid) < distance - below)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *first = lo;
+
+    // everything from the end on starts above the screen
+    hi = kv_size(playfield->chart);
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (kv_A(playfield->chart, mid).bottom <= distance + above)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *count = lo - *first;
+}
+
+void _build_scroll(playfield_t* playfield) {
+    const beatmap_t* beatmap = playfield->gameplay->beatmap;
+    double time = 0;
+    double distance = 0;
+    float multiplier = 1;
+
+    for (int i = 0; i < kv_size(beatmap->timing_points); i++) {
+        beatmap_timing_point_t* tm = &kv_A(beatmap->timing_points, i);
+        double start = tm->time_start / 1000.0;
+
+        // red lines reset the speed, green lines set it relative to the base SV
+        float next = (tm->is_uninherited) ? 1 : -100.0f / tm->length;
+        next = CONSTRAIN(next, PLAYFIELD_MIN_SV, PLAYFIELD_MAX_SV);
+
+        distance += (max(start, time) - time) * multiplier;
+        time = max(start, time);
+        multiplier = next;
+
+        playfield_scroll_t scroll = { time, distance, multiplier };
+        kv_push(playfield_scroll_t, playfield->scroll, scroll);
+    }
+}
+
+void _build_chart(playfield_t* playfield) {
+    const gameplay_t* gameplay = playfield->gameplay;
+
+    for (int ci = 0; ci < playfield->column_count; ci++) {
+        column_t* col = &kv_A(gameplay->columns, ci);
+        float x = playfield->column_x + playfield->column_width * ci;
+
+        for (int i = 0; i < kv_size(*col); i++)
+            kv_push(float, playfield->distances[ci], playfield_distance(playfield, kv_A(*col, i).time));
+
+        for (int i = 0; i < kv_size(*col); i++) {
+            note_event_t* event = &kv_A(*col, i);
+            float distance = kv_A(playfield->distances[ci], i);
+
+            if (event->type == NOTE_CLICK) {
+                playfield_chart_quad_t quad = {
+                    x, playfield->column_width,
+                    distance, distance, 0, -playfield->note_height,
+                    ci, i, -1, RED
+                };
+                kv_push(playfield_chart_quad_t, playfield->chart, quad);
+            }
+            else if (event->type == NOTE_HOLD_START && i + 1 < kv_size(*col)) {
+                playfield_chart_quad_t quad = {
+                    x, playfield->column_width,
+                    distance, kv_A(playfield->distances[ci], i + 1), 0, 0,
+                    ci, i + 1, i, RED
+                };
+                kv_push(playfield_chart_quad_t, playfield->chart, quad);
+            }
+        }
+    }
+
+    qsort(playfield->chart.a, kv_size(playfield->chart), sizeof(playfield_chart_quad_t), _compare_chart_quads);
+
+    float reach = -INFINITY;
+    for (int i = 0; i < kv_size(playfield->chart); i++) {
+        reach = max(reach, kv_A(playfield->chart, i).top);
+        kv_push(float, playfield->chart_reach, reach);
+    }
+}
+
+int _compare_chart_quads(const void* a, const void* b) {
+    float da = ((const playfield_chart_quad_t*)a)->bottom;
+    float db = ((const playfield_chart_quad_t*)b)->bottom;
+    return (da > db) - (da < db);
+}
+
+void _build_notes(playfield_t* playfield, const gameplay_state_t* state, double pos) {
+    const gameplay_t* gameplay = playfield->gameplay;
+    float line_y = playfield->line_y;
+    float speed = playfield->scroll_speed;
+    double scroll = playfield_distance(playfield, pos);
+    double view = scroll + line_y / speed;
+
+    for (int ci = 0; ci < playfield->column_count; ci++) {
+        column_t* col = &kv_A(gameplay->columns, ci);
+        float* distances = playfield->distances[ci].a;
+        float x = playfield->column_x + playfield->column_width * ci;
+
+        int column_begin = kv_size(playfield->quads);
+
+        for (int i = state->cursors[ci] + 1; i < kv_size(*col); i++) {
+            note_event_t* event = &kv_A(*col, i);
+
+            if (i > state->cursors[ci] + 1 && distances[i] >= view)
+                break;
+
+            float y = line_y + (scroll - distances[i]) * speed;
+
+            if (event->type == NOTE_CLICK) {
+                _push_note(playfield, column_begin, x, y - playfield->note_height, playfield->note_height);
+            }
+            else if (event->type == NOTE_HOLD_START && i + 1 < kv_size(*col)) {
+                float end_y = line_y + (scroll - distances[i + 1]) * speed;
+                _push_note(playfield, column_begin, x, end_y, y - end_y);
+            }
+            else if (event->type == NOTE_HOLD_END && i == state->cursors[ci] + 1) {
+                // the head was already hit, the body is cut off at the judgement line
+                _push_note(playfield, column_begin, x, y, line_y - y);
+            }
+        }
+    }
+}
+
+void _build_keys(playfield_t* playfield, const gameplay_state_t* state, double pos) {
+    for (int i = 0; i < playfield->column_count; i++) {
+        float opacity = (state->held[i]) ? 1 : 1 - CONSTRAIN((pos - state->hit_anims[i]) / 0.2f, 0, 1);
+        if (opacity <= 0)
+            continue;
+
+        _push_quad(
+            playfield,
+            playfield->column_x + playfield->column_width * i,
+            playfield->line_y,
+            playfield->column_width,
+            playfield->height * 0.2f,
+            Fade(BLACK, 0.75f * opacity)
+        );
+    }
+}
+
+void _push_note(playfield_t* playfield, int column_begin, float x, float y, float height) {
+    if (height <= 0)
+        return;
+
+    if (playfield->merge_notes && kv_size(playfield->quads) > column_begin) {
+        // notes of a column are pushed bottom to top, so only the last span can overlap
+        playfield_quad_t* last = &kv_A(playfield->quads, kv_size(playfield->quads) - 1);
+        float top = min(last->y, y);
+        float bottom = max(last->y + last->height, y + height);
+        float gap = max(last->y, y) - min(last->y + last->height, y + height);
+        float tolerance = (max(last->y, y) > playfield->line_y - PLAYFIELD_LOD_LINE_MARGIN) ? 0 : PLAYFIELD_LOD_GAP;
+
+        if (gap <= tolerance) {
+            last->y = top;
+            last->height = bottom - top;
+            return;
+        }
+    }
+
+    _push_quad(playfield, x, y, playfield->column_width, height, RED);
+}
+
+void _push_quad(playfield_t* playfield, float x, float y, float width, float height, Color color) {
+    assert(width >= 0);
+    if (height <= 0)
+        return;
+
+    playfield_quad_t quad = { x, y, width, height, color };
+    kv_push(playfield_quad_t, playfield->quads, quad);
+}
@@ -0,0 +1,93 @@
+#ifndef PLAYFIELD_H
+#define PLAYFIELD_H
+
+#include <kvec.h>
+#include <raylib.h>
+
+#include <defines.h>
+#include <gameplay.h>
+
+// Scroll speed multipliers of inherited timing points are clamped to this range
+#define PLAYFIELD_MIN_SV 0.01f
+#define PLAYFIELD_MAX_SV 10.0f
+
+// Note quads of a column closer than this many pixels are merged into one span
+#ifndef PLAYFIELD_LOD_GAP
+#define PLAYFIELD_LOD_GAP 1.0f
+#endif
+
+// Around the judgement line only quads that actually touch are merged, so it stays exact
+#ifndef PLAYFIELD_LOD_LINE_MARGIN
+#define PLAYFIELD_LOD_LINE_MARGIN 16.0f
+#endif
+
+
+// Everything on the playfield is an axis aligned rectangle, so a frame is a list of quads
+// that any backend can draw without knowing about notes.
+typedef struct playfield_quad_s {
+    float   x;
+    float   y;
+    float   width;
+    float   height;
+    Color   color;
+} playfield_quad_t;
+
+// A note of the whole chart positioned in scroll distance instead of pixels, so it can be
+// laid out once and scrolled by the backend. Edges are at line_y + (scroll - distance) * speed + offset.
+typedef struct playfield_chart_quad_s {
+    float   x;
+    float   width;
+    float   bottom;
+    float   top;
+    float   bottom_offset;
+    float   top_offset;
+    int     column;
+    int     hide_after;     // hidden once the column cursor reaches this event
+    int     clamp_after;    // bottom edge stops at the judgement line from this event on, -1 never
+    Color   color;
+} playfield_chart_quad_t;
+
+typedef struct playfield_scroll_s {
+    double  time;
+    double  distance;
+    float   multiplier;
+} playfield_scroll_t;
+
+typedef struct playfield_s {
+    const gameplay_t*               gameplay;
+    int                             column_count;
+    float                           width;
+    float                           height;
+    float                           line_y;
+    float                           column_x;
+    float                           column_width;
+    float                           note_height;
+    float                           scroll_speed;   // pixels per unit of scroll distance
+    bool                            build_notes;    // off when the backend draws the chart itself
+    bool                            merge_notes;    // level of detail pass over dense regions
+
+    kvec_t(playfield_scroll_t)      scroll;
+    kvec_t(float)                   distances[INPUT_MAX_COLUMNS];   // per note event of a column
+    kvec_t(playfield_chart_quad_t)  chart;          // sorted by bottom
+    kvec_t(float)                   chart_reach;    // highest top of the chart up to each quad
+
+    kvec_t(playfield_quad_t)        quads;
+    int                             notes_begin;    // quads of notes, everything before is below them
+    int                             notes_end;
+} playfield_t;
+
+
+void playfield_init(playfield_t* playfield, const gameplay_t* gameplay, float width, float height);
+void playfield_destroy(playfield_t* playfield);
+
+// Rebuilds the quad list for the given state, back to front.
+void playfield_build(playfield_t* playfield, const gameplay_state_t* state, double pos);
+
+// Scroll distance covered from the start of the song, with the speed changes of the beatmap.
+double playfield_distance(const playfield_t* playfield, double time);
+
+// Range of chart quads that can be on screen at the given scroll distance.
+void playfield_chart_range(const playfield_t* playfield, double distance, int* first, int* count);
+
+
+#endif
@@ -0,0 +1,388 @@
+#include <playfield_gl.h>
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <raylib.h>
+#include <raymath.h>
+#include <rlgl.h>
+
+#define SCOPE_NAME "playfield gl"
+#include <logging.h>
+
+
+typedef struct vertex_s {
+    float           x;
+    float           y;
+    unsigned char   color[4];
+} vertex_t;
+
+typedef struct chart_vertex_s {
+    float           x;
+    float           distance;
+    float           offset;
+    float           column;
+    float           hide_after;
+    float           clamp_after;
+    unsigned char   color[4];
+} chart_vertex_t;
+
+static const char* s_mode_names[] = {
+    "dynamic",
+    "static",
+};
+
+static const char* s_vertex_shader =
+    "#version 330\n"
+    "in vec2 vertexPosition;\n"
+    "in vec4 vertexColor;\n"
+    "uniform mat4 mvp;\n"
+    "out vec4 fragColor;\n"
+    "void main() {\n"
+    "    fragColor = vertexColor;\n"
+    "    gl_Position = mvp * vec4(vertexPosition, 0.0, 1.0);\n"
+    "}\n";
+
+static const char* s_chart_vertex_shader =
+    "#version 330\n"
+    "in vec3 vertexPosition;\n"     // x, scroll distance, pixel offset
+    "in vec3 vertexState;\n"        // column, hide after, clamp after
+    "in vec4 vertexColor;\n"
+    "uniform mat4 mvp;\n"
+    "uniform float scroll;\n"
+    "uniform float scrollSpeed;\n"
+    "uniform float lineY;\n"
+    "uniform int cursors[9];\n"
+    "out vec4 fragColor;\n"
+    "void main() {\n"
+    "    float cursor = float(cursors[int(vertexState.x)]);\n"
+    "    float y = lineY + (scroll - vertexPosition.y) * scrollSpeed + vertexPosition.z;\n"
+    "    if (vertexState.z >= 0.0 && cursor >= vertexState.z)\n"
+    "        y = min(y, lineY);\n"
+    "    fragColor = vertexColor;\n"
+    "    gl_Position = mvp * vec4(vertexPosition.x, y, 0.0, 1.0);\n"
+    "    if (cursor >= vertexState.y)\n"
+    "        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);\n"
+    "}\n";
+
+static const char* s_fragment_shader =
+    "#version 330\n"
+    "in vec4 fragColor;\n"
+    "out vec4 finalColor;\n"
+    "void main() {\n"
+    "    finalColor = fragColor;\n"
+    "}\n";
+
+static bool                 s_initialized = false;
+static bool                 s_is_batched = false;
+static playfield_gl_mode_t  s_mode = PLAYFIELD_GL_DYNAMIC;
+static unsigned int         s_shader = 0;
+static int                  s_mvp_loc = -1;
+static unsigned int         s_vaos[PLAYFIELD_GL_BUFFER_COUNT];
+static unsigned int         s_vbos[PLAYFIELD_GL_BUFFER_COUNT];
+static unsigned int         s_ibo = 0;
+static int                  s_buffer_i = 0;
+static vertex_t*            s_vertices = NULL;
+
+static unsigned int         s_chart_shader = 0;
+static int                  s_chart_locs[5];
+static unsigned int         s_chart_vao = 0;
+static unsigned int         s_chart_vbo = 0;
+
+static playfield_gl_stats_t s_stats;
+
+static bool _load_buffers();
+static bool _load_chart(const playfield_t* playfield);
+static void _unload_shader(unsigned int shader);
+static void _upload(const playfield_quad_t* quads, int count);
+static void _draw_range(int first, int count);
+static void _draw_chart(const playfield_t* playfield, const gameplay_state_t* state, double pos);
+static void _draw_immediate(const playfield_quad_t* quads, int count);
+
+
+bool playfield_gl_init(playfield_t* playfield, playfield_gl_mode_t mode) {
+    assert(!s_initialized);
+
+    s_vertices = malloc(sizeof(vertex_t) * 4 * PLAYFIELD_GL_MAX_QUADS);
+    if (!s_vertices) {
+        LOG("Failed to allocate vertex storage");
+        return false;
+    }
+
+    s_shader = rlLoadShaderCode(s_vertex_shader, s_fragment_shader);
+    s_is_batched = s_shader != 0 && _load_buffers();
+    if (!s_is_batched)
+        LOG("Batched rendering is unavailable, falling back to immediate mode");
+
+    s_mode = PLAYFIELD_GL_DYNAMIC;
+    if (mode == PLAYFIELD_GL_STATIC) {
+        if (s_is_batched && _load_chart(playfield))
+            s_mode = PLAYFIELD_GL_STATIC;
+        else
+            LOG("Static chart is unavailable, notes are laid out every frame");
+    }
+    playfield->build_notes = s_mode != PLAYFIELD_GL_STATIC;
+    LOGF("%s mode", s_mode_names[s_mode]);
+
+    s_stats = (playfield_gl_stats_t){0};
+    s_initialized = true;
+    return true;
+}
+
+void playfield_gl_destroy() {
+    if (!s_initialized)
+        return;
+
+    for (int i = 0; i < PLAYFIELD_GL_BUFFER_COUNT; i++) {
+        if (s_vaos[i])
+            rlUnloadVertexArray(s_vaos[i]);
+        if (s_vbos[i])
+            rlUnloadVertexBuffer(s_vbos[i]);
+        s_vaos[i] = s_vbos[i] = 0;
+    }
+    if (s_ibo)
+        rlUnloadVertexBuffer(s_ibo);
+    if (s_chart_vao)
+        rlUnloadVertexArray(s_chart_vao);
+    if (s_chart_vbo)
+        rlUnloadVertexBuffer(s_chart_vbo);
+    _unload_shader(s_shader);
+    _unload_shader(s_chart_shader);
+    SAFE_DELETE(s_vertices);
+
+    s_ibo = s_shader = s_chart_vao = s_chart_vbo = s_chart_shader = 0;
+    s_initialized = false;
+}
+
+bool playfield_gl_mode_from_name(const char* name, playfield_gl_mode_t* mode) {
+    for (int i = 0; i < STACKARRAY_SIZE(s_mode_names); i++) {
+        if (strcmp(name, s_mode_names[i]) == 0) {
+            *mode = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void playfield_gl_draw(const playfield_t* playfield, const gameplay_state_t* state, double pos) {
+    assert(s_initialized);
+
+    const playfield_quad_t* quads = playfield->quads.a;
+    int count = kv_size(playfield->quads);
+    s_stats = (playfield_gl_stats_t){0};
+
+    if (!s_is_batched) {
+        _draw_immediate(quads, count);
+        return;
+    }
+
+    // whatever raylib batched so far has to land below the playfield
+    rlDrawRenderBatchActive();
+
+    if (s_mode == PLAYFIELD_GL_STATIC) {
+        _upload(quads, count);
+        _draw_range(0, playfield->notes_begin);
+        _draw_chart(playfield, state, pos);
+        _draw_range(playfield->notes_end, count - playfield->notes_end);
+        return;
+    }
+
+    for (int i = 0; i < count; i += PLAYFIELD_GL_MAX_QUADS) {
+        _upload(&quads[i], min(count - i, PLAYFIELD_GL_MAX_QUADS));
+        _draw_range(0, min(count - i, PLAYFIELD_GL_MAX_QUADS));
+    }
+}
+
+playfield_gl_stats_t playfield_gl_stats() {
+    return s_stats;
+}
+
+bool _load_buffers() {
+    s_mvp_loc = rlGetLocationUniform(s_shader, "mvp");
+    int position_loc = rlGetLocationAttrib(s_shader, "vertexPosition");
+    int color_loc = rlGetLocationAttrib(s_shader, "vertexColor");
+    if (s_mvp_loc < 0 || position_loc < 0 || color_loc < 0)
+        return false;
+
+    // quads never change their topology, so the index buffer is filled once
+    unsigned short* indices = malloc(sizeof(unsigned short) * 6 * PLAYFIELD_GL_MAX_QUADS);
+    if (!indices)
+        return false;
+    for (int i = 0; i < PLAYFIELD_GL_MAX_QUADS; i++) {
+        unsigned short* quad = &indices[i * 6];
+        quad[0] = i * 4 + 0;
+        quad[1] = i * 4 + 1;
+        quad[2] = i * 4 + 2;
+        quad[3] = i * 4 + 0;
+        quad[4] = i * 4 + 2;
+        quad[5] = i * 4 + 3;
+    }
+
+    bool ok = true;
+    for (int i = 0; i < PLAYFIELD_GL_BUFFER_COUNT && ok; i++) {
+        s_vaos[i] = rlLoadVertexArray();
+        if (!s_vaos[i]) {
+            ok = false;
+            break;
+        }
+
+        rlEnableVertexArray(s_vaos[i]);
+        s_vbos[i] = rlLoadVertexBuffer(NULL, sizeof(vertex_t) * 4 * PLAYFIELD_GL_MAX_QUADS, true);
+        rlSetVertexAttribute(position_loc, 2, RL_FLOAT, false, sizeof(vertex_t), (void*)offsetof(vertex_t, x));
+        rlEnableVertexAttribute(position_loc);
+        rlSetVertexAttribute(color_loc, 4, RL_UNSIGNED_BYTE, true, sizeof(vertex_t), (void*)offsetof(vertex_t, color));
+        rlEnableVertexAttribute(color_loc);
+
+        // the element buffer binding is part of the vertex array state
+        if (!s_ibo)
+            s_ibo = rlLoadVertexBufferElement(indices, sizeof(unsigned short) * 6 * PLAYFIELD_GL_MAX_QUADS, false);
+        else
+            rlEnableVertexBufferElement(s_ibo);
+        rlDisableVertexArray();
+    }
+
+    free(indices);
+    return ok;
+}
+
+bool _load_chart(const playfield_t* playfield) {
+    s_chart_shader = rlLoadShaderCode(s_chart_vertex_shader, s_fragment_shader);
+    if (!s_chart_shader)
+        return false;
+
+    s_chart_locs[0] = rlGetLocationUniform(s_chart_shader, "mvp");
+    s_chart_locs[1] = rlGetLocationUniform(s_chart_shader, "scroll");
+    s_chart_locs[2] = rlGetLocationUniform(s_chart_shader, "scrollSpeed");
+    s_chart_locs[3] = rlGetLocationUniform(s_chart_shader, "lineY");
+    s_chart_locs[4] = rlGetLocationUniform(s_chart_shader, "cursors");
+    int position_loc = rlGetLocationAttrib(s_chart_shader, "vertexPosition");
+    int state_loc = rlGetLocationAttrib(s_chart_shader, "vertexState");
+    int color_loc = rlGetLocationAttrib(s_chart_shader, "vertexColor");
+    for (int i = 0; i < STACKARRAY_SIZE(s_chart_locs); i++)
+        if (s_chart_locs[i] < 0)
+            return false;
+    if (position_loc < 0 || state_loc < 0 || color_loc < 0)
+        return false;
+
+    // six vertices per note instead of an index buffer, a long chart doesn't fit 16-bit indices
+    int count = kv_size(playfield->chart);
+    chart_vertex_t* vertices = malloc(sizeof(chart_vertex_t) * 6 * max(count, 1));
+    if (!vertices)
+        return false;
+
+    for (int i = 0; i < count; i++) {
+        const playfield_chart_quad_t* q = &kv_A(playfield->chart, i);
+        chart_vertex_t corners[4];
+        for (int c = 0; c < 4; c++) {
+            bool is_top = c == 0 || c == 3;
+            bool is_right = c >= 2;
+            corners[c] = (chart_vertex_t){
+                q->x + (is_right ? q->width : 0),
+                is_top ? q->top : q->bottom,
+                is_top ? q->top_offset : q->bottom_offset,
+                q->column,
+                q->hide_after,
+                q->clamp_after,
+                { q->color.r, q->color.g, q->color.b, q->color.a }
+            };
+        }
+
+        chart_vertex_t* v = &vertices[i * 6];
+        v[0] = corners[0];
+        v[1] = corners[1];
+        v[2] = corners[2];
+        v[3] = corners[0];
+        v[4] = corners[2];
+        v[5] = corners[3];
+    }
+
+    s_chart_vao = rlLoadVertexArray();
+    if (s_chart_vao) {
+        rlEnableVertexArray(s_chart_vao);
+        s_chart_vbo = rlLoadVertexBuffer(vertices, sizeof(chart_vertex_t) * 6 * max(count, 1), false);
+        rlSetVertexAttribute(position_loc, 3, RL_FLOAT, false, sizeof(chart_vertex_t), (void*)offsetof(chart_vertex_t, x));
+        rlEnableVertexAttribute(position_loc);
+        rlSetVertexAttribute(state_loc, 3, RL_FLOAT, false, sizeof(chart_vertex_t), (void*)offsetof(chart_vertex_t, column));
+        rlEnableVertexAttribute(state_loc);
+        rlSetVertexAttribute(color_loc, 4, RL_UNSIGNED_BYTE, true, sizeof(chart_vertex_t), (void*)offsetof(chart_vertex_t, color));
+        rlEnableVertexAttribute(color_loc);
+        rlDisableVertexArray();
+    }
+
+    free(vertices);
+    if (s_chart_vao)
+        LOGF("uploaded %d notes (%.1f KiB)", count, sizeof(chart_vertex_t) * 6 * count / 1024.0f);
+    return s_chart_vao != 0;
+}
+
+void _unload_shader(unsigned int shader) {
+    if (shader && shader != rlGetShaderIdDefault())
+        rlUnloadShaderProgram(shader);
+}
+
+void _upload(const playfield_quad_t* quads, int count) {
+    assert(count <= PLAYFIELD_GL_MAX_QUADS);
+
+    for (int i = 0; i < count; i++) {
+        const playfield_quad_t* q = &quads[i];
+        vertex_t* v = &s_vertices[i * 4];
+        float x1 = q->x + q->width;
+        float y1 = q->y + q->height;
+
+        v[0] = (vertex_t){ q->x, q->y, { q->color.r, q->color.g, q->color.b, q->color.a } };
+        v[1] = (vertex_t){ q->x, y1,   { q->color.r, q->color.g, q->color.b, q->color.a } };
+        v[2] = (vertex_t){ x1,   y1,   { q->color.r, q->color.g, q->color.b, q->color.a } };
+        v[3] = (vertex_t){ x1,   q->y, { q->color.r, q->color.g, q->color.b, q->color.a } };
+    }
+
+    s_buffer_i = (s_buffer_i + 1) % PLAYFIELD_GL_BUFFER_COUNT;
+    if (count > 0)
+        rlUpdateVertexBuffer(s_vbos[s_buffer_i], s_vertices, sizeof(vertex_t) * 4 * count, 0);
+}
+
+void _draw_range(int first, int count) {
+    if (count <= 0)
+        return;
+
+    rlEnableShader(s_shader);
+    rlSetUniformMatrix(s_mvp_loc, MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection()));
+    rlEnableVertexArray(s_vaos[s_buffer_i]);
+    rlDrawVertexArrayElements(first * 6, count * 6, 0);
+    rlDisableVertexArray();
+    rlDisableShader();
+
+    s_stats.draw_calls++;
+    s_stats.vertices += count * 4;
+}
+
+void _draw_chart(const playfield_t* playfield, const gameplay_state_t* state, double pos) {
+    double scroll = playfield_distance(playfield, pos);
+    int first, count;
+    playfield_chart_range(playfield, scroll, &first, &count);
+    if (count <= 0)
+        return;
+
+    float scroll_f = scroll;
+    rlEnableShader(s_chart_shader);
+    rlSetUniformMatrix(s_chart_locs[0], MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection()));
+    rlSetUniform(s_chart_locs[1], &scroll_f, RL_SHADER_UNIFORM_FLOAT, 1);
+    rlSetUniform(s_chart_locs[2], &playfield->scroll_speed, RL_SHADER_UNIFORM_FLOAT, 1);
+    rlSetUniform(s_chart_locs[3], &playfield->line_y, RL_SHADER_UNIFORM_FLOAT, 1);
+    rlSetUniform(s_chart_locs[4], state->cursors, RL_SHADER_UNIFORM_INT, INPUT_MAX_COLUMNS);
+    rlEnableVertexArray(s_chart_vao);
+    rlDrawVertexArray(first * 6, count * 6);
+    rlDisableVertexArray();
+    rlDisableShader();
+
+    s_stats.draw_calls++;
+    s_stats.vertices += count * 6;
+}
+
+void _draw_immediate(const playfield_quad_t* quads, int count) {
+    for (int i = 0; i < count; i++)
+        DrawRectangleRec((Rectangle) { quads[i].x, quads[i].y, quads[i].width, quads[i].height }, quads[i].color);
+
+    // raylib's batch flushes every RL_DEFAULT_BATCH_BUFFER_ELEMENTS quads
+    s_stats.draw_calls += 1 + count / RL_DEFAULT_BATCH_BUFFER_ELEMENTS;
+    s_stats.vertices += count * 4;
+}
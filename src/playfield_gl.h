@@ -0,0 +1,38 @@
+#ifndef PLAYFIELD_GL_H
+#define PLAYFIELD_GL_H
+
+#include <defines.h>
+#include <playfield.h>
+
+// Quads that fit into one draw call, limited by 16-bit indices
+#define PLAYFIELD_GL_MAX_QUADS (65536 / 4)
+
+// Vertex buffers cycled through, so the one being written was never used by the last frames
+#ifndef PLAYFIELD_GL_BUFFER_COUNT
+#define PLAYFIELD_GL_BUFFER_COUNT 3
+#endif
+
+
+typedef enum {
+    PLAYFIELD_GL_DYNAMIC,   // notes are laid out on the CPU every frame
+    PLAYFIELD_GL_STATIC,    // the chart is uploaded once and scrolled by the shader
+} playfield_gl_mode_t;
+
+typedef struct playfield_gl_stats_s {
+    int draw_calls;
+    int vertices;
+} playfield_gl_stats_t;
+
+
+// Must be called on the render thread after the window was created. In static mode the
+// playfield stops building note quads, the chart is drawn from GPU memory instead.
+bool playfield_gl_init(playfield_t* playfield, playfield_gl_mode_t mode);
+void playfield_gl_destroy();
+bool playfield_gl_mode_from_name(const char* name, playfield_gl_mode_t* mode);
+
+// Draws the quads of the last playfield_build(), with a single draw call per layer.
+void playfield_gl_draw(const playfield_t* playfield, const gameplay_state_t* state, double pos);
+playfield_gl_stats_t playfield_gl_stats();
+
+
+#endif
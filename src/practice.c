@@ -0,0 +1,125 @@
+#include <practice.h>
+
+#include <string.h>
+
+#include <input.h>
+#include <music.h>
+#define SCOPE_NAME "practice"
+#include <logging.h>
+
+
+static void _restore(practice_t* practice, gameplay_t* gameplay);
+static void _record_pass(practice_t* practice, const gameplay_state_t* state);
+static void _log_summary(const practice_t* practice);
+
+
+void practice_init(practice_t* practice) {
+    *practice = (practice_t){0};
+    practice->start = -1;
+    kv_init(practice->passes);
+}
+
+void practice_destroy(practice_t* practice) {
+    _log_summary(practice);
+    kv_destroy(practice->passes);
+    kv_init(practice->passes);
+}
+
+void practice_mark_start(practice_t* practice, const gameplay_t* gameplay) {
+    if (practice->is_looping)
+        practice_clear(practice);
+
+    practice->start = gameplay->state.time;
+    practice->snapshot = gameplay->state;
+    LOGF("A at %.3f s", practice->start);
+}
+
+bool practice_mark_end(practice_t* practice, gameplay_t* gameplay) {
+    if (practice->start < 0 || practice->is_looping) {
+        LOG("Mark A before B");
+        return false;
+    }
+
+    double end = gameplay->state.time;
+    if (!music_set_loop(practice->start, end))
+        return false;
+
+    practice->end = end;
+    practice->is_looping = true;
+    kv_size(practice->passes) = 0;
+    _restore(practice, gameplay);
+    return true;
+}
+
+void practice_clear(practice_t* practice) {
+    if (practice->is_looping) {
+        music_clear_loop();
+        _log_summary(practice);
+    }
+    practice->start = -1;
+    practice->is_looping = false;
+    kv_size(practice->passes) = 0;
+}
+
+bool practice_update(practice_t* practice, gameplay_t* gameplay, unsigned int pass) {
+    if (pass == practice->pass)
+        return false;
+    practice->pass = pass;
+    if (!practice->is_looping)
+        return false;
+
+    // the pass ends where the loop does, inputs up to there still count
+    if (gameplay->state.time < practice->end)
+        gameplay_update(gameplay, practice->end);
+    _record_pass(practice, &gameplay->state);
+    _restore(practice, gameplay);
+    return true;
+}
+
+void _restore(practice_t* practice, gameplay_t* gameplay) {
+    // events stamped past the end before the clock caught up with the wrap belong to no pass,
+    // they only tell which keys are down
+    input_event_t input;
+    while (input_peek(&input) && input.time >= gameplay->state.time) {
+        input_pop(&input);
+        gameplay->state.held[input.column] = input.is_pressed;
+    }
+
+    gameplay_state_t state = practice->snapshot;
+    if (!gameplay->autoplay)
+        memcpy(state.held, gameplay->state.held, sizeof(state.held));
+    gameplay->state = state;
+    gameplay->previous = state;
+}
+
+void _record_pass(practice_t* practice, const gameplay_state_t* state) {
+    gameplay_state_t delta = {0};
+    for (int j = 0; j < JUDGEMENT_COUNT; j++)
+        delta.judgements[j] = state->judgements[j] - practice->snapshot.judgements[j];
+    delta.judged_count = state->judged_count - practice->snapshot.judged_count;
+
+    practice_pass_t result = { .judged_count = delta.judged_count, .accuracy = gameplay_accuracy(&delta) };
+    memcpy(result.judgements, delta.judgements, sizeof(result.judgements));
+    kv_push(practice_pass_t, practice->passes, result);
+
+    LOGF(
+        "pass %d: %.2f%%, %d judged, %d misses",
+        (int)kv_size(practice->passes),
+        result.accuracy * 100,
+        result.judged_count,
+        result.judgements[JUDGEMENT_MISS]
+    );
+}
+
+void _log_summary(const practice_t* practice) {
+    int count = kv_size(practice->passes);
+    if (count == 0)
+        return;
+
+    float best = 0, sum = 0;
+    for (int i = 0; i < count; i++) {
+        best = max(best, kv_A(practice->passes, i).accuracy);
+        sum += kv_A(practice->passes, i).accuracy;
+    }
+    LOGF("%d passes, best %.2f%%, mean %.2f%%", count, best * 100, sum / count * 100);
+}
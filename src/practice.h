@@ -0,0 +1,42 @@
+#ifndef PRACTICE_H
+#define PRACTICE_H
+
+#include <kvec.h>
+
+#include <defines.h>
+#include <gameplay.h>
+
+
+typedef struct practice_pass_s {
+    int     judgements[JUDGEMENT_COUNT];
+    int     judged_count;
+    float   accuracy;
+} practice_pass_t;
+
+// A-B loop over a section of the song. The music wraps on its own in the audio callback,
+// the gameplay follows by going back to the state it had at A on every pass.
+typedef struct practice_s {
+    double                  start;          // A, negative while unmarked
+    double                  end;
+    bool                    is_looping;
+    gameplay_state_t        snapshot;       // gameplay state at A
+    unsigned int            pass;           // last music loop pass seen
+    kvec_t(practice_pass_t) passes;         // judgements of every finished pass of the loop
+} practice_t;
+
+
+void practice_init(practice_t* practice);
+void practice_destroy(practice_t* practice);
+
+// Marks A at the current gameplay position, any running loop is cleared.
+void practice_mark_start(practice_t* practice, const gameplay_t* gameplay);
+// Marks B at the current gameplay position and starts looping from A.
+bool practice_mark_end(practice_t* practice, gameplay_t* gameplay);
+void practice_clear(practice_t* practice);
+
+// Call with the pass music_time_played_pass() returned along with the position the clock was
+// synced to, before the gameplay is updated. Returns true when a new pass started at A.
+bool practice_update(practice_t* practice, gameplay_t* gameplay, unsigned int pass);
+
+
+#endif
@@ -0,0 +1,543 @@
+#include <preview.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <raylib.h>
+
+#include <decoder.h>
+#include <pcm_cache.h>
+#include <ring.h>
+#include <stretch.h>
+#include <timer.h>
+#define SCOPE_NAME "preview"
+#include <logging.h>
+
+
+// Decoded audio from the preview point of a song
+typedef struct head_s {
+    char            filepath[512];
+    double          time;           // as requested, the cache key
+    int             sample_rate;
+    float*          frames;         // NULL for a free slot
+    int             frame_count;
+    uint64_t        last_used;
+    atomic_int      refs;           // chunks, the worker and the audio callback using it
+} head_t;
+
+typedef struct request_s {
+    int             count;          // selection first, then the neighbours, 0 stops
+    char            filepaths[1 + PREVIEW_MAX_NEIGHBOURS][512];
+    double          times[1 + PREVIEW_MAX_NEIGHBOURS];
+} request_t;
+
+typedef struct chunk_s {
+    unsigned int    generation;
+    head_t*         head;           // (re)starts at the preview point, the samples follow it
+    int             count;
+    float           samples[PREVIEW_CHUNK_FRAMES * DECODER_CHANNELS];
+} chunk_t;
+
+static bool             s_is_ready = false;
+static char             s_cache_directory[512];
+static AudioStream      s_stream;
+static ring_t           s_ring;
+static pthread_t        s_thread;
+static atomic_bool      s_quit = false;
+
+// Selections bump the generation, the worker only holds the mutex to copy the request
+static pthread_mutex_t  s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static request_t        s_request;
+static atomic_uint      s_generation = 0;
+static _Atomic double   s_select_time = 0;
+
+// Only touched by the worker
+static head_t           s_heads[PREVIEW_CACHE_SIZE];
+static uint64_t         s_clock = 0;
+static decoder_t        s_decoder;
+static bool             s_is_open = false;
+static head_t*          s_current = NULL;       // head of the selection, referenced while open
+static uint64_t         s_loop_frame = 0;       // where the stream continues after the head
+
+// Only touched by the audio callback
+static unsigned int     s_pull_generation = 0;
+static bool             s_is_started = false;
+static chunk_t          s_chunk;
+static int              s_chunk_offset = 0;
+static bool             s_has_next = false;     // s_chunk belongs to a newer selection
+static head_t*          s_head = NULL;
+static int              s_head_offset = 0;
+static stretch_t        s_stretch;
+static bool             s_is_stretched = false;
+static int              s_fade_frame = 0;
+
+static atomic_int       s_selects = 0;
+static atomic_int       s_started = 0;
+static atomic_int       s_head_hits = 0;
+static atomic_int       s_head_misses = 0;
+static atomic_int       s_cancelled = 0;
+static _Atomic double   s_last_latency = 0;
+static _Atomic double   s_max_latency = 0;
+
+static void* _worker(void* arg);
+static void _start(const request_t* request, unsigned int generation);
+static void _fill(unsigned int generation);
+static void _prefetch(const char* filepath, double time, unsigned int generation);
+static void _close();
+static bool _open(decoder_t* decoder, const char* filepath, unsigned int generation);
+static bool _is_cancelled(unsigned int generation);
+static head_t* _find_head(const char* filepath, double time);
+static head_t* _decode_head(decoder_t* decoder, const char* filepath, double preview_time, unsigned int generation);
+static bool _push_head(head_t* head, unsigned int generation);
+static uint64_t _start_frame(const decoder_t* decoder, double time);
+static void _pull(void* buffer, unsigned int frames);
+static bool _begin();
+static bool _next_chunk();
+static int _read(void* user, float* frames, int count);
+static void _release(head_t* head);
+
+
+bool preview_init(const char* cache_directory) {
+    snprintf(s_cache_directory, STACKARRAY_SIZE(s_cache_directory), "%s", (cache_directory) ? cache_directory : "");
+
+    int capacity = max(2, (int)(PREVIEW_BUFFER * PREVIEW_SAMPLE_RATE / PREVIEW_CHUNK_FRAMES));
+    if (!ring_init(&s_ring, sizeof(chunk_t), capacity))
+        return false;
+    // resamples songs that are not at PREVIEW_SAMPLE_RATE, the rate is set per song
+    if (!stretch_init(&s_stretch, PREVIEW_SAMPLE_RATE, STRETCH_NIGHTCORE, 1, _read, NULL)) {
+        ring_destroy(&s_ring);
+        return false;
+    }
+
+    for (int i = 0; i < PREVIEW_CACHE_SIZE; i++)
+        s_heads[i] = (head_t){0};
+    s_request = (request_t){0};
+    s_clock = 0;
+    s_is_open = false;
+    s_current = NULL;
+    s_pull_generation = 0;
+    s_is_started = false;
+    s_chunk = (chunk_t){0};
+    s_chunk_offset = 0;
+    s_has_next = false;
+    s_head = NULL;
+    atomic_store(&s_quit, false);
+    atomic_store(&s_generation, 0);
+    atomic_store(&s_selects, 0);
+    atomic_store(&s_started, 0);
+    atomic_store(&s_head_hits, 0);
+    atomic_store(&s_head_misses, 0);
+    atomic_store(&s_cancelled, 0);
+    atomic_store(&s_last_latency, 0);
+    atomic_store(&s_max_latency, 0);
+
+    if (pthread_create(&s_thread, NULL, _worker, NULL) != 0) {
+        LOG("Failed to start the preview thread");
+        stretch_destroy(&s_stretch);
+        ring_destroy(&s_ring);
+        return false;
+    }
+
+    s_stream = LoadAudioStream(PREVIEW_SAMPLE_RATE, 32, DECODER_CHANNELS);
+    SetAudioStreamCallback(s_stream, _pull);
+    SetAudioStreamVolume(s_stream, PREVIEW_VOLUME);
+    PlayAudioStream(s_stream);
+    s_is_ready = true;
+    return true;
+}
+
+void preview_shutdown() {
+    if (!s_is_ready)
+        return;
+
+    UnloadAudioStream(s_stream);
+    atomic_store(&s_quit, true);
+    pthread_join(s_thread, NULL);
+
+    preview_stats_t stats = preview_stats();
+    LOGF(
+        "%d selections, %d started, %d from cached heads, %d loads cancelled, latency %.1f ms max",
+        stats.selects,
+        stats.started,
+        stats.head_hits,
+        stats.cancelled,
+        stats.max_latency * 1000
+    );
+
+    // the callback is gone, whatever it and the ring referenced can go too
+    chunk_t chunk;
+    while (ring_read(&s_ring, &chunk, 1))
+        _release(chunk.head);
+    for (int i = 0; i < PREVIEW_CACHE_SIZE; i++)
+        free(s_heads[i].frames);
+    s_head = NULL;
+    stretch_destroy(&s_stretch);
+    ring_destroy(&s_ring);
+    s_is_ready = false;
+}
+
+void preview_select(const preview_item_t* item, const preview_item_t* neighbours, int neighbour_count) {
+    pthread_mutex_lock(&s_mutex);
+    s_request.count = 1 + min(neighbour_count, PREVIEW_MAX_NEIGHBOURS);
+    for (int i = 0; i < s_request.count; i++) {
+        const preview_item_t* it = (i == 0) ? item : &neighbours[i - 1];
+        snprintf(s_request.filepaths[i], STACKARRAY_SIZE(s_request.filepaths[i]), "%s", it->audio_filepath);
+        s_request.times[i] = it->preview_time;
+    }
+    pthread_mutex_unlock(&s_mutex);
+
+    atomic_store(&s_select_time, timer_now());
+    atomic_fetch_add_explicit(&s_generation, 1, memory_order_release);
+    atomic_fetch_add_explicit(&s_selects, 1, memory_order_relaxed);
+}
+
+void preview_stop() {
+    pthread_mutex_lock(&s_mutex);
+    s_request.count = 0;
+    pthread_mutex_unlock(&s_mutex);
+    atomic_fetch_add_explicit(&s_generation, 1, memory_order_release);
+}
+
+preview_stats_t preview_stats() {
+    return (preview_stats_t) {
+        atomic_load(&s_selects),
+        atomic_load(&s_started),
+        atomic_load(&s_head_hits),
+        atomic_load(&s_head_misses),
+        atomic_load(&s_cancelled),
+        atomic_load(&s_last_latency),
+        atomic_load(&s_max_latency),
+    };
+}
+
+void* _worker(void* arg) {
+    // selections made before the thread got to run still count
+    static request_t request;
+    unsigned int generation = 0;
+    int prefetched = 0;
+
+    while (!atomic_load(&s_quit)) {
+        unsigned int latest = atomic_load_explicit(&s_generation, memory_order_acquire);
+        if (latest != generation) {
+            generation = latest;
+            pthread_mutex_lock(&s_mutex);
+            request = s_request;
+            pthread_mutex_unlock(&s_mutex);
+
+            _close();
+            prefetched = 1;
+            if (request.count > 0)
+                _start(&request, generation);
+            continue;
+        }
+
+        if (s_is_open && ring_space(&s_ring) > 0) {
+            _fill(generation);
+            continue;
+        }
+
+        // neighbours only once the selection is buffered, one at a time so a new
+        // selection is picked up in between
+        if (prefetched < request.count) {
+            _prefetch(request.filepaths[prefetched], request.times[prefetched], generation);
+            prefetched++;
+            continue;
+        }
+
+        timer_sleep(PREVIEW_INTERVAL);
+    }
+
+    _close();
+    return NULL;
+}
+
+void _start(const request_t* request, unsigned int generation) {
+    const char* filepath = request->filepaths[0];
+    double time = request->times[0];
+
+    // a cached head plays before the file is even opened
+    head_t* head = _find_head(filepath, time);
+    atomic_fetch_add_explicit((head) ? &s_head_hits : &s_head_misses, 1, memory_order_relaxed);
+    if (head && !_push_head(head, generation))
+        return;
+
+    if (!_open(&s_decoder, filepath, generation))
+        return;
+    s_is_open = true;
+    // opening scans the file when it has no index yet, the selection may have moved on since
+    if (_is_cancelled(generation)) {
+        _close();
+        return;
+    }
+
+    uint64_t start = _start_frame(&s_decoder, time);
+    if (!head) {
+        // the head is decoded with the decoder the stream continues with
+        head = _decode_head(&s_decoder, filepath, time, generation);
+        if (!head || !_push_head(head, generation)) {
+            _close();
+            return;
+        }
+    }
+    else if (!decoder_seek(&s_decoder, start + head->frame_count)) {
+        _close();
+        return;
+    }
+
+    atomic_fetch_add(&head->refs, 1);
+    s_current = head;
+    s_loop_frame = start + head->frame_count;
+}
+
+void _fill(unsigned int generation) {
+    static chunk_t chunk;
+    chunk.generation = generation;
+    chunk.head = NULL;
+    chunk.count = decoder_read(&s_decoder, chunk.samples, PREVIEW_CHUNK_FRAMES);
+    if (chunk.count > 0)
+        ring_write(&s_ring, &chunk, 1);
+
+    // loops from the preview point like osu!, starting with the head again
+    if (chunk.count < PREVIEW_CHUNK_FRAMES) {
+        if (!decoder_seek(&s_decoder, s_loop_frame) || !_push_head(s_current, generation))
+            _close();
+    }
+}
+
+void _prefetch(const char* filepath, double time, unsigned int generation) {
+    if (_find_head(filepath, time))
+        return;
+
+    decoder_t decoder;
+    if (!_open(&decoder, filepath, generation))
+        return;
+    _decode_head(&decoder, filepath, time, generation);
+    decoder_close(&decoder);
+}
+
+void _close() {
+    if (s_is_open)
+        decoder_close(&s_decoder);
+    s_is_open = false;
+    _release(s_current);
+    s_current = NULL;
+}
+
+bool _open(decoder_t* decoder, const char* filepath, unsigned int generation) {
+    char index_filepath[512];
+    bool has_index = s_cache_directory[0]
+        && pcm_cache_filepath(filepath, s_cache_directory, "seek", index_filepath, STACKARRAY_SIZE(index_filepath));
+    if (_is_cancelled(generation))
+        return false;
+    return decoder_open(decoder, filepath, (has_index) ? index_filepath : NULL);
+}
+
+bool _is_cancelled(unsigned int generation) {
+    if (atomic_load_explicit(&s_generation, memory_order_relaxed) == generation)
+        return false;
+    atomic_fetch_add_explicit(&s_cancelled, 1, memory_order_relaxed);
+    return true;
+}
+
+head_t* _find_head(const char* filepath, double time) {
+    for (int i = 0; i < PREVIEW_CACHE_SIZE; i++) {
+        head_t* head = &s_heads[i];
+        if (head->frames && head->time == time && strcmp(head->filepath, filepath) == 0) {
+            head->last_used = ++s_clock;
+            return head;
+        }
+    }
+    return NULL;
+}
+
+head_t* _decode_head(decoder_t* decoder, const char* filepath, double preview_time, unsigned int generation) {
+    uint64_t start = _start_frame(decoder, preview_time);
+    int count = (int)min((uint64_t)(PREVIEW_HEAD * decoder->sample_rate), decoder->frame_count - start);
+    if (count <= 0 || !decoder_seek(decoder, start))
+        return NULL;
+
+    float* frames = malloc((size_t)count * DECODER_CHANNELS * sizeof(float));
+    if (!frames) {
+        LOG("Failed to allocate a preview head");
+        return NULL;
+    }
+
+    // in pieces, so moving on to another song does not wait for the rest
+    int done = 0;
+    while (done < count) {
+        if (_is_cancelled(generation)) {
+            free(frames);
+            return NULL;
+        }
+        int read = decoder_read(decoder, frames + done * DECODER_CHANNELS, min(count - done, PREVIEW_CHUNK_FRAMES));
+        if (read <= 0)
+            break;
+        done += read;
+    }
+
+    // the least recently used head nothing plays from makes room
+    head_t* head = NULL;
+    for (int i = 0; i < PREVIEW_CACHE_SIZE; i++) {
+        head_t* h = &s_heads[i];
+        if (atomic_load_explicit(&h->refs, memory_order_acquire) > 0)
+            continue;
+        if (!head || !h->frames || (head->frames && h->last_used < head->last_used))
+            head = h;
+        if (!head->frames)
+            break;
+    }
+    if (!head) {
+        free(frames);
+        return NULL;
+    }
+
+    free(head->frames);
+    snprintf(head->filepath, STACKARRAY_SIZE(head->filepath), "%s", filepath);
+    head->time = preview_time;
+    head->sample_rate = decoder->sample_rate;
+    head->frames = frames;
+    head->frame_count = done;
+    head->last_used = ++s_clock;
+    return head;
+}
+
+bool _push_head(head_t* head, unsigned int generation) {
+    static chunk_t chunk;
+    chunk.generation = generation;
+    chunk.head = head;
+    chunk.count = 0;
+
+    // the ring may still be full of the previous selection until the next callback drops it
+    atomic_fetch_add(&head->refs, 1);
+    while (ring_write(&s_ring, &chunk, 1) == 0) {
+        if (atomic_load(&s_quit) || atomic_load_explicit(&s_generation, memory_order_relaxed) != generation) {
+            _release(head);
+            return false;
+        }
+        timer_sleep(PREVIEW_INTERVAL);
+    }
+    return true;
+}
+
+uint64_t _start_frame(const decoder_t* decoder, double time) {
+    double length = decoder_length(decoder);
+    if (time < 0 || time >= length)
+        time = length * 0.4;
+    return (uint64_t)(time * decoder->sample_rate);
+}
+
+void _pull(void* buffer, unsigned int frames) {
+    float* out = buffer;
+    unsigned int generation = atomic_load_explicit(&s_generation, memory_order_acquire);
+    if (generation != s_pull_generation) {
+        s_pull_generation = generation;
+        _release(s_head);
+        s_head = NULL;
+        if (!s_has_next)
+            s_chunk.count = 0;
+        s_is_started = false;
+    }
+
+    if (!s_is_started)
+        s_is_started = _begin();
+
+    int done = 0;
+    if (s_is_started)
+        done = (s_is_stretched) ? stretch_process(&s_stretch, out, frames) : _read(NULL, out, frames);
+
+    int fade_frames = (int)(PREVIEW_FADE_IN * PREVIEW_SAMPLE_RATE);
+    for (int i = 0; i < done && s_fade_frame < fade_frames; i++, s_fade_frame++) {
+        float gain = (float)s_fade_frame / fade_frames;
+        out[i * DECODER_CHANNELS] *= gain;
+        out[i * DECODER_CHANNELS + 1] *= gain;
+    }
+    memset(out + done * DECODER_CHANNELS, 0, (frames - done) * DECODER_CHANNELS * sizeof(float));
+}
+
+bool _begin() {
+    // every selection starts with its head, older chunks are dropped on the way
+    while (_next_chunk()) {
+        if (!s_chunk.head)
+            continue;
+
+        s_head = s_chunk.head;
+        s_head_offset = 0;
+        s_chunk.head = NULL;
+        s_chunk.count = 0;
+
+        double rate = (double)s_head->sample_rate / PREVIEW_SAMPLE_RATE;
+        s_is_stretched = rate != 1.0;
+        if (s_is_stretched) {
+            stretch_set_rate(&s_stretch, rate);
+            stretch_reset(&s_stretch, 0);
+        }
+        s_fade_frame = 0;
+
+        double latency = timer_now() - atomic_load(&s_select_time);
+        atomic_store(&s_last_latency, latency);
+        atomic_store(&s_max_latency, max(atomic_load(&s_max_latency), latency));
+        atomic_fetch_add_explicit(&s_started, 1, memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+bool _next_chunk() {
+    // chunks of older selections are dropped, one of a newer selection waits for the next callback
+    while (s_has_next || ring_read(&s_ring, &s_chunk, 1)) {
+        s_has_next = false;
+        int age = (int)(s_pull_generation - s_chunk.generation);
+        if (age > 0) {
+            _release(s_chunk.head);
+            s_chunk.head = NULL;
+            s_chunk.count = 0;
+            continue;
+        }
+        if (age < 0) {
+            s_has_next = true;
+            return false;
+        }
+        s_chunk_offset = 0;
+        return true;
+    }
+    return false;
+}
+
+int _read(void* user, float* frames, int count) {
+    int done = 0;
+    while (done < count) {
+        if (s_head && s_head_offset < s_head->frame_count) {
+            int n = min(count - done, s_head->frame_count - s_head_offset);
+            memcpy(frames + done * DECODER_CHANNELS, s_head->frames + s_head_offset * DECODER_CHANNELS, n * DECODER_CHANNELS * sizeof(float));
+            s_head_offset += n;
+            done += n;
+            continue;
+        }
+        if (!s_has_next && s_chunk_offset < s_chunk.count) {
+            int n = min(count - done, s_chunk.count - s_chunk_offset);
+            memcpy(frames + done * DECODER_CHANNELS, s_chunk.samples + s_chunk_offset * DECODER_CHANNELS, n * DECODER_CHANNELS * sizeof(float));
+            s_chunk_offset += n;
+            done += n;
+            continue;
+        }
+
+        if (!_next_chunk())
+            break;
+        // the song looped, its head plays again
+        if (s_chunk.head) {
+            _release(s_head);
+            s_head = s_chunk.head;
+            s_head_offset = 0;
+            s_chunk.head = NULL;
+        }
+    }
+    return done;
+}
+
+void _release(head_t* head) {
+    if (head)
+        atomic_fetch_sub_explicit(&head->refs, 1, memory_order_release);
+}
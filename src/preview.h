@@ -0,0 +1,77 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <stdint.h>
+
+#include <defines.h>
+
+// Rate of the preview stream, songs at other rates are resampled in the audio callback
+#define PREVIEW_SAMPLE_RATE 44100
+
+// Decoded from the preview point of every selected song and its neighbours, so switching back
+// and forth starts from memory
+#ifndef PREVIEW_HEAD
+#define PREVIEW_HEAD 1.0
+#endif
+
+// Heads kept, the least recently used one is dropped
+#ifndef PREVIEW_CACHE_SIZE
+#define PREVIEW_CACHE_SIZE 16
+#endif
+
+#ifndef PREVIEW_MAX_NEIGHBOURS
+#define PREVIEW_MAX_NEIGHBOURS 4
+#endif
+
+#ifndef PREVIEW_CHUNK_FRAMES
+#define PREVIEW_CHUNK_FRAMES 1024
+#endif
+
+// Decoded audio kept ahead of the audio callback
+#ifndef PREVIEW_BUFFER
+#define PREVIEW_BUFFER 0.25
+#endif
+
+#ifndef PREVIEW_FADE_IN
+#define PREVIEW_FADE_IN 0.3
+#endif
+
+// How often the worker looks for a new selection and room in the buffer
+#ifndef PREVIEW_INTERVAL
+#define PREVIEW_INTERVAL 0.002
+#endif
+
+#define PREVIEW_VOLUME 0.75f
+
+
+typedef struct preview_item_s {
+    const char* audio_filepath;
+    double      preview_time;       // seconds, negative for 40% into the song like osu!
+} preview_item_t;
+
+typedef struct preview_stats_s {
+    int         selects;
+    int         started;
+    int         head_hits;          // selections that started from a cached head
+    int         head_misses;
+    int         cancelled;          // opens and decodes abandoned because the selection moved on
+    double      last_latency;       // from preview_select() to the first audible frame
+    double      max_latency;
+} preview_stats_t;
+
+
+// Plays song previews on a stream of its own. All file I/O and decoding happens on a worker
+// thread, the caller of preview_select() only hands over the request. MP3 seek indexes are
+// kept in cache_directory (optional). Requires an initialized audio device.
+bool preview_init(const char* cache_directory);
+void preview_shutdown();
+
+// Switches to item at its preview point and loops from there. The neighbours (in order of
+// priority) get their heads decoded once the selection plays. Never blocks on I/O.
+void preview_select(const preview_item_t* item, const preview_item_t* neighbours, int neighbour_count);
+void preview_stop();
+
+preview_stats_t preview_stats();
+
+
+#endif
@@ -0,0 +1,160 @@
+#include <raster.h>
+
+#include <math.h>
+#include <stdlib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+// Glyphs from ' ' to '_', five rows of three bits each, top row first
+static const uint16_t s_font[64] = {
+    000000, 022202, 055000, 057575, 036736, 051245, 025253, 022000,  //   ! " # $ % & '
+    012221, 042224, 052725, 002720, 000024, 000700, 000002, 011244,  // ( ) * + , - . /
+    075557, 026227, 071747, 071317, 055711, 074717, 074757, 071222,  // 0 1 2 3 4 5 6 7
+    075757, 075717, 002020, 002024, 012421, 007070, 042124, 071202,  // 8 9 : ; < = > ?
+    025747, 025755, 065656, 034443, 065556, 074647, 074644, 034553,  // @ A B C D E F G
+    055755, 072227, 011152, 055655, 044447, 057755, 065555, 025552,  // H I J K L M N O
+    065644, 025563, 065655, 034216, 072222, 055557, 055552, 055775,  // P Q R S T U V W
+    055255, 055222, 071247, 064446, 044211, 031113, 025000, 000007,  // X Y Z [ \ ] ^ _
+};
+
+static void _fill_span(Color* dst, int count, Color color);
+static void _blend_span(Color* dst, int count, Color color);
+static inline uint8_t _blend(int src_alpha_product, int dst, int inv_alpha);
+
+
+bool raster_init(raster_t* raster, int width, int height) {
+    *raster = (raster_t){0};
+    raster->pixels = calloc((size_t)width * height, sizeof(Color));
+    if (!raster->pixels)
+        return false;
+    raster->width = width;
+    raster->height = height;
+    return true;
+}
+
+void raster_destroy(raster_t* raster) {
+    SAFE_DELETE(raster->pixels);
+    *raster = (raster_t){0};
+}
+
+void raster_clear(raster_t* raster, Color color) {
+    color.a = 255;
+    _fill_span(raster->pixels, raster->width * raster->height, color);
+}
+
+void raster_fill_rect(raster_t* raster, float x, float y, float width, float height, Color color) {
+    if (color.a == 0)
+        return;
+
+    // a pixel is covered when its center is inside [x, x + width)
+    int x0 = max((int)ceilf(x - 0.5f), 0);
+    int x1 = min((int)ceilf(x + width - 0.5f), raster->width);
+    int y0 = max((int)ceilf(y - 0.5f), 0);
+    int y1 = min((int)ceilf(y + height - 0.5f), raster->height);
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    for (int row = y0; row < y1; row++) {
+        Color* dst = &raster->pixels[(size_t)row * raster->width + x0];
+        if (color.a == 255)
+            _fill_span(dst, x1 - x0, color);
+        else
+            _blend_span(dst, x1 - x0, color);
+    }
+}
+
+void raster_text(raster_t* raster, const char* text, int x, int y, int scale, Color color) {
+    int pen = x;
+    for (const char* c = text; *c; c++) {
+        int ch = (*c >= 'a' && *c <= 'z') ? *c - 'a' + 'A' : *c;
+        uint16_t glyph = (ch >= ' ' && ch <= '_') ? s_font[ch - ' '] : s_font['?' - ' '];
+
+        for (int row = 0; row < RASTER_GLYPH_HEIGHT; row++) {
+            int bits = (glyph >> ((RASTER_GLYPH_HEIGHT - 1 - row) * 3)) & 7;
+            for (int col = 0; col < RASTER_GLYPH_WIDTH; col++)
+                if (bits & (4 >> col))
+                    raster_fill_rect(raster, pen + col * scale, y + row * scale, scale, scale, color);
+        }
+        pen += (RASTER_GLYPH_WIDTH + 1) * scale;
+    }
+}
+
+Image raster_image(const raster_t* raster) {
+    return (Image) {
+        .data = raster->pixels,
+        .width = raster->width,
+        .height = raster->height,
+        .mipmaps = 1,
+        .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+    };
+}
+
+uint64_t raster_hash(const raster_t* raster) {
+    // FNV-1a
+    const uint8_t* bytes = (const uint8_t*)raster->pixels;
+    size_t size = (size_t)raster->width * raster->height * sizeof(Color);
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    return hash;
+}
+
+void _fill_span(Color* dst, int count, Color color) {
+    int i = 0;
+#if defined(__SSE2__)
+    int32_t packed;
+    memcpy(&packed, &color, sizeof(packed));
+    __m128i value = _mm_set1_epi32(packed);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i*)&dst[i], value);
+#endif
+    for (; i < count; i++)
+        dst[i] = color;
+}
+
+void _blend_span(Color* dst, int count, Color color) {
+    // dst = (src * a + dst * (255 - a)) / 255, rounded, alpha stays opaque
+    int a = color.a;
+    int inv = 255 - a;
+    int sr = color.r * a + 128;
+    int sg = color.g * a + 128;
+    int sb = color.b * a + 128;
+    int i = 0;
+
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    __m128i src = _mm_setr_epi16(sr, sg, sb, 0, sr, sg, sb, 0);
+    __m128i inv_alpha = _mm_set1_epi16(inv);
+    __m128i opaque = _mm_set1_epi32(0xFF000000);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128((__m128i*)&dst[i]);
+        __m128i lo = _mm_unpacklo_epi8(pixels, zero);
+        __m128i hi = _mm_unpackhi_epi8(pixels, zero);
+
+        // t = src * a + 128 + dst * inv fits 16 bits, t / 255 == (t + (t >> 8)) >> 8
+        lo = _mm_add_epi16(_mm_mullo_epi16(lo, inv_alpha), src);
+        hi = _mm_add_epi16(_mm_mullo_epi16(hi, inv_alpha), src);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+        pixels = _mm_or_si128(_mm_packus_epi16(lo, hi), opaque);
+        _mm_storeu_si128((__m128i*)&dst[i], pixels);
+    }
+#endif
+
+    for (; i < count; i++) {
+        dst[i].r = _blend(sr, dst[i].r, inv);
+        dst[i].g = _blend(sg, dst[i].g, inv);
+        dst[i].b = _blend(sb, dst[i].b, inv);
+        dst[i].a = 255;
+    }
+}
+
+uint8_t _blend(int src_alpha_product, int dst, int inv_alpha) {
+    int t = src_alpha_product + dst * inv_alpha;
+    return (t + (t >> 8)) >> 8;
+}
@@ -0,0 +1,36 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <raylib.h>
+
+#include <defines.h>
+
+// Pixels of a glyph of the built-in font, before scaling
+#define RASTER_GLYPH_WIDTH 3
+#define RASTER_GLYPH_HEIGHT 5
+
+
+// CPU framebuffer of opaque RGBA8 pixels. Everything is integer math on pixel centers,
+// so the same calls produce the same bytes on any machine, with or without SIMD.
+typedef struct raster_s {
+    Color*  pixels;
+    int     width;
+    int     height;
+} raster_t;
+
+
+bool raster_init(raster_t* raster, int width, int height);
+void raster_destroy(raster_t* raster);
+
+void raster_clear(raster_t* raster, Color color);
+// Covers the pixels whose centers are inside the rectangle, alpha blended.
+void raster_fill_rect(raster_t* raster, float x, float y, float width, float height, Color color);
+// Built-in 3x5 font, upper case letters, digits and a few symbols.
+void raster_text(raster_t* raster, const char* text, int x, int y, int scale, Color color);
+
+// Non-owning view of the pixels for raylib's image functions (ExportImage etc.).
+Image raster_image(const raster_t* raster);
+uint64_t raster_hash(const raster_t* raster);
+
+
+#endif
@@ -0,0 +1,438 @@
+#include <render.h>
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include <math.h>
+
+#include <raylib.h>
+#include <raymath.h>
+#define GLFW_INCLUDE_NONE
+#include <external/glfw/include/GLFW/glfw3.h>
+
+#include <input.h>
+#include <playback_clock.h>
+#include <playfield.h>
+#include <playfield_gl.h>
+#include <ring.h>
+#include <timer.h>
+#include <triple_buffer.h>
+#define SCOPE_NAME "render"
+#include <logging.h>
+
+
+typedef enum {
+    RENDER_STATUS_OPEN,         // window and context are up, waiting for the chart
+    RENDER_STATUS_RUNNING,      // the chart is on the GPU, frames are drawn once render_run() is called
+    RENDER_STATUS_CLOSED,
+} render_status_t;
+
+static const int width = 280;
+static const int height = 480;
+
+static const gameplay_t*    s_gameplay = NULL;
+static const beatmap_t*     s_beatmap = NULL;
+static const waveform_t*    s_waveform = NULL;
+static render_config_t      s_config;
+static bool                 s_is_started = false;
+static bool                 s_is_loaded = false;
+static atomic_int           s_status = RENDER_STATUS_CLOSED;
+static atomic_bool          s_is_idle = false;
+static bool                 s_has_drawn = false;
+static _Atomic double       s_first_frame_time = 0;
+static render_snapshot_t    s_published;
+static bool                 s_has_published = false;
+static render_snapshot_t    s_snapshots[3];
+static triple_buffer_t      s_snapshot_buffer;
+static ring_t               s_commands;
+static playfield_t          s_playfield;
+static RenderTexture2D      s_target;           // low resolution playfield, unused at scale 1
+static Shader               s_upscaler;
+static int                  s_upscaler_locs[2];
+static bool                 s_is_target_valid = false;
+static double               s_target_pos = 0;
+static double               s_waveform_zoom = RENDER_WAVEFORM_ZOOM;
+static bool                 s_is_waveform_stale = true;  // zoomed or became ready since the last frame
+static bool                 s_has_waveform = false;      // drawn in the last frame
+
+static const char* s_upscaler_shader =
+    "#version 330\n"
+    "in vec2 fragTexCoord;\n"
+    "in vec4 fragColor;\n"
+    "uniform sampler2D texture0;\n"
+    "uniform vec4 colDiffuse;\n"
+    "uniform vec2 textureSize;\n"
+    "uniform float upscale;\n"
+    "out vec4 finalColor;\n"
+    "void main() {\n"
+    // sharp bilinear: texels are magnified with nearest sampling, only the fractional pixel
+    // on their border is interpolated, so edges stay crisp at non-integer factors
+    "    vec2 texel = fragTexCoord * textureSize;\n"
+    "    vec2 center = fract(texel) - 0.5;\n"
+    "    float region = 0.5 - 0.5 / upscale;\n"
+    "    vec2 f = (center - clamp(center, -region, region)) * upscale + 0.5;\n"
+    "    finalColor = texture(texture0, (floor(texel) + f) / textureSize) * colDiffuse * fragColor;\n"
+    "}\n";
+
+static bool _load_chart();
+static void _unload_chart();
+static bool _update_idle();
+static bool _is_same_frame(const render_snapshot_t* a, const render_snapshot_t* b);
+static bool _load_target();
+static void _unload_target();
+static void _draw_target(const render_snapshot_t* snapshot, double pos, bool is_fresh);
+static void _poll_controls();
+static void _push_command(render_command_id_t type, float value);
+static void _draw_info(const render_snapshot_t* snapshot);
+static void _draw_waveform(double pos);
+
+
+bool render_start(render_config_t config) {
+    assert(!s_is_started);
+
+    s_gameplay = NULL;
+    s_beatmap = NULL;
+    s_waveform = NULL;
+    s_config = config;
+    triple_buffer_init(&s_snapshot_buffer, &s_snapshots[0], &s_snapshots[1], &s_snapshots[2]);
+    s_has_published = false;
+    s_has_drawn = false;
+    atomic_store(&s_first_frame_time, 0);
+    atomic_store(&s_is_idle, false);
+
+    InitWindow(width, height, "CMania");
+    if (!IsWindowReady()) {
+        LOG("Failed to create window");
+        return false;
+    }
+    ring_init(&s_commands, sizeof(render_command_t), RENDER_COMMAND_QUEUE_SIZE);
+    s_is_started = true;
+    atomic_store(&s_status, RENDER_STATUS_OPEN);
+    return true;
+}
+
+bool render_load(const gameplay_t* gameplay, const beatmap_t* beatmap, const waveform_t* waveform) {
+    assert(s_is_started && atomic_load(&s_status) == RENDER_STATUS_OPEN);
+
+    s_gameplay = gameplay;
+    s_beatmap = beatmap;
+    s_waveform = waveform;
+    if (!_load_chart())
+        return false;
+    s_is_loaded = true;
+    frame_pacer_init(s_config.pacing, s_config.target_fps);
+    atomic_store(&s_status, RENDER_STATUS_RUNNING);
+    return true;
+}
+
+void render_run() {
+    assert(s_is_loaded);
+
+    while (!WindowShouldClose()) {
+        if (_update_idle()) {
+            // nothing visible changed since the last frame, so it either stays on screen
+            // until an event arrives or gets redrawn at the idle rate
+            frame_pacer_resume();
+            if (s_config.idle_fps == 0) {
+                PollInputEvents();
+                input_poll_window();
+                _poll_controls();
+                continue;
+            }
+            timer_sleep(1.0 / s_config.idle_fps);
+        }
+        else {
+            frame_pacer_wait();
+        }
+
+        // never waits for the simulation, the latest snapshot is redrawn if nothing new arrived
+        bool is_fresh = false;
+        const render_snapshot_t* snapshot = triple_buffer_read(&s_snapshot_buffer, &is_fresh);
+        double pos = (snapshot) ? gameplay_interpolate(&snapshot->previous, &snapshot->state, playback_clock_now()) : 0;
+
+        if (snapshot && s_target.id)
+            _draw_target(snapshot, pos, is_fresh);
+
+        BeginDrawing();
+        ClearBackground(WHITE);
+
+        if (snapshot) {
+            if (s_target.id) {
+                Rectangle source = { 0, 0, s_target.texture.width, -s_target.texture.height };
+                BeginShaderMode(s_upscaler);
+                DrawTexturePro(s_target.texture, source, (Rectangle) { 0, 0, width, height }, Vector2Zero(), 0, WHITE);
+                EndShaderMode();
+            }
+            else {
+                playfield_build(&s_playfield, &snapshot->state, pos);
+                playfield_gl_draw(&s_playfield, &snapshot->state, pos);
+            }
+            _draw_waveform(pos);
+            _draw_info(snapshot);
+        }
+
+        frame_pacer_rendered();
+        EndDrawing();
+        frame_pacer_presented();
+        if (!s_has_drawn)
+            atomic_store(&s_first_frame_time, timer_now());
+        s_has_drawn = true;
+
+        input_poll_window();
+        _poll_controls();
+    }
+
+    frame_pacer_log_stats();
+    atomic_store(&s_status, RENDER_STATUS_CLOSED);
+}
+
+void render_stop() {
+    if (!s_is_started)
+        return;
+
+    if (s_is_loaded)
+        _unload_chart();
+    s_is_loaded = false;
+    atomic_store(&s_status, RENDER_STATUS_CLOSED);
+    CloseWindow();
+    ring_destroy(&s_commands);
+    s_is_started = false;
+}
+
+bool render_should_close() {
+    return atomic_load_explicit(&s_status, memory_order_relaxed) != RENDER_STATUS_RUNNING;
+}
+
+double render_first_frame_time() {
+    return atomic_load(&s_first_frame_time);
+}
+
+void render_publish(const gameplay_t* gameplay, float volume, float rate) {
+    render_snapshot_t* snapshot = triple_buffer_write_slot(&s_snapshot_buffer);
+    snapshot->previous = gameplay->previous;
+    snapshot->state = gameplay->state;
+    snapshot->volume = volume;
+    snapshot->rate = rate;
+
+    if (s_has_published && _is_same_frame(snapshot, &s_published))
+        return;
+
+    s_published = *snapshot;
+    s_has_published = true;
+    triple_buffer_publish(&s_snapshot_buffer);
+
+    // wakes the main thread up if it is blocked waiting for window events
+    if (atomic_load(&s_is_idle) && s_config.idle_fps == 0)
+        glfwPostEmptyEvent();
+}
+
+bool render_pop_command(render_command_t* command) {
+    return ring_read(&s_commands, command, 1) == 1;
+}
+
+bool _load_chart() {
+    // at a lower scale the layout is done in target pixels, so lines stay a pixel wide
+    float scale = (s_config.playfield_scale > 0) ? s_config.playfield_scale : 1;
+    playfield_init(&s_playfield, s_gameplay, roundf(width * scale), roundf(height * scale));
+    if (!playfield_gl_init(&s_playfield, s_config.chart_mode) || !_load_target()) {
+        playfield_gl_destroy();
+        playfield_destroy(&s_playfield);
+        return false;
+    }
+    return true;
+}
+
+void _unload_chart() {
+    _unload_target();
+    playfield_destroy(&s_playfield);
+    playfield_gl_destroy();
+}
+
+bool _load_target() {
+    s_target = (RenderTexture2D){0};
+    s_upscaler = (Shader){0};
+    s_is_target_valid = false;
+    if (s_playfield.width >= width && s_playfield.height >= height)
+        return true;
+
+    s_target = LoadRenderTexture(s_playfield.width, s_playfield.height);
+    if (!IsRenderTextureReady(s_target)) {
+        LOG("Failed to create the playfield render texture");
+        return false;
+    }
+    SetTextureFilter(s_target.texture, TEXTURE_FILTER_BILINEAR);
+
+    s_upscaler = LoadShaderFromMemory(NULL, s_upscaler_shader);
+    s_upscaler_locs[0] = GetShaderLocation(s_upscaler, "textureSize");
+    s_upscaler_locs[1] = GetShaderLocation(s_upscaler, "upscale");
+
+    Vector2 size = { s_target.texture.width, s_target.texture.height };
+    float upscale = (float)height / s_target.texture.height;
+    SetShaderValue(s_upscaler, s_upscaler_locs[0], &size, SHADER_UNIFORM_VEC2);
+    SetShaderValue(s_upscaler, s_upscaler_locs[1], &upscale, SHADER_UNIFORM_FLOAT);
+
+    LOGF("playfield at %dx%d, upscaled %.2fx", s_target.texture.width, s_target.texture.height, upscale);
+    return true;
+}
+
+void _unload_target() {
+    if (s_target.id)
+        UnloadRenderTexture(s_target);
+    if (s_upscaler.id)
+        UnloadShader(s_upscaler);
+    s_target = (RenderTexture2D){0};
+    s_upscaler = (Shader){0};
+}
+
+void _draw_target(const render_snapshot_t* snapshot, double pos, bool is_fresh) {
+    // the texture is kept while neither the gameplay state nor the scroll position changed,
+    // frames in between only recomposite it under a new HUD
+    if (s_is_target_valid && !is_fresh && pos == s_target_pos)
+        return;
+
+    playfield_build(&s_playfield, &snapshot->state, pos);
+    BeginTextureMode(s_target);
+    ClearBackground(WHITE);
+    playfield_gl_draw(&s_playfield, &snapshot->state, pos);
+    EndTextureMode();
+
+    s_is_target_valid = true;
+    s_target_pos = pos;
+}
+
+bool _update_idle() {
+    // the playfield is a function of the snapshot and the playback position, so while the
+    // clock is stopped and no new snapshot arrived the last frame is still accurate
+    if (s_waveform && !s_is_waveform_stale && waveform_is_ready(s_waveform) != s_has_waveform)
+        s_is_waveform_stale = true;
+    bool is_idle = s_has_drawn && !s_is_waveform_stale && !playback_clock_is_running() && !triple_buffer_has_fresh(&s_snapshot_buffer);
+
+    if (is_idle != atomic_load(&s_is_idle)) {
+        atomic_store(&s_is_idle, is_idle);
+        if (is_idle && s_config.idle_fps == 0)
+            EnableEventWaiting();
+        else
+            DisableEventWaiting();
+    }
+
+    // a snapshot published right before the flag was set didn't wake us up
+    return is_idle && !triple_buffer_has_fresh(&s_snapshot_buffer);
+}
+
+bool _is_same_frame(const render_snapshot_t* a, const render_snapshot_t* b) {
+    const gameplay_state_t* sa = &a->state;
+    const gameplay_state_t* sb = &b->state;
+
+    return sa->time == sb->time
+        && a->volume == b->volume
+        && a->rate == b->rate
+        && sa->judged_count == sb->judged_count
+        && sa->bpm == sb->bpm
+        && sa->sv == sb->sv
+        && memcmp(sa->cursors, sb->cursors, sizeof(sa->cursors)) == 0
+        && memcmp(sa->held, sb->held, sizeof(sa->held)) == 0
+        && memcmp(sa->hit_anims, sb->hit_anims, sizeof(sa->hit_anims)) == 0
+        && memcmp(sa->judgements, sb->judgements, sizeof(sa->judgements)) == 0;
+}
+
+void _poll_controls() {
+    if (IsKeyPressed(KEY_SPACE))
+        _push_command(RENDER_COMMAND_TOGGLE_PAUSE, 0);
+
+    float wh = GetMouseWheelMove();
+    if (wh != 0)
+        _push_command(RENDER_COMMAND_VOLUME, wh * 0.05f);
+
+    if (IsKeyPressed(KEY_RIGHT))
+        _push_command(RENDER_COMMAND_SEEK, 5);
+
+    if (IsKeyPressed(KEY_LEFT_BRACKET))
+        _push_command(RENDER_COMMAND_RATE, -0.05f);
+    if (IsKeyPressed(KEY_RIGHT_BRACKET))
+        _push_command(RENDER_COMMAND_RATE, 0.05f);
+
+    // A-B practice loop
+    if (IsKeyPressed(KEY_F1))
+        _push_command(RENDER_COMMAND_LOOP_START, 0);
+    if (IsKeyPressed(KEY_F2))
+        _push_command(RENDER_COMMAND_LOOP_END, 0);
+    if (IsKeyPressed(KEY_F3))
+        _push_command(RENDER_COMMAND_LOOP_CLEAR, 0);
+
+    // the timeline zoom only concerns this thread
+    if (IsKeyPressed(KEY_MINUS) || IsKeyPressed(KEY_EQUAL)) {
+        double zoom = s_waveform_zoom * (IsKeyPressed(KEY_EQUAL) ? 2 : 0.5);
+        s_waveform_zoom = CONSTRAIN(zoom, RENDER_WAVEFORM_MIN_ZOOM, RENDER_WAVEFORM_MAX_ZOOM);
+        s_is_waveform_stale = true;
+    }
+}
+
+void _push_command(render_command_id_t type, float value) {
+    render_command_t command = { type, value };
+    if (ring_write(&s_commands, &command, 1) == 0)
+        LOG("Command queue overflow, dropping command");
+}
+
+void _draw_info(const render_snapshot_t* snapshot) {
+    const gameplay_state_t* state = &snapshot->state;
+    frame_pacer_stats_t frame_stats = frame_pacer_stats();
+    playfield_gl_stats_t playfield_stats = playfield_gl_stats();
+
+    DrawFPS(0, 0);
+    DrawText(TextFormat("vol %.2f  %.2fx", snapshot->volume, snapshot->rate), 0, 21, 16, ORANGE);
+    DrawText(TextFormat("Note %d/%d", state->judged_count, kv_size(s_beatmap->notes)), 0, 38, 16, RED);
+    DrawText(TextFormat("BPM %.0f", state->bpm), 0, 54, 16, BLACK);
+    DrawText(TextFormat("SV %.1f", state->sv), 0, 70, 16, DARKGRAY);
+    DrawText(
+        TextFormat(
+            "Acc %.2f%% Miss %d",
+            gameplay_accuracy(state) * 100,
+            state->judgements[JUDGEMENT_MISS]
+        ),
+        0,
+        86,
+        16,
+        DARKGRAY
+    );
+    DrawText(
+        TextFormat("Frame %.2fms sd %.2fms", frame_stats.mean * 1000, frame_stats.stddev * 1000),
+        0,
+        102,
+        16,
+        DARKGRAY
+    );
+    DrawText(
+        TextFormat("Draws %d Verts %d", playfield_stats.draw_calls, playfield_stats.vertices),
+        0,
+        118,
+        16,
+        DARKGRAY
+    );
+}
+
+void _draw_waveform(double pos) {
+    static waveform_column_t columns[512];
+    int count = min(width, (int)STACKARRAY_SIZE(columns));
+
+    // the playhead stays in the middle, the strip scrolls under it
+    double start = pos - count / 2.0 / s_waveform_zoom;
+    s_has_waveform = s_waveform && waveform_columns(s_waveform, start, s_waveform_zoom, columns, count);
+    s_is_waveform_stale = false;
+    if (!s_has_waveform)
+        return;
+
+    float half = RENDER_WAVEFORM_HEIGHT / 2.0f;
+    float center = height - half;
+    DrawRectangle(0, height - RENDER_WAVEFORM_HEIGHT, count, RENDER_WAVEFORM_HEIGHT, Fade(WHITE, 0.7f));
+    for (int i = 0; i < count; i++) {
+        const waveform_column_t* column = &columns[i];
+        int top = (int)floorf(center - column->max * half);
+        int bottom = (int)ceilf(center - column->min * half);
+        DrawRectangle(i, top, 1, max(bottom - top, 1), LIGHTGRAY);
+        int rms = (int)roundf(column->rms * half);
+        if (rms > 0)
+            DrawRectangle(i, (int)center - rms, 1, 2 * rms, GRAY);
+    }
+    DrawRectangle(count / 2, height - RENDER_WAVEFORM_HEIGHT, 1, RENDER_WAVEFORM_HEIGHT, RED);
+}
@@ -0,0 +1,76 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <defines.h>
+#include <beatmap.h>
+#include <frame_pacer.h>
+#include <gameplay.h>
+#include <playfield_gl.h>
+#include <waveform.h>
+
+#ifndef RENDER_COMMAND_QUEUE_SIZE
+#define RENDER_COMMAND_QUEUE_SIZE 32
+#endif
+
+// Timeline strip at the bottom of the window, - and = zoom it
+#define RENDER_WAVEFORM_HEIGHT 32
+#define RENDER_WAVEFORM_ZOOM 40.0       // pixels per second
+#define RENDER_WAVEFORM_MIN_ZOOM 0.25
+#define RENDER_WAVEFORM_MAX_ZOOM 16384.0
+
+
+// Controls read on the render thread, executed by the simulation thread
+typedef enum {
+    RENDER_COMMAND_TOGGLE_PAUSE,
+    RENDER_COMMAND_VOLUME,
+    RENDER_COMMAND_SEEK,
+    RENDER_COMMAND_RATE,
+    RENDER_COMMAND_LOOP_START,
+    RENDER_COMMAND_LOOP_END,
+    RENDER_COMMAND_LOOP_CLEAR,
+} render_command_id_t;
+
+typedef struct render_command_s {
+    render_command_id_t type;
+    float               value;
+} render_command_t;
+
+typedef struct render_config_s {
+    frame_pacer_mode_t  pacing;
+    int                 target_fps;
+    int                 idle_fps;   // redraw rate while nothing changes, 0 waits for events
+    playfield_gl_mode_t chart_mode;
+    float               playfield_scale;    // playfield resolution relative to the window, HUD stays native
+} render_config_t;
+
+// Immutable view of the gameplay, published by the simulation thread through a triple buffer
+typedef struct render_snapshot_s {
+    gameplay_state_t    previous;
+    gameplay_state_t    state;
+    float               volume;
+    float               rate;
+} render_snapshot_t;
+
+
+// Creates the window and the GL context. The window functions of most platforms only work
+// on the main thread, so it and the other render_* functions but render_should_close(),
+// render_first_frame_time(), render_publish() and render_pop_command() are called there.
+bool render_start(render_config_t config);
+// Puts the chart on the GPU. The chart of the gameplay, the beatmap and the waveform
+// (optional, drawn once it is ready) must stay unchanged until render_stop().
+bool render_load(const gameplay_t* gameplay, const beatmap_t* beatmap, const waveform_t* waveform);
+// Draws frames and polls the window until it is closed, the simulation runs on another thread.
+void render_run();
+void render_stop();
+// True before render_load() and once the window was closed.
+bool render_should_close();
+// When the first frame was presented, in timer_now() seconds, 0 before that.
+double render_first_frame_time();
+
+// Snapshots that would draw the same frame as the previous one are not published,
+// which lets the render thread go idle while playback is paused.
+void render_publish(const gameplay_t* gameplay, float volume, float rate);
+bool render_pop_command(render_command_t* command);
+
+
+#endif
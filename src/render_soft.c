@@ -0,0 +1,31 @@
+#include <render_soft.h>
+
+#include <stdio.h>
+
+
+void render_soft_frame(raster_t* raster, playfield_t* playfield, const gameplay_state_t* state, double pos) {
+    const beatmap_t* beatmap = playfield->gameplay->beatmap;
+
+    playfield_build(playfield, state, pos);
+    raster_clear(raster, WHITE);
+    for (int i = 0; i < kv_size(playfield->quads); i++) {
+        const playfield_quad_t* q = &kv_A(playfield->quads, i);
+        raster_fill_rect(raster, q->x, q->y, q->width, q->height, q->color);
+    }
+
+    char lines[4][64];
+    snprintf(lines[0], sizeof(lines[0]), "NOTE %d/%d", state->judged_count, (int)kv_size(beatmap->notes));
+    snprintf(lines[1], sizeof(lines[1]), "BPM %.0f", state->bpm);
+    snprintf(lines[2], sizeof(lines[2]), "SV %.1f", state->sv);
+    snprintf(
+        lines[3],
+        sizeof(lines[3]),
+        "ACC %.2f%% MISS %d",
+        gameplay_accuracy(state) * 100,
+        state->judgements[JUDGEMENT_MISS]
+    );
+
+    int line_height = (RASTER_GLYPH_HEIGHT + 1) * RENDER_SOFT_TEXT_SCALE;
+    for (int i = 0; i < STACKARRAY_SIZE(lines); i++)
+        raster_text(raster, lines[i], 2, 2 + i * line_height, RENDER_SOFT_TEXT_SCALE, (i == 0) ? RED : DARKGRAY);
+}
@@ -0,0 +1,17 @@
+#ifndef RENDER_SOFT_H
+#define RENDER_SOFT_H
+
+#include <defines.h>
+#include <gameplay.h>
+#include <playfield.h>
+#include <raster.h>
+
+#define RENDER_SOFT_TEXT_SCALE 3
+
+
+// Draws a complete frame, playfield and HUD, into a CPU framebuffer of the playfield's size.
+// Needs no window or GL context, the result only depends on the arguments.
+void render_soft_frame(raster_t* raster, playfield_t* playfield, const gameplay_state_t* state, double pos);
+
+
+#endif
@@ -0,0 +1,80 @@
+#include <ring.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static void _copy_out(ring_t* ring, size_t from, void* elements, size_t count);
+
+
+bool ring_init(ring_t* ring, size_t element_size, size_t capacity) {
+    assert(element_size > 0 && capacity > 0);
+
+    size_t rounded = 1;
+    while (rounded < capacity)
+        rounded <<= 1;
+
+    ring->data = malloc(rounded * element_size);
+    ring->element_size = element_size;
+    ring->capacity = rounded;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return ring->data != NULL;
+}
+
+void ring_destroy(ring_t* ring) {
+    SAFE_DELETE(ring->data);
+    ring->capacity = 0;
+}
+
+void ring_clear(ring_t* ring) {
+    // consumer side: drops everything that was published so far
+    atomic_store_explicit(&ring->tail, atomic_load_explicit(&ring->head, memory_order_acquire), memory_order_release);
+}
+
+size_t ring_write(ring_t* ring, const void* elements, size_t count) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    count = min(count, ring->capacity - (head - tail));
+
+    size_t start = head & (ring->capacity - 1);
+    size_t first = min(count, ring->capacity - start);
+    memcpy(ring->data + start * ring->element_size, elements, first * ring->element_size);
+    memcpy(ring->data, (const uint8_t*)elements + first * ring->element_size, (count - first) * ring->element_size);
+
+    atomic_store_explicit(&ring->head, head + count, memory_order_release);
+    return count;
+}
+
+size_t ring_read(ring_t* ring, void* elements, size_t count) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    count = ring_peek(ring, elements, count);
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+    return count;
+}
+
+size_t ring_peek(ring_t* ring, void* elements, size_t count) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    count = min(count, head - tail);
+
+    if (elements)
+        _copy_out(ring, tail, elements, count);
+    return count;
+}
+
+size_t ring_size(ring_t* ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire) - atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+size_t ring_space(ring_t* ring) {
+    return ring->capacity - ring_size(ring);
+}
+
+void _copy_out(ring_t* ring, size_t from, void* elements, size_t count) {
+    size_t start = from & (ring->capacity - 1);
+    size_t first = min(count, ring->capacity - start);
+    memcpy(elements, ring->data + start * ring->element_size, first * ring->element_size);
+    memcpy((uint8_t*)elements + first * ring->element_size, ring->data, (count - first) * ring->element_size);
+}
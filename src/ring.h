@@ -0,0 +1,33 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+
+#include <defines.h>
+
+
+// Lock-free single producer / single consumer ring buffer of fixed size elements.
+// Capacity is rounded up to a power of two.
+typedef struct ring_s {
+    uint8_t*        data;
+    size_t          element_size;
+    size_t          capacity;
+    atomic_size_t   head;   // written by the producer
+    atomic_size_t   tail;   // written by the consumer
+} ring_t;
+
+
+bool ring_init(ring_t* ring, size_t element_size, size_t capacity);
+void ring_destroy(ring_t* ring);
+void ring_clear(ring_t* ring);
+
+// Both return the number of elements actually transferred.
+size_t ring_write(ring_t* ring, const void* elements, size_t count);
+size_t ring_read(ring_t* ring, void* elements, size_t count);
+size_t ring_peek(ring_t* ring, void* elements, size_t count);
+
+size_t ring_size(ring_t* ring);
+size_t ring_space(ring_t* ring);
+
+
+#endif
@@ -0,0 +1,292 @@
+#include <sample_bank.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <raylib.h>
+#include <khash.h>
+#include <kvec.h>
+
+#include <decoder.h>
+#include <timer.h>
+#define SCOPE_NAME "samples"
+#include <logging.h>
+
+KHASH_MAP_INIT_STR(sample_ids, int)
+
+
+typedef struct use_s {
+    double  time;
+    int     id;
+} use_t;
+
+static bool                     s_is_ready = false;
+static char                     s_directory[512];
+static int                      s_sample_rate;
+static size_t                   s_budget;
+static kvec_t(sample_t)         s_samples;      // fixed once the thread runs
+static khash_t(sample_ids)*     s_ids;          // filename to id, -1 for missing files
+static kvec_t(use_t)            s_uses;         // sorted by time once the thread runs
+static pthread_t                s_thread;
+static bool                     s_has_thread = false;
+static atomic_bool              s_quit = false;
+static atomic_bool              s_is_warm = false;
+static _Atomic double           s_position = 0;
+
+// Guards the frames, the LRU stamps and the byte count. The audio callback never takes it,
+// it only drops references.
+static pthread_mutex_t          s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t                 s_clock = 0;
+static size_t                   s_bytes = 0;
+
+static atomic_int               s_loads = 0;
+static atomic_int               s_evictions = 0;
+static atomic_int               s_hits = 0;
+static atomic_int               s_misses = 0;
+
+static void* _prefetch_thread(void* arg);
+static void _load(sample_t* sample);
+static void _evict(uint64_t pass);
+static int _first_use(double time);
+static int _compare_uses(const void* a, const void* b);
+
+
+bool sample_bank_init(const char* directory, int sample_rate, size_t budget) {
+    snprintf(s_directory, STACKARRAY_SIZE(s_directory), "%s", directory);
+    s_sample_rate = sample_rate;
+    s_budget = budget;
+    kv_init(s_samples);
+    kv_init(s_uses);
+    s_ids = kh_init(sample_ids);
+    s_clock = 0;
+    s_bytes = 0;
+    s_has_thread = false;
+    atomic_store(&s_quit, false);
+    atomic_store(&s_is_warm, false);
+    atomic_store(&s_position, 0);
+    atomic_store(&s_loads, 0);
+    atomic_store(&s_evictions, 0);
+    atomic_store(&s_hits, 0);
+    atomic_store(&s_misses, 0);
+    s_is_ready = true;
+    return true;
+}
+
+void sample_bank_shutdown() {
+    if (!s_is_ready)
+        return;
+
+    if (s_has_thread) {
+        atomic_store(&s_quit, true);
+        pthread_join(s_thread, NULL);
+
+        sample_bank_stats_t stats = sample_bank_stats();
+        LOGF(
+            "%d samples, %d loads, %d evictions, %d hits, %d misses",
+            (int)kv_size(s_samples),
+            stats.loads,
+            stats.evictions,
+            stats.hits,
+            stats.misses
+        );
+    }
+
+    // the mixer is shut down first, so nothing holds a reference anymore
+    for (int i = 0; i < kv_size(s_samples); i++) {
+        sample_t* sample = &kv_A(s_samples, i);
+        if (sample->frames)
+            UnloadWave((Wave){ .data = sample->frames });
+        free(sample->filepath);
+    }
+    for (khint_t k = kh_begin(s_ids); k != kh_end(s_ids); k++)
+        if (kh_exist(s_ids, k))
+            free((char*)kh_key(s_ids, k));
+    kh_destroy(sample_ids, s_ids);
+    kv_destroy(s_samples);
+    kv_destroy(s_uses);
+    s_is_ready = false;
+}
+
+int sample_bank_add(const char* filename) {
+    khint_t k = kh_get(sample_ids, s_ids, filename);
+    if (k != kh_end(s_ids))
+        return kh_value(s_ids, k);
+
+    char filepath[1024];
+    snprintf(filepath, STACKARRAY_SIZE(filepath), "%s/%s", s_directory, filename);
+    int id = -1;
+    if (FileExists(filepath)) {
+        id = kv_size(s_samples);
+        sample_t sample = { .filepath = strdup(filepath) };
+        kv_push(sample_t, s_samples, sample);
+    }
+    else {
+        LOGF("\"%s\" not found, the default hitsound plays instead", filename);
+    }
+
+    int is_new;
+    k = kh_put(sample_ids, s_ids, strdup(filename), &is_new);
+    kh_value(s_ids, k) = id;
+    return id;
+}
+
+void sample_bank_schedule(int id, double time) {
+    if (id < 0)
+        return;
+    use_t use = { time, id };
+    kv_push(use_t, s_uses, use);
+}
+
+bool sample_bank_start() {
+    if (kv_size(s_samples) == 0)
+        return true;
+
+    qsort(s_uses.a, kv_size(s_uses), sizeof(use_t), _compare_uses);
+    if (pthread_create(&s_thread, NULL, _prefetch_thread, NULL) != 0) {
+        LOG("Failed to start the prefetch thread");
+        kv_size(s_samples) = 0;
+        kv_size(s_uses) = 0;
+        return false;
+    }
+    s_has_thread = true;
+
+    double start = timer_now();
+    while (!atomic_load(&s_is_warm) && timer_now() - start < SAMPLE_BANK_WARMUP_TIMEOUT)
+        timer_sleep(SAMPLE_BANK_INTERVAL);
+    LOGF(
+        "%d samples, %d of them loaded in %.3f s",
+        (int)kv_size(s_samples),
+        sample_bank_stats().loaded,
+        timer_now() - start
+    );
+    return true;
+}
+
+void sample_bank_update(double playback_pos) {
+    atomic_store_explicit(&s_position, playback_pos, memory_order_relaxed);
+}
+
+sample_t* sample_bank_acquire(int id) {
+    if (id < 0 || id >= kv_size(s_samples))
+        return NULL;
+
+    sample_t* sample = &kv_A(s_samples, id);
+    pthread_mutex_lock(&s_mutex);
+    bool is_loaded = sample->frames != NULL;
+    if (is_loaded) {
+        atomic_fetch_add_explicit(&sample->refs, 1, memory_order_relaxed);
+        sample->last_used = ++s_clock;
+    }
+    pthread_mutex_unlock(&s_mutex);
+
+    atomic_fetch_add_explicit((is_loaded) ? &s_hits : &s_misses, 1, memory_order_relaxed);
+    return (is_loaded) ? sample : NULL;
+}
+
+void sample_bank_release(sample_t* sample) {
+    if (sample)
+        atomic_fetch_sub_explicit(&sample->refs, 1, memory_order_release);
+}
+
+sample_bank_stats_t sample_bank_stats() {
+    sample_bank_stats_t stats = {
+        .loads = atomic_load_explicit(&s_loads, memory_order_relaxed),
+        .evictions = atomic_load_explicit(&s_evictions, memory_order_relaxed),
+        .hits = atomic_load_explicit(&s_hits, memory_order_relaxed),
+        .misses = atomic_load_explicit(&s_misses, memory_order_relaxed),
+    };
+
+    pthread_mutex_lock(&s_mutex);
+    for (int i = 0; i < kv_size(s_samples); i++)
+        stats.loaded += kv_A(s_samples, i).frames != NULL;
+    stats.bytes = s_bytes;
+    pthread_mutex_unlock(&s_mutex);
+    return stats;
+}
+
+void* _prefetch_thread(void* arg) {
+    uint64_t pass = 0;
+    while (!atomic_load(&s_quit)) {
+        pass++;
+
+        // everything that plays in the next seconds, seeks just move the window
+        double pos = atomic_load_explicit(&s_position, memory_order_relaxed);
+        for (int i = _first_use(pos); i < kv_size(s_uses) && !atomic_load(&s_quit); i++) {
+            use_t use = kv_A(s_uses, i);
+            if (use.time >= pos + SAMPLE_BANK_PREFETCH)
+                break;
+
+            sample_t* sample = &kv_A(s_samples, use.id);
+            sample->window = pass;
+            if (!sample->frames && !sample->has_failed)
+                _load(sample);
+        }
+
+        _evict(pass);
+        atomic_store(&s_is_warm, true);
+        timer_sleep(SAMPLE_BANK_INTERVAL);
+    }
+    return NULL;
+}
+
+void _load(sample_t* sample) {
+    // decoded and converted without the lock, only publishing the frames takes it
+    Wave wave;
+    if (!decoder_load_wave(sample->filepath, &wave)) {
+        LOGF("Failed to load \"%s\"", sample->filepath);
+        sample->has_failed = true;
+        return;
+    }
+    WaveFormat(&wave, s_sample_rate, 32, SAMPLE_BANK_CHANNELS);
+
+    pthread_mutex_lock(&s_mutex);
+    sample->frames = wave.data;
+    sample->frame_count = wave.frameCount;
+    sample->last_used = ++s_clock;
+    s_bytes += (size_t)wave.frameCount * SAMPLE_BANK_CHANNELS * sizeof(float);
+    pthread_mutex_unlock(&s_mutex);
+    atomic_fetch_add_explicit(&s_loads, 1, memory_order_relaxed);
+}
+
+void _evict(uint64_t pass) {
+    pthread_mutex_lock(&s_mutex);
+    while (s_bytes > s_budget) {
+        // samples that are about to play or still playing stay, even over budget
+        sample_t* victim = NULL;
+        for (int i = 0; i < kv_size(s_samples); i++) {
+            sample_t* sample = &kv_A(s_samples, i);
+            if (!sample->frames || sample->window == pass || atomic_load_explicit(&sample->refs, memory_order_acquire) > 0)
+                continue;
+            if (!victim || sample->last_used < victim->last_used)
+                victim = sample;
+        }
+        if (!victim)
+            break;
+
+        UnloadWave((Wave){ .data = victim->frames });
+        s_bytes -= (size_t)victim->frame_count * SAMPLE_BANK_CHANNELS * sizeof(float);
+        victim->frames = NULL;
+        victim->frame_count = 0;
+        atomic_fetch_add_explicit(&s_evictions, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&s_mutex);
+}
+
+int _first_use(double time) {
+    int lo = 0, hi = kv_size(s_uses);
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (kv_A(s_uses, mid).time < time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int _compare_uses(const void* a, const void* b) {
+    double ta = ((const use_t*)a)->time, tb = ((const use_t*)b)->time;
+    return (ta > tb) - (ta < tb);
+}
@@ -0,0 +1,79 @@
+#ifndef SAMPLE_BANK_H
+#define SAMPLE_BANK_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include <defines.h>
+
+#define SAMPLE_BANK_CHANNELS 2
+
+// How far ahead of the playback position samples are loaded
+#ifndef SAMPLE_BANK_PREFETCH
+#define SAMPLE_BANK_PREFETCH 4.0
+#endif
+
+// Decoded samples kept in memory, the least recently used ones beyond it are unloaded
+#ifndef SAMPLE_BANK_DEFAULT_BUDGET
+#define SAMPLE_BANK_DEFAULT_BUDGET (64 << 20)
+#endif
+
+// How often the prefetch thread looks at the playback position
+#ifndef SAMPLE_BANK_INTERVAL
+#define SAMPLE_BANK_INTERVAL 0.01
+#endif
+
+// Waiting for the samples of the first SAMPLE_BANK_PREFETCH seconds
+#ifndef SAMPLE_BANK_WARMUP_TIMEOUT
+#define SAMPLE_BANK_WARMUP_TIMEOUT 2.0
+#endif
+
+
+// Interleaved float stereo at the device rate. Frames stay valid while a reference is held.
+typedef struct sample_s {
+    char*       filepath;
+    float*      frames;         // NULL while not loaded
+    int         frame_count;
+    atomic_int  refs;
+    bool        has_failed;
+    uint64_t    last_used;      // LRU stamp
+    uint64_t    window;         // prefetch pass that last found it ahead of the playback position
+} sample_t;
+
+typedef struct sample_bank_stats_s {
+    int         loaded;         // samples in memory
+    size_t      bytes;
+    int         loads;
+    int         evictions;
+    int         hits;           // acquired while loaded
+    int         misses;         // not loaded yet when it had to play
+} sample_bank_stats_t;
+
+
+// Samples are loaded from directory (the beatmap folder) and converted to sample_rate once.
+// A background thread follows the playback position along the schedule and loads what
+// is needed next, unloading the least recently used samples once over budget bytes.
+bool sample_bank_init(const char* directory, int sample_rate, size_t budget);
+void sample_bank_shutdown();
+
+// Returns the id of a sample, the same filename always gets the same id. Returns -1 for
+// files that don't exist. Only before sample_bank_start().
+int sample_bank_add(const char* filename);
+// Announces that a sample plays at time (seconds), which is what prefetching goes by.
+void sample_bank_schedule(int id, double time);
+
+// Starts the prefetch thread and waits until the samples of the first seconds are loaded.
+bool sample_bank_start();
+// Called by the simulation thread with the playback position.
+void sample_bank_update(double playback_pos);
+
+// Takes a reference for the mixer, or returns NULL when the sample is not loaded (yet).
+// Simulation thread only.
+sample_t* sample_bank_acquire(int id);
+// Lock-free, can be called from the audio callback.
+void sample_bank_release(sample_t* sample);
+
+sample_bank_stats_t sample_bank_stats();
+
+
+#endif
@@ -0,0 +1,297 @@
+#include <stretch.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define SCOPE_NAME "stretch"
+#include <logging.h>
+
+
+static bool _fill(stretch_t* stretch, int64_t keep_start, int64_t need_end);
+static bool _step_tempo(stretch_t* stretch);
+static bool _step_nightcore(stretch_t* stretch);
+static int _best_offset(const stretch_t* stretch, int64_t template_start, int64_t center);
+static float _dot(const float* a, const float* b, int count);
+static float _cubic(float a, float b, float c, float d, float t);
+
+
+bool stretch_mode_from_name(const char* name, stretch_mode_t* mode, double* rate) {
+    if (strcmp(name, "dt") == 0) {
+        *mode = STRETCH_TEMPO;
+        *rate = 1.5;
+        return true;
+    }
+    if (strcmp(name, "ht") == 0) {
+        *mode = STRETCH_TEMPO;
+        *rate = 0.75;
+        return true;
+    }
+    if (strcmp(name, "nc") == 0) {
+        *mode = STRETCH_NIGHTCORE;
+        *rate = 1.5;
+        return true;
+    }
+
+    char* end = NULL;
+    double value = strtod(name, &end);
+    if (end == name || *end != '\0' || value < STRETCH_MIN_RATE || value > STRETCH_MAX_RATE)
+        return false;
+    *mode = STRETCH_TEMPO;
+    *rate = value;
+    return true;
+}
+
+bool stretch_init(stretch_t* stretch, int sample_rate, stretch_mode_t mode, double rate, stretch_read_f read, void* user) {
+    *stretch = (stretch_t) {
+        .mode = mode,
+        .rate = CONSTRAIN(rate, STRETCH_MIN_RATE, STRETCH_MAX_RATE),
+        .read = read,
+        .user = user,
+        .hop = max(16, (int)(STRETCH_FRAME * sample_rate / 2)),
+        .seek = max(1, (int)(STRETCH_SEEK * sample_rate)),
+    };
+    stretch->frame_size = stretch->hop * 2;
+
+    // a step keeps the search range, the frame and one hop at the fastest rate
+    stretch->capacity = stretch->frame_size + 2 * stretch->seek + (int)ceil(stretch->hop * STRETCH_MAX_RATE) + 8;
+    stretch->window = malloc(stretch->frame_size * sizeof(float));
+    stretch->input = malloc(stretch->capacity * STRETCH_CHANNELS * sizeof(float));
+    stretch->mono = malloc(stretch->capacity * sizeof(float));
+    stretch->overlap = malloc(stretch->hop * STRETCH_CHANNELS * sizeof(float));
+    stretch->output = malloc(stretch->hop * STRETCH_CHANNELS * sizeof(float));
+    if (!stretch->window || !stretch->input || !stretch->mono || !stretch->overlap || !stretch->output) {
+        LOG("Failed to allocate the stretch buffers");
+        stretch_destroy(stretch);
+        return false;
+    }
+
+    // periodic Hann, two windows half a frame apart add up to one
+    for (int i = 0; i < stretch->frame_size; i++)
+        stretch->window[i] = 0.5f - 0.5f * cosf(2 * (float)M_PI * i / stretch->frame_size);
+
+    stretch_reset(stretch, 0);
+    return true;
+}
+
+void stretch_destroy(stretch_t* stretch) {
+    free(stretch->window);
+    free(stretch->input);
+    free(stretch->mono);
+    free(stretch->overlap);
+    free(stretch->output);
+    *stretch = (stretch_t){0};
+}
+
+void stretch_reset(stretch_t* stretch, uint64_t frame) {
+    stretch->input_count = 0;
+    stretch->input_start = frame;
+    stretch->end = 0;
+    stretch->has_ended = false;
+    stretch->position = frame;
+    stretch->previous = -1;
+    stretch->output_count = 0;
+    stretch->output_offset = 0;
+    stretch->output_position = frame;
+    stretch->output_rate = stretch->rate;
+    memset(stretch->overlap, 0, stretch->hop * STRETCH_CHANNELS * sizeof(float));
+}
+
+void stretch_set_rate(stretch_t* stretch, double rate) {
+    stretch->rate = CONSTRAIN(rate, STRETCH_MIN_RATE, STRETCH_MAX_RATE);
+}
+
+int stretch_process(stretch_t* stretch, float* frames, int count) {
+    int done = 0;
+    while (done < count) {
+        if (stretch->output_offset == stretch->output_count) {
+            if (stretch_is_finished(stretch))
+                break;
+            bool ok = (stretch->mode == STRETCH_TEMPO) ? _step_tempo(stretch) : _step_nightcore(stretch);
+            if (!ok)
+                break;
+            continue;
+        }
+
+        int n = min(count - done, stretch->output_count - stretch->output_offset);
+        memcpy(
+            frames + done * STRETCH_CHANNELS,
+            stretch->output + stretch->output_offset * STRETCH_CHANNELS,
+            n * STRETCH_CHANNELS * sizeof(float)
+        );
+        stretch->output_offset += n;
+        done += n;
+    }
+    return done;
+}
+
+double stretch_position(const stretch_t* stretch) {
+    double position = stretch->output_position + stretch->output_offset * stretch->output_rate;
+    return (stretch->has_ended) ? min(position, (double)stretch->end) : position;
+}
+
+bool stretch_is_finished(const stretch_t* stretch) {
+    return stretch->has_ended
+        && stretch->output_offset == stretch->output_count
+        && stretch->position >= stretch->end;
+}
+
+bool _fill(stretch_t* stretch, int64_t keep_start, int64_t need_end) {
+    // drops what no step will look at again
+    int drop = CONSTRAIN(keep_start - stretch->input_start, 0, stretch->input_count);
+    if (drop > 0) {
+        stretch->input_count -= drop;
+        stretch->input_start += drop;
+        memmove(stretch->input, stretch->input + drop * STRETCH_CHANNELS, stretch->input_count * STRETCH_CHANNELS * sizeof(float));
+        memmove(stretch->mono, stretch->mono + drop, stretch->input_count * sizeof(float));
+    }
+
+    int want = min(need_end - stretch->input_start, stretch->capacity) - stretch->input_count;
+    while (want > 0 && !stretch->has_ended) {
+        float* dest = stretch->input + stretch->input_count * STRETCH_CHANNELS;
+        int read = stretch->read(stretch->user, dest, want);
+        if (read < 0) {
+            stretch->has_ended = true;
+            stretch->end = stretch->input_start + stretch->input_count;
+            break;
+        }
+        if (read == 0)
+            return false;
+
+        for (int i = 0; i < read; i++)
+            stretch->mono[stretch->input_count + i] = dest[i * 2] + dest[i * 2 + 1];
+        stretch->input_count += read;
+        want -= read;
+    }
+
+    // past the end of the source there is only silence
+    if (want > 0) {
+        memset(stretch->input + stretch->input_count * STRETCH_CHANNELS, 0, want * STRETCH_CHANNELS * sizeof(float));
+        memset(stretch->mono + stretch->input_count, 0, want * sizeof(float));
+        stretch->input_count += want;
+    }
+    return true;
+}
+
+bool _step_tempo(stretch_t* stretch) {
+    int hop = stretch->hop;
+    int64_t center = llround(stretch->position);
+    int64_t keep_start = center - stretch->seek;
+    if (stretch->previous >= 0)
+        keep_start = min(keep_start, stretch->previous + hop);
+
+    if (!_fill(stretch, keep_start, center + stretch->seek + stretch->frame_size))
+        return false;
+
+    // the frame that sounds most like the continuation of the previous one
+    int64_t start = center;
+    if (stretch->previous >= 0)
+        start += _best_offset(stretch, stretch->previous + hop, center);
+    start = CONSTRAIN(start, stretch->input_start, stretch->input_start + stretch->input_count - stretch->frame_size);
+
+    const float* src = stretch->input + (start - stretch->input_start) * STRETCH_CHANNELS;
+    const float* window = stretch->window;
+    for (int i = 0; i < hop; i++) {
+        for (int c = 0; c < STRETCH_CHANNELS; c++) {
+            int k = i * STRETCH_CHANNELS + c;
+            stretch->output[k] = stretch->overlap[k] + src[k] * window[i];
+            stretch->overlap[k] = src[hop * STRETCH_CHANNELS + k] * window[hop + i];
+        }
+    }
+
+    stretch->output_count = hop;
+    stretch->output_offset = 0;
+    stretch->output_position = stretch->position;
+    stretch->output_rate = stretch->rate;
+    stretch->previous = start;
+    stretch->position += hop * stretch->rate;
+    return true;
+}
+
+bool _step_nightcore(stretch_t* stretch) {
+    int hop = stretch->hop;
+    double rate = stretch->rate;
+    int64_t first = (int64_t)floor(stretch->position) - 1;
+    int64_t last = (int64_t)floor(stretch->position + (hop - 1) * rate) + 2;
+
+    if (!_fill(stretch, first, last + 1))
+        return false;
+
+    // Catmull-Rom between the two nearest frames, edges repeat the first frame after a reset
+    int64_t lo = stretch->input_start, hi = stretch->input_start + stretch->input_count - 1;
+    for (int i = 0; i < hop; i++) {
+        double p = stretch->position + i * rate;
+        int64_t base = (int64_t)floor(p);
+        float t = (float)(p - base);
+        for (int c = 0; c < STRETCH_CHANNELS; c++) {
+            float s[4];
+            for (int k = 0; k < 4; k++) {
+                int64_t frame = CONSTRAIN(base - 1 + k, lo, hi);
+                s[k] = stretch->input[(frame - lo) * STRETCH_CHANNELS + c];
+            }
+            stretch->output[i * STRETCH_CHANNELS + c] = _cubic(s[0], s[1], s[2], s[3], t);
+        }
+    }
+
+    stretch->output_count = hop;
+    stretch->output_offset = 0;
+    stretch->output_position = stretch->position;
+    stretch->output_rate = rate;
+    stretch->position += hop * rate;
+    return true;
+}
+
+int _best_offset(const stretch_t* stretch, int64_t template_start, int64_t center) {
+    // normalized cross-correlation of the overlapping half against every candidate start
+    int length = stretch->hop;
+    int64_t lo = max(center - stretch->seek, stretch->input_start);
+    int64_t hi = min(center + stretch->seek, stretch->input_start + stretch->input_count - stretch->frame_size);
+    if (hi <= lo || template_start < stretch->input_start)
+        return 0;
+
+    const float* pattern = stretch->mono + (template_start - stretch->input_start);
+    const float* candidates = stretch->mono + (lo - stretch->input_start);
+
+    double energy = _dot(candidates, candidates, length);
+    double best_score = -INFINITY;
+    int best = 0;
+    for (int k = 0; k <= hi - lo; k++) {
+        double correlation = _dot(pattern, candidates + k, length);
+        double score = correlation / sqrt(max(energy, 1e-9));
+        if (score > best_score) {
+            best_score = score;
+            best = k;
+        }
+        // slides the energy window by one frame
+        energy += (double)candidates[k + length] * candidates[k + length] - (double)candidates[k] * candidates[k];
+    }
+    return (int)(lo + best - center);
+}
+
+float _dot(const float* a, const float* b, int count) {
+    int i = 0;
+    float sum = 0;
+#if defined(__SSE2__)
+    // two accumulators hide the latency of the adds
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (; i + 8 <= count; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < count; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+float _cubic(float a, float b, float c, float d, float t) {
+    return b + 0.5f * t * (c - a + t * (2 * a - 5 * b + 4 * c - d + t * (3 * (b - c) + d - a)));
+}
@@ -0,0 +1,87 @@
+#ifndef STRETCH_H
+#define STRETCH_H
+
+#include <stdint.h>
+
+#include <defines.h>
+
+#define STRETCH_CHANNELS 2
+
+#define STRETCH_MIN_RATE 0.5
+#define STRETCH_MAX_RATE 2.0
+
+// Length of a WSOLA frame in seconds, frames overlap by half
+#ifndef STRETCH_FRAME
+#define STRETCH_FRAME 0.04
+#endif
+
+// How far from its nominal position a frame may be taken to line up with the previous one.
+// Also the most the audio can be ahead or behind of the reported position.
+#ifndef STRETCH_SEEK
+#define STRETCH_SEEK 0.01
+#endif
+
+
+typedef enum {
+    STRETCH_TEMPO,      // WSOLA, the pitch stays the same
+    STRETCH_NIGHTCORE,  // resampled, the pitch follows the rate
+} stretch_mode_t;
+
+// Pulls up to count frames of the source, returns how many were read or -1 once the source
+// has ended. Reading less than count means nothing more is available right now.
+typedef int (*stretch_read_f)(void* user, float* frames, int count);
+
+// Plays interleaved float stereo at a different rate. The source is pulled on demand, so
+// it has to be readable from the thread calling stretch_process().
+typedef struct stretch_s {
+    stretch_mode_t  mode;
+    double          rate;
+    stretch_read_f  read;
+    void*           user;
+
+    int             frame_size;
+    int             hop;                // output frames per step
+    int             seek;
+    float*          window;
+
+    // source frames [input_start, input_start + input_count), downmixed for the search
+    float*          input;
+    float*          mono;
+    int             input_count;
+    int             capacity;
+    int64_t         input_start;
+    int64_t         end;                // source length, known once the source has ended
+    bool            has_ended;
+
+    double          position;           // source frame of the next step
+    int64_t         previous;           // source frame of the last WSOLA frame, -1 after a reset
+    float*          overlap;            // second half of the last windowed frame
+    float*          output;             // finished frames of the last step
+    int             output_count;
+    int             output_offset;
+    double          output_position;    // source frame of output[0]
+    double          output_rate;        // rate the output was made with
+} stretch_t;
+
+
+// Accepts a rate ("0.8"), which keeps the pitch, or a mod: "dt" (1.5), "ht" (0.75) and
+// "nc" (1.5 nightcore).
+bool stretch_mode_from_name(const char* name, stretch_mode_t* mode, double* rate);
+
+bool stretch_init(stretch_t* stretch, int sample_rate, stretch_mode_t mode, double rate, stretch_read_f read, void* user);
+void stretch_destroy(stretch_t* stretch);
+
+// Starts over at a source frame, the source has to continue from there as well.
+void stretch_reset(stretch_t* stretch, uint64_t frame);
+// Applies from the next step on, without a gap.
+void stretch_set_rate(stretch_t* stretch, double rate);
+
+// Returns the number of frames written, less than count when the source ran dry or ended.
+int stretch_process(stretch_t* stretch, float* frames, int count);
+
+// Source frame of the next frame stretch_process() writes.
+double stretch_position(const stretch_t* stretch);
+bool stretch_is_finished(const stretch_t* stretch);
+
+
+#endif
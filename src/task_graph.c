@@ -0,0 +1,213 @@
+#include <task_graph.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <timer.h>
+#define SCOPE_NAME "tasks"
+#include <logging.h>
+
+
+typedef struct worker_s {
+    task_graph_t*   graph;
+    int             index;
+} worker_t;
+
+static void* _worker_thread(void* arg);
+static int _next_task(task_graph_t* graph, int thread);
+static int _critical_dependency(const task_graph_t* graph, int task);
+
+
+void task_graph_init(task_graph_t* graph) {
+    *graph = (task_graph_t){0};
+    pthread_mutex_init(&graph->lock, NULL);
+    pthread_cond_init(&graph->changed, NULL);
+}
+
+void task_graph_destroy(task_graph_t* graph) {
+    pthread_mutex_destroy(&graph->lock);
+    pthread_cond_destroy(&graph->changed);
+}
+
+int task_graph_add(task_graph_t* graph, const char* name, task_f run, void* data, const int* dependencies, int dependency_count) {
+    if (graph->task_count >= TASK_GRAPH_MAX_TASKS || dependency_count > TASK_GRAPH_MAX_DEPENDENCIES) {
+        LOGF("Can not add task \"%s\"", name);
+        graph->is_invalid = true;
+        return -1;
+    }
+
+    int id = graph->task_count;
+    task_t* task = &graph->tasks[id];
+    *task = (task_t) {
+        .name = name,
+        .run = run,
+        .data = data,
+        .dependency_count = dependency_count,
+    };
+    for (int i = 0; i < dependency_count; i++) {
+        // -1 from a task that could not be added, or one added later
+        if (dependencies[i] < 0 || dependencies[i] >= id) {
+            LOGF("Task \"%s\" has an invalid dependency", name);
+            graph->is_invalid = true;
+            return -1;
+        }
+        task->dependencies[i] = dependencies[i];
+    }
+    graph->task_count++;
+    return id;
+}
+
+void task_graph_pin(task_graph_t* graph, int task) {
+    if (task >= 0 && task < graph->task_count)
+        graph->tasks[task].is_pinned = true;
+}
+
+bool task_graph_run(task_graph_t* graph, int threads) {
+    if (graph->is_invalid)
+        return false;
+    if (threads <= 0)
+        threads = graph->task_count;
+    threads = max(1, min(threads, TASK_GRAPH_MAX_THREADS));
+
+    graph->remaining = graph->task_count;
+    graph->start = timer_now();
+    for (int i = 0; i < graph->task_count; i++)
+        graph->tasks[i].state = TASK_WAITING;
+
+    pthread_t pool[TASK_GRAPH_MAX_THREADS];
+    worker_t workers[TASK_GRAPH_MAX_THREADS];
+    int started = 0;
+    for (int i = 0; i < threads; i++)
+        workers[i] = (worker_t) { graph, i };
+    while (started < threads - 1 && pthread_create(&pool[started], NULL, _worker_thread, &workers[started + 1]) == 0)
+        started++;
+
+    // the calling thread runs tasks as well, so all of them run even without a pool
+    graph->thread_count = started + 1;
+    _worker_thread(&workers[0]);
+    for (int i = 0; i < started; i++)
+        pthread_join(pool[i], NULL);
+    graph->end = timer_now() - graph->start;
+
+    bool ok = true;
+    for (int i = 0; i < graph->task_count; i++)
+        ok = ok && graph->tasks[i].state == TASK_DONE;
+    return ok;
+}
+
+void task_graph_log_trace(const task_graph_t* graph) {
+    static const char* states[] = { "waiting", "running", "done", "FAILED", "skipped" };
+
+    // walked back from the task that finished last, through the dependency each one waited for last
+    bool is_critical[TASK_GRAPH_MAX_TASKS] = {false};
+    int last = -1;
+    for (int i = 0; i < graph->task_count; i++)
+        if (graph->tasks[i].state == TASK_DONE && (last < 0 || graph->tasks[i].end > graph->tasks[last].end))
+            last = i;
+    char path[512] = {'\0'};
+    for (int task = last; task >= 0; task = _critical_dependency(graph, task)) {
+        is_critical[task] = true;
+        char link[512];
+        snprintf(link, STACKARRAY_SIZE(link), "%s%s%s", graph->tasks[task].name, (path[0]) ? " > " : "", path);
+        snprintf(path, STACKARRAY_SIZE(path), "%s", link);
+    }
+
+    LOGF("%d tasks in %.3f s, critical path %s", graph->task_count, graph->end, (path[0]) ? path : "none");
+    for (int i = 0; i < graph->task_count; i++) {
+        const task_t* task = &graph->tasks[i];
+        if (task->state != TASK_DONE && task->state != TASK_FAILED) {
+            LOGF("  %-12s %s", task->name, states[task->state]);
+            continue;
+        }
+        LOGF(
+            "%c %-12s %7.3f .. %7.3f s  %6.1f ms  thread %d  %s",
+            (is_critical[i]) ? '*' : ' ',
+            task->name,
+            task->start,
+            task->end,
+            (task->end - task->start) * 1000,
+            task->thread,
+            states[task->state]
+        );
+    }
+}
+
+void* _worker_thread(void* arg) {
+    worker_t* worker = arg;
+    task_graph_t* graph = worker->graph;
+
+    pthread_mutex_lock(&graph->lock);
+    while (graph->remaining > 0) {
+        int id = _next_task(graph, worker->index);
+        if (id < 0) {
+            pthread_cond_wait(&graph->changed, &graph->lock);
+            continue;
+        }
+
+        task_t* task = &graph->tasks[id];
+        if (task->state == TASK_SKIPPED) {
+            graph->remaining--;
+            pthread_cond_broadcast(&graph->changed);
+            continue;
+        }
+
+        task->state = TASK_RUNNING;
+        task->thread = worker->index;
+        task->start = timer_now() - graph->start;
+        pthread_mutex_unlock(&graph->lock);
+
+        bool ok = task->run(task->data);
+
+        pthread_mutex_lock(&graph->lock);
+        task->end = timer_now() - graph->start;
+        task->state = (ok) ? TASK_DONE : TASK_FAILED;
+        if (!ok)
+            LOGF("Task \"%s\" failed", task->name);
+        graph->remaining--;
+        pthread_cond_broadcast(&graph->changed);
+    }
+    pthread_mutex_unlock(&graph->lock);
+    return NULL;
+}
+
+int _next_task(task_graph_t* graph, int thread) {
+    // called with the lock held. The calling thread stays free for pinned tasks, unless nobody
+    // else would run the rest.
+    bool is_pinned_waiting = false;
+    for (int i = 0; i < graph->task_count && thread == 0 && graph->thread_count > 1; i++)
+        is_pinned_waiting = is_pinned_waiting || (graph->tasks[i].is_pinned && graph->tasks[i].state == TASK_WAITING);
+
+    // a task whose dependency did not succeed is handed out to be skipped
+    for (int i = 0; i < graph->task_count; i++) {
+        task_t* task = &graph->tasks[i];
+        if (task->state != TASK_WAITING)
+            continue;
+        if ((task->is_pinned && thread != 0) || (!task->is_pinned && is_pinned_waiting))
+            continue;
+
+        bool is_ready = true;
+        bool is_skipped = false;
+        for (int j = 0; j < task->dependency_count; j++) {
+            task_state_t state = graph->tasks[task->dependencies[j]].state;
+            is_ready = is_ready && state != TASK_WAITING && state != TASK_RUNNING;
+            is_skipped = is_skipped || state == TASK_FAILED || state == TASK_SKIPPED;
+        }
+        if (is_skipped) {
+            task->state = TASK_SKIPPED;
+            return i;
+        }
+        if (is_ready)
+            return i;
+    }
+    return -1;
+}
+
+int _critical_dependency(const task_graph_t* graph, int task) {
+    int latest = -1;
+    for (int i = 0; i < graph->tasks[task].dependency_count; i++) {
+        int dependency = graph->tasks[task].dependencies[i];
+        if (latest < 0 || graph->tasks[dependency].end > graph->tasks[latest].end)
+            latest = dependency;
+    }
+    return latest;
+}
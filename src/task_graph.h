@@ -0,0 +1,79 @@
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+
+#include <pthread.h>
+
+#include <defines.h>
+
+#ifndef TASK_GRAPH_MAX_TASKS
+#define TASK_GRAPH_MAX_TASKS 32
+#endif
+
+#ifndef TASK_GRAPH_MAX_DEPENDENCIES
+#define TASK_GRAPH_MAX_DEPENDENCIES 4
+#endif
+
+#ifndef TASK_GRAPH_MAX_THREADS
+#define TASK_GRAPH_MAX_THREADS 16
+#endif
+
+
+// Returns false when the task failed, the tasks depending on it are skipped then
+typedef bool (*task_f)(void* data);
+
+typedef enum {
+    TASK_WAITING,
+    TASK_RUNNING,
+    TASK_DONE,
+    TASK_FAILED,
+    TASK_SKIPPED,
+} task_state_t;
+
+typedef struct task_s {
+    const char*     name;
+    task_f          run;
+    void*           data;
+    int             dependencies[TASK_GRAPH_MAX_DEPENDENCIES];
+    int             dependency_count;
+    bool            is_pinned;  // only runs on the thread that called task_graph_run()
+    task_state_t    state;
+    double          start;      // seconds since task_graph_run() started
+    double          end;
+    int             thread;     // 0 is the thread that called task_graph_run()
+} task_t;
+
+typedef struct task_graph_s {
+    task_t          tasks[TASK_GRAPH_MAX_TASKS];
+    int             task_count;
+    int             remaining;
+    int             thread_count;
+    double          start;
+    double          end;
+    bool            is_invalid;     // a task could not be added, nothing runs
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+} task_graph_t;
+
+
+void task_graph_init(task_graph_t* graph);
+void task_graph_destroy(task_graph_t* graph);
+
+// Adds a task that runs once all of its dependencies are done, they must have been added
+// before it. Of the tasks ready at a time the one added first starts first. Returns the id
+// of the task, -1 when the graph is full, which makes task_graph_run() fail.
+int task_graph_add(task_graph_t* graph, const char* name, task_f run, void* data, const int* dependencies, int dependency_count);
+// Makes the task run on the thread that calls task_graph_run(), for APIs that only work on
+// the main thread. That thread leaves the other tasks to the pool while one is waiting.
+void task_graph_pin(task_graph_t* graph, int task);
+
+// Runs every task on up to threads threads, the calling one included, and returns once all
+// of them are done or skipped. 0 runs as many as there are tasks, startup tasks mostly wait
+// on the OS and drivers rather than use a core. Returns false when a task failed.
+bool task_graph_run(task_graph_t* graph, int threads);
+
+// Logs when every task ran and on which thread, and the chain of tasks that took the
+// longest, the critical path, which nothing but speeding one of them up makes shorter.
+void task_graph_log_trace(const task_graph_t* graph);
+
+
+#endif
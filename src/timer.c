@@ -0,0 +1,34 @@
+#include <timer.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_RELAX() _mm_pause()
+#else
+#define CPU_RELAX()
+#endif
+
+
+static _Thread_local double s_spin_margin = 0.0005;
+
+void timer_wait_until(double deadline) {
+    double now = timer_now();
+
+    while (deadline - now > s_spin_margin) {
+        double requested = deadline - now - s_spin_margin;
+        timer_sleep(requested);
+
+        double after = timer_now();
+        double oversleep = (after - now) - requested;
+        now = after;
+
+        // grow quickly when the scheduler is late, shrink slowly when it is on time
+        if (oversleep > s_spin_margin)
+            s_spin_margin = oversleep * 1.25;
+        else
+            s_spin_margin = s_spin_margin * 0.95 + oversleep * 0.05;
+        s_spin_margin = CONSTRAIN(s_spin_margin, TIMER_SPIN_MARGIN_MIN, TIMER_SPIN_MARGIN_MAX);
+    }
+
+    while (timer_now() < deadline)
+        CPU_RELAX();
+}
@@ -0,0 +1,26 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <defines.h>
+
+#ifndef TIMER_SPIN_MARGIN_MIN
+#define TIMER_SPIN_MARGIN_MIN 0.0001
+#endif
+
+#ifndef TIMER_SPIN_MARGIN_MAX
+#define TIMER_SPIN_MARGIN_MAX 0.002
+#endif
+
+
+// Monotonic high resolution clock in seconds. On Linux this is CLOCK_MONOTONIC,
+// the same clock evdev devices are switched to, so their timestamps compare directly.
+double timer_now();
+void timer_sleep(double seconds);
+
+// Sleeps until shortly before the deadline and spins for the rest. The spin margin adapts
+// to how much the OS scheduler has been oversleeping, so usually only a fraction of a
+// millisecond is spent spinning.
+void timer_wait_until(double deadline);
+
+
+#endif
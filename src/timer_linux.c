@@ -0,0 +1,21 @@
+#include <timer.h>
+
+#include <time.h>
+
+
+double timer_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void timer_sleep(double seconds) {
+    if (seconds <= 0)
+        return;
+
+    struct timespec ts = {
+        .tv_sec = (time_t)seconds,
+        .tv_nsec = (long)((seconds - (time_t)seconds) * 1e9),
+    };
+    clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+}
@@ -0,0 +1,39 @@
+#include <timer.h>
+
+#include <windows.h>
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+
+double timer_now() {
+    static LARGE_INTEGER frequency = {0};
+    LARGE_INTEGER counter;
+
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / frequency.QuadPart;
+}
+
+void timer_sleep(double seconds) {
+    static __thread HANDLE timer = NULL;
+
+    if (seconds <= 0)
+        return;
+
+    // high resolution waitable timers (Windows 10 1803+) avoid the 1-15 ms Sleep() granularity
+    if (timer == NULL)
+        timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+
+    if (timer == NULL) {
+        Sleep((DWORD)(seconds * 1000));
+        return;
+    }
+
+    LARGE_INTEGER due;
+    due.QuadPart = -(LONGLONG)(seconds * 1e7);
+    SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE);
+    WaitForSingleObject(timer, INFINITE);
+}
@@ -0,0 +1,51 @@
+#include <triple_buffer.h>
+
+#define TRIPLE_BUFFER_FRESH     0x4
+#define TRIPLE_BUFFER_EMPTY     0x8
+#define TRIPLE_BUFFER_INDEX     0x3
+
+
+void triple_buffer_init(triple_buffer_t* buffer, void* a, void* b, void* c) {
+    buffer->slots[0] = a;
+    buffer->slots[1] = b;
+    buffer->slots[2] = c;
+    buffer->write = 0;
+    buffer->read = 2 | TRIPLE_BUFFER_EMPTY;
+    atomic_init(&buffer->middle, 1);
+}
+
+void* triple_buffer_write_slot(triple_buffer_t* buffer) {
+    return buffer->slots[buffer->write];
+}
+
+void triple_buffer_publish(triple_buffer_t* buffer) {
+    int previous = atomic_exchange_explicit(
+        &buffer->middle,
+        buffer->write | TRIPLE_BUFFER_FRESH,
+        memory_order_acq_rel
+    );
+    buffer->write = previous & TRIPLE_BUFFER_INDEX;
+}
+
+const void* triple_buffer_read(triple_buffer_t* buffer, bool* is_fresh) {
+    bool fresh = atomic_load_explicit(&buffer->middle, memory_order_relaxed) & TRIPLE_BUFFER_FRESH;
+
+    if (fresh) {
+        int previous = atomic_exchange_explicit(
+            &buffer->middle,
+            buffer->read & TRIPLE_BUFFER_INDEX,
+            memory_order_acq_rel
+        );
+        buffer->read = previous & TRIPLE_BUFFER_INDEX;
+    }
+
+    if (is_fresh)
+        *is_fresh = fresh;
+    if (buffer->read & TRIPLE_BUFFER_EMPTY)
+        return NULL;
+    return buffer->slots[buffer->read & TRIPLE_BUFFER_INDEX];
+}
+
+bool triple_buffer_has_fresh(triple_buffer_t* buffer) {
+    return atomic_load(&buffer->middle) & TRIPLE_BUFFER_FRESH;
+}
@@ -0,0 +1,30 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stdatomic.h>
+
+#include <defines.h>
+
+
+// Lock-free triple buffer: one writer always has a slot to fill, one reader always gets
+// the most recently published slot, neither of them ever waits for the other.
+typedef struct triple_buffer_s {
+    void*       slots[3];
+    int         write;      // owned by the writer
+    int         read;       // owned by the reader
+    atomic_int  middle;     // slot index | TRIPLE_BUFFER_FRESH
+} triple_buffer_t;
+
+
+void triple_buffer_init(triple_buffer_t* buffer, void* a, void* b, void* c);
+
+void* triple_buffer_write_slot(triple_buffer_t* buffer);
+void triple_buffer_publish(triple_buffer_t* buffer);
+
+// Returns the latest published slot, or NULL if nothing was ever published.
+// is_fresh is set when the slot changed since the previous call.
+const void* triple_buffer_read(triple_buffer_t* buffer, bool* is_fresh);
+bool triple_buffer_has_fresh(triple_buffer_t* buffer);
+
+
+#endif
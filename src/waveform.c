@@ -0,0 +1,288 @@
+#include <waveform.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <raylib.h>
+#include <kvec.h>
+
+#include <decoder.h>
+#include <pcm_cache.h>
+#include <timer.h>
+#define SCOPE_NAME "waveform"
+#include <logging.h>
+
+#define CACHE_MAGIC 0x31564157u // "WAV1"
+
+// Frames decoded at once while building
+#define READ_FRAMES 4096
+
+
+typedef struct cache_header_s {
+    uint32_t    magic;
+    uint32_t    base_frames;
+    uint32_t    sample_rate;
+    uint32_t    base_count;     // buckets of the finest level, the others follow from it
+    uint64_t    frame_count;
+} cache_header_t;
+
+static void* _load_thread(void* arg);
+static bool _build(waveform_t* waveform);
+static bool _set_levels(waveform_t* waveform, int base_count);
+static bool _load_cache(waveform_t* waveform, const char* cache_filepath);
+static void _store_cache(const waveform_t* waveform, const char* cache_filepath);
+static int16_t _quantize(float value);
+
+
+bool waveform_load(waveform_t* waveform, const char* filepath, const char* cache_directory) {
+    *waveform = (waveform_t){0};
+    snprintf(waveform->filepath, STACKARRAY_SIZE(waveform->filepath), "%s", filepath);
+    snprintf(waveform->cache_directory, STACKARRAY_SIZE(waveform->cache_directory), "%s", (cache_directory) ? cache_directory : "");
+
+    // even hashing the file for the cache name is left to the thread
+    if (pthread_create(&waveform->thread, NULL, _load_thread, waveform) != 0) {
+        LOG("Failed to start the waveform thread");
+        return false;
+    }
+    waveform->has_thread = true;
+    return true;
+}
+
+void waveform_destroy(waveform_t* waveform) {
+    if (waveform->has_thread) {
+        atomic_store(&waveform->quit, true);
+        pthread_join(waveform->thread, NULL);
+    }
+    free(waveform->buckets);
+    *waveform = (waveform_t){0};
+}
+
+bool waveform_is_ready(const waveform_t* waveform) {
+    return atomic_load_explicit(&waveform->is_ready, memory_order_acquire);
+}
+
+bool waveform_columns(const waveform_t* waveform, double start, double pixels_per_second, waveform_column_t* columns, int count) {
+    if (!waveform_is_ready(waveform) || pixels_per_second <= 0)
+        return false;
+
+    // the coarsest level with buckets no longer than a column, so a column spans at most a few
+    double frames_per_column = waveform->sample_rate / pixels_per_second;
+    int level = 0;
+    while (level + 1 < waveform->level_count && (double)((uint64_t)WAVEFORM_BASE_FRAMES << (level + 1)) <= frames_per_column)
+        level++;
+    double bucket_frames = (double)((uint64_t)WAVEFORM_BASE_FRAMES << level);
+    const waveform_bucket_t* buckets = waveform->levels[level];
+    int64_t bucket_count = waveform->counts[level];
+
+    double frame = start * waveform->sample_rate;
+    for (int i = 0; i < count; i++) {
+        double x = frame + i * frames_per_column;
+        int64_t first = max((int64_t)floor(x / bucket_frames), 0);
+        int64_t last = min((int64_t)ceil((x + frames_per_column) / bucket_frames), bucket_count);
+        if (first >= last) {
+            columns[i] = (waveform_column_t){0};
+            continue;
+        }
+
+        int lo = INT16_MAX, hi = INT16_MIN;
+        double sum = 0;
+        for (int64_t b = first; b < last; b++) {
+            lo = min(lo, buckets[b].min);
+            hi = max(hi, buckets[b].max);
+            sum += (double)buckets[b].rms * buckets[b].rms;
+        }
+        columns[i] = (waveform_column_t) {
+            lo / 32767.0f,
+            hi / 32767.0f,
+            (float)(sqrt(sum / (last - first)) / 32767.0),
+        };
+    }
+    return true;
+}
+
+void* _load_thread(void* arg) {
+    waveform_t* waveform = arg;
+
+    char cache_filepath[512] = {'\0'};
+    if (waveform->cache_directory[0])
+        pcm_cache_filepath(waveform->filepath, waveform->cache_directory, "wave", cache_filepath, STACKARRAY_SIZE(cache_filepath));
+
+    double start = timer_now();
+    bool is_cached = cache_filepath[0] && _load_cache(waveform, cache_filepath);
+    if (!is_cached && !_build(waveform))
+        return NULL;
+    if (!is_cached && cache_filepath[0])
+        _store_cache(waveform, cache_filepath);
+
+    LOGF(
+        "%d levels, %d buckets, %s in %.3f s",
+        waveform->level_count,
+        waveform->counts[0],
+        (is_cached) ? "loaded" : "built",
+        timer_now() - start
+    );
+    atomic_store_explicit(&waveform->is_ready, true, memory_order_release);
+    return NULL;
+}
+
+bool _build(waveform_t* waveform) {
+    decoder_t decoder;
+    if (!decoder_open(&decoder, waveform->filepath, NULL))
+        return false;
+
+    float* frames = malloc(READ_FRAMES * DECODER_CHANNELS * sizeof(float));
+    if (!frames) {
+        decoder_close(&decoder);
+        return false;
+    }
+
+    // the finest level straight from the decoded frames, a bucket can span two reads
+    kvec_t(waveform_bucket_t) base;
+    kv_init(base);
+    float lo = 0, hi = 0;
+    double sum = 0;
+    int filled = 0;
+    uint64_t frame_count = 0;
+    int read;
+    while (!atomic_load(&waveform->quit) && (read = decoder_read(&decoder, frames, READ_FRAMES)) > 0) {
+        for (int i = 0; i < read; i++) {
+            float x = 0.5f * (frames[i * DECODER_CHANNELS] + frames[i * DECODER_CHANNELS + 1]);
+            lo = (filled == 0) ? x : min(lo, x);
+            hi = (filled == 0) ? x : max(hi, x);
+            sum += (double)x * x;
+            if (++filled == WAVEFORM_BASE_FRAMES) {
+                waveform_bucket_t bucket = { _quantize(lo), _quantize(hi), (uint16_t)_quantize(sqrtf(sum / filled)) };
+                kv_push(waveform_bucket_t, base, bucket);
+                filled = 0;
+                sum = 0;
+            }
+        }
+        frame_count += read;
+    }
+    if (filled > 0) {
+        waveform_bucket_t bucket = { _quantize(lo), _quantize(hi), (uint16_t)_quantize(sqrtf(sum / filled)) };
+        kv_push(waveform_bucket_t, base, bucket);
+    }
+
+    waveform->sample_rate = decoder.sample_rate;
+    waveform->frame_count = frame_count;
+    free(frames);
+    decoder_close(&decoder);
+
+    bool ok = !atomic_load(&waveform->quit) && kv_size(base) > 0 && _set_levels(waveform, kv_size(base));
+    if (ok) {
+        memcpy(waveform->levels[0], base.a, kv_size(base) * sizeof(waveform_bucket_t));
+
+        // every bucket above covers two below it
+        for (int level = 1; level < waveform->level_count; level++) {
+            const waveform_bucket_t* below = waveform->levels[level - 1];
+            int below_count = waveform->counts[level - 1];
+            for (int i = 0; i < waveform->counts[level]; i++) {
+                const waveform_bucket_t* a = &below[2 * i];
+                const waveform_bucket_t* b = (2 * i + 1 < below_count) ? &below[2 * i + 1] : a;
+                waveform->levels[level][i] = (waveform_bucket_t) {
+                    min(a->min, b->min),
+                    max(a->max, b->max),
+                    (uint16_t)lround(sqrt(((double)a->rms * a->rms + (double)b->rms * b->rms) / 2)),
+                };
+            }
+        }
+    }
+
+    kv_destroy(base);
+    return ok;
+}
+
+bool _set_levels(waveform_t* waveform, int base_count) {
+    int total = 0;
+    int count = base_count;
+    waveform->level_count = 0;
+    while (waveform->level_count < WAVEFORM_MAX_LEVELS) {
+        waveform->counts[waveform->level_count++] = count;
+        total += count;
+        if (count == 1)
+            break;
+        count = (count + 1) / 2;
+    }
+
+    waveform->buckets = malloc(total * sizeof(waveform_bucket_t));
+    if (!waveform->buckets) {
+        LOG("Failed to allocate the waveform");
+        return false;
+    }
+    waveform_bucket_t* level = waveform->buckets;
+    for (int i = 0; i < waveform->level_count; i++) {
+        waveform->levels[i] = level;
+        level += waveform->counts[i];
+    }
+    return true;
+}
+
+bool _load_cache(waveform_t* waveform, const char* cache_filepath) {
+    if (!FileExists(cache_filepath))
+        return false;
+
+    unsigned int size = 0;
+    unsigned char* data = LoadFileData(cache_filepath, &size);
+    if (!data)
+        return false;
+
+    cache_header_t header = {0};
+    if (size >= sizeof(header))
+        memcpy(&header, data, sizeof(header));
+
+    bool is_valid =
+        header.magic == CACHE_MAGIC &&
+        header.base_frames == WAVEFORM_BASE_FRAMES &&
+        header.base_count > 0 &&
+        _set_levels(waveform, header.base_count);
+
+    size_t bucket_count = 0;
+    for (int i = 0; is_valid && i < waveform->level_count; i++)
+        bucket_count += waveform->counts[i];
+    if (is_valid && size == sizeof(header) + bucket_count * sizeof(waveform_bucket_t)) {
+        memcpy(waveform->buckets, data + sizeof(header), bucket_count * sizeof(waveform_bucket_t));
+        waveform->sample_rate = header.sample_rate;
+        waveform->frame_count = header.frame_count;
+    }
+    else if (is_valid) {
+        free(waveform->buckets);
+        waveform->buckets = NULL;
+        is_valid = false;
+    }
+
+    if (!is_valid)
+        LOGF("Ignoring stale waveform \"%s\"", cache_filepath);
+    UnloadFileData(data);
+    return is_valid;
+}
+
+void _store_cache(const waveform_t* waveform, const char* cache_filepath) {
+    cache_header_t header = {
+        CACHE_MAGIC,
+        WAVEFORM_BASE_FRAMES,
+        waveform->sample_rate,
+        waveform->counts[0],
+        waveform->frame_count,
+    };
+    size_t bucket_count = 0;
+    for (int i = 0; i < waveform->level_count; i++)
+        bucket_count += waveform->counts[i];
+    unsigned int size = sizeof(header) + bucket_count * sizeof(waveform_bucket_t);
+
+    unsigned char* data = malloc(size);
+    if (!data)
+        return;
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), waveform->buckets, bucket_count * sizeof(waveform_bucket_t));
+
+    if (!SaveFileData(cache_filepath, data, size))
+        LOGF("Failed to write \"%s\"", cache_filepath);
+    free(data);
+}
+
+int16_t _quantize(float value) {
+    return (int16_t)lrintf(CONSTRAIN(value, -1.0f, 1.0f) * 32767);
+}
@@ -0,0 +1,61 @@
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include <defines.h>
+
+// Frames per bucket of the finest level, every level above has buckets twice as long
+#ifndef WAVEFORM_BASE_FRAMES
+#define WAVEFORM_BASE_FRAMES 64
+#endif
+
+#define WAVEFORM_MAX_LEVELS 32
+
+
+// Of the mono mix, 32767 is full scale
+typedef struct waveform_bucket_s {
+    int16_t     min;
+    int16_t     max;
+    uint16_t    rms;
+} waveform_bucket_t;
+
+// What one pixel column shows, -1..1, all zero past either end of the song
+typedef struct waveform_column_s {
+    float       min;
+    float       max;
+    float       rms;
+} waveform_column_t;
+
+typedef struct waveform_s {
+    char                filepath[512];
+    char                cache_directory[512];   // empty without a cache
+    int                 sample_rate;
+    uint64_t            frame_count;
+    int                 level_count;
+    waveform_bucket_t*  levels[WAVEFORM_MAX_LEVELS];    // level i has buckets of WAVEFORM_BASE_FRAMES << i frames
+    int                 counts[WAVEFORM_MAX_LEVELS];
+    waveform_bucket_t*  buckets;                // all levels, finest first
+    pthread_t           thread;
+    bool                has_thread;
+    atomic_bool         is_ready;
+    atomic_bool         quit;
+} waveform_t;
+
+
+// Loads the pyramid of filepath from cache_directory (optional) or builds it from the decoded
+// file and stores it there. Both happen on a thread of its own, the waveform is empty until
+// waveform_is_ready() and must not move until it is destroyed.
+bool waveform_load(waveform_t* waveform, const char* filepath, const char* cache_directory);
+void waveform_destroy(waveform_t* waveform);
+bool waveform_is_ready(const waveform_t* waveform);
+
+// Fills count columns from start seconds on, at pixels_per_second columns per second. Reads
+// the level with buckets just shorter than a column, so it takes O(count) at any zoom.
+// Returns false while the waveform is not ready.
+bool waveform_columns(const waveform_t* waveform, double start, double pixels_per_second, waveform_column_t* columns, int count);
+
+
+#endif